@@ -7,6 +7,10 @@
 //
 
 #include "D.h"
+#include "Dsuite_pipeline.h"
+#include "Dsuite_cache.h"
+#include "Dsuite_bcf.h"
+#include "Dsuite_output.h"
 #include <deque>
 #define SUBPROGRAM "Dinvestigate"
 
@@ -16,6 +20,7 @@ static const char *ABBA_USAGE_MESSAGE =
 "Usage: " PROGRAM_BIN " " SUBPROGRAM " [OPTIONS] INPUT_FILE.vcf.gz SETS.txt test_trios.txt\n"
 "Calculate the admixture proportion estimates f_G, f_d (Martin et al. 2014 MBE), and f_dM (Malinsky et al., 2015)\n"
 "Also outputs f_d and f_dM in genomic windows\n"
+"The INPUT_FILE can also be a BCF file, or a genotype cache (" GENOTYPE_CACHE_EXT ") made by " PROGRAM_BIN " cache\n"
 "The SETS.txt file should have two columns: SAMPLE_ID    POPULATION_ID\n"
 "The test_trios.txt should contain names of three populations for which the statistics will be calculated:\n"
 "POP1   POP2    POP3\n"
@@ -25,19 +30,34 @@ static const char *ABBA_USAGE_MESSAGE =
 "       -w SIZE,STEP --window=SIZE,STEP         (required) D, f_D, and f_dM statistics for windows containing SIZE useable SNPs, moving by STEP (default: 50,25)\n"
 //"       --fJackKnife=WINDOW                     (optional) Calculate jackknife for the f_G statistic from Green et al. Also outputs \n"
 "       -n, --run-name                          run-name will be included in the output file name\n"
+"       -r , --region=chr:start-end             (optional) only process the variants in this region (or a whole chromosome: --region=chr)\n"
+"                                               with a bgzipped VCF and a tabix (.tbi) or .csi index, reading starts straight at the region\n"
+"       --regions=REGIONS.bed                   (optional) only process the variants in the regions listed in a BED file\n"
+"                                               without an index, the sites are read in the order of the VCF file\n"
+"       --threads=N                             (default=1) use N threads to split the test trios between (and N threads to get the allele counts)\n"
+"       --seed=N                                (default=1) the seed for the random splits of the P3 population for f_G; a site is split\n"
+"                                               the same way whatever the number of threads and the input format\n"
+"       --single-file=FILE                      (optional) output the windows of all the test trios to one file, with the trio in the first three columns,\n"
+"                                               instead of a file for each trio; compressed with gzip if FILE ends with .gz\n"
 "\n"
 "\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
 
 
 //enum { OPT_F_JK };
+enum { OPT_REGIONS = 1, OPT_THREADS, OPT_SINGLE_FILE, OPT_SEED };
 
-static const char* shortopts = "hw:n:";
+static const char* shortopts = "hw:n:r:";
 
 //static const int JK_WINDOW = 5000;
 
 static const struct option longopts[] = {
     { "run-name",   required_argument, NULL, 'n' },
     { "window",   required_argument, NULL, 'w' },
+    { "region",   required_argument, NULL, 'r' },
+    { "regions",   required_argument, NULL, OPT_REGIONS },
+    { "threads",   required_argument, NULL, OPT_THREADS },
+    { "single-file",   required_argument, NULL, OPT_SINGLE_FILE },
+    { "seed",   required_argument, NULL, OPT_SEED },
     { "help",   no_argument, NULL, 'h' },
     { NULL, 0, NULL, 0 }
 };
@@ -51,14 +71,66 @@ namespace opt
     static int minScLength = 0;
     static int windowSize = 50;
     static int windowStep = 25;
+    static std::vector<GenomicRegion> regions; // From --region and --regions
+    static string regionsName = ""; // Goes into the output file names
+    static int numThreads = 1;
+    static string singleFile = "";
+    static uint64_t seed = 1;
     //int jkWindowSize = JK_WINDOW;
 }
 
 
+// A batch of VCF lines on its way through the reading -> allele counts -> test trio statistics pipeline
+struct AbbaBabaLineBatch {
+    std::vector<string> lines; int nLines;
+    uint64_t firstSite; // With a genotype cache the batch is the sites [firstSite, firstSite + nLines) instead of the lines
+    LineTokenizer fields; // Reused for every line in the batch
+    std::vector<GeneralSetCountsWithSplits> counts; // Reused from batch to batch
+    std::vector<bool> usable; // false if the line can't be used
+    std::vector<string> chrs; std::vector<string> coords;
+    std::vector<double> positions; // The coords as numbers
+};
+
+// The sums of each of a few columns over the last windowSize rows, kept up to date in constant time as each new row comes in
+// (the oldest row goes out) with the rows in a ring buffer. The running sums are recalculated from the rows every windowSize rows,
+// which stops rounding errors from building up
+class WindowSums {
+public:
+    WindowSums(int nColumns, int windowSize) : nColumns(nColumns), windowSize(windowSize), rows((size_t)nColumns * windowSize, 0.0), sums(nColumns, 0.0), oldest(0), nSinceRecalculated(0) {};
+    
+    void add(const double* row) {
+        double* slot = &rows[(size_t)oldest * nColumns];
+        for (int k = 0; k != nColumns; k++) { sums[k] += row[k] - slot[k]; slot[k] = row[k]; }
+        if (++oldest == windowSize) oldest = 0;
+        if (++nSinceRecalculated == windowSize) recalculate();
+    }
+    double sum(int column) const { return sums[column]; }
+    double oldestValue(int column) const { return rows[(size_t)oldest * nColumns + column]; }
+    
+private:
+    int nColumns; int windowSize;
+    std::vector<double> rows;
+    std::vector<double> sums;
+    int oldest; // The row that goes out next
+    int nSinceRecalculated;
+    
+    void recalculate() { // From the oldest to the newest row
+        for (int k = 0; k != nColumns; k++) sums[k] = 0;
+        for (int r = 0; r != windowSize; r++) {
+            const double* row = &rows[(size_t)((oldest + r) % windowSize) * nColumns];
+            for (int k = 0; k != nColumns; k++) sums[k] += row[k];
+        }
+        nSinceRecalculated = 0;
+    }
+};
+
 void doAbbaBaba() {
     string line; // for reading the input files
     
-    std::istream* vcfFile = createReader(opt::vcfFile);
+    std::istream* vcfFile = NULL; GenotypeCache* genotypeCache = NULL; BcfFile* bcfFile = NULL;
+    if (isGenotypeCache(opt::vcfFile)) genotypeCache = new GenotypeCache(opt::vcfFile);
+    else if (isBcf(opt::vcfFile)) { bcfFile = new BcfFile(opt::vcfFile); vcfFile = bcfFile->stream(); }
+    else vcfFile = createReader(opt::vcfFile);
     std::ifstream* setsFile = new std::ifstream(opt::setsFile.c_str());
     std::ifstream* testTriosFile = new std::ifstream(opt::testTriosFile.c_str());
     
@@ -66,7 +138,6 @@ void doAbbaBaba() {
     std::map<string, std::vector<string>> speciesToIDsMap;
     std::map<string, string> IDsToSpeciesMap;
     std::map<string, std::vector<size_t>> speciesToPosMap;
-    std::map<size_t, string> posToSpeciesMap;
     
     // Get the sample sets
     bool outgroupSpecified = false;
@@ -94,7 +165,12 @@ void doAbbaBaba() {
     
     
     // Get the test trios
-    std::vector<std::ofstream*> outFiles;
+    std::vector<ResultWriter*> outFiles; // With smaller buffers than usual, as there can be many test trios
+    ResultWriter* singleOutFile = NULL; // Instead of outFiles with --single-file
+    if (opt::singleFile != "") {
+        singleOutFile = new ResultWriter(opt::singleFile, opt::numThreads > 1);
+        *singleOutFile << "P1\tP2\tP3\tchr\twindowStart\twindowEnd\tD\tf_d\tf_dM" << std::endl;
+    }
     std::vector<std::ofstream*> outFilesGenes;
     std::vector<std::vector<string> > testTrios;
     while (getline(*testTriosFile,line)) {
@@ -104,26 +180,26 @@ void doAbbaBaba() {
         for (int i = 0; i != threePops.size(); i++) { // Check that the test trios are in the sets file
             if (speciesToIDsMap.count(threePops[i]) == 0) {
                 std::cerr << threePops[i] << " is present in the " << opt::testTriosFile << " but missing from the " << opt::setsFile << std::endl;
+                exit(EXIT_FAILURE);
             }
         }
-        std::ofstream* outFile = new std::ofstream(threePops[0] + "_" + threePops[1] + "_" + threePops[2]+ "_localFstats_" + opt::runName + "_" + numToString(opt::windowSize) + "_" + numToString(opt::windowStep) + ".txt");
+        testTrios.push_back(threePops);
+        if (singleOutFile != NULL) continue;
+        ResultWriter* outFile = new ResultWriter(threePops[0] + "_" + threePops[1] + "_" + threePops[2]+ "_localFstats_" + opt::runName + "_" + (opt::regionsName == "" ? "" : opt::regionsName + "_") + numToString(opt::windowSize) + "_" + numToString(opt::windowStep) + ".txt", false, 1 << 16);
         *outFile << "chr\twindowStart\twindowEnd\tD\tf_d\tf_dM" << std::endl;
         outFiles.push_back(outFile);
-        testTrios.push_back(threePops);
     }
     
-    // And need to prepare the vectors to hold the PBS values and the coordinates:
-    std::deque<double> initDeq(opt::windowSize,0.0); // deque to initialise per-site values
-    // vector of three per-site PBS deques - for (ABBA-BABA), and the Fg, Fd, and Fdm denominators
+    // And need to prepare the windows of per-site values: ABBA, BABA, and the f_d and f_dM denominators
     // and the final is for the coordinates
-    std::vector<std::deque<double>> initFiveDeques(5,initDeq);
-    std::vector<std::vector<std::deque<double>>> testTrioResults(testTrios.size(),initFiveDeques);
+    enum { WINDOW_ABBA, WINDOW_BABA, WINDOW_F_D_DENOM, WINDOW_F_DM_DENOM, WINDOW_COORD, N_WINDOW_COLUMNS };
+    std::vector<WindowSums> testTrioResults(testTrios.size(), WindowSums(N_WINDOW_COLUMNS, opt::windowSize));
     
     // Now go through the vcf and calculate D
-    int totalVariantNumber = 0;
+    int totalVariantNumber = 0; int nSamples = 0;
     std::vector<int> usedVars(testTrios.size(),0); // Will count the number of used variants for each trio
     std::vector<int> usedVars_f_G(testTrios.size(),0); // Will count the number of used variants for each trio
-    int reportProgressEvery = 1000; string chr; string coord;
+    int reportProgressEvery = 1000;
     std::vector<double> ABBAtotals(testTrios.size(),0); std::vector<double> BABAtotals(testTrios.size(),0);
     std::vector<double> Genome_f_G_num(testTrios.size(),0); std::vector<double> Genome_f_G_denom(testTrios.size(),0);
     std::vector<double> Genome_f_D_denom(testTrios.size(),0); std::vector<double> Genome_f_DM_denom(testTrios.size(),0);
@@ -131,69 +207,139 @@ void doAbbaBaba() {
    // int lastPrint = 0; int lastWindowVariant = 0;
    // std::vector<double> regionDs; std::vector<double> region_f_Gs; std::vector<double> region_f_Ds; std::vector<double> region_f_DMs;
     std::vector<string> sampleNames; std::vector<std::string> fields;
-    clock_t start; clock_t startGettingCounts; clock_t startCalculation;
-    double durationOverall; double durationGettingCounts; double durationCalculation;
-    while (getline(*vcfFile, line)) {
-        line.erase(std::remove(line.begin(), line.end(), '\r'), line.end()); // Deal with any left over \r from files prepared on Windows
-        if (line[0] == '#' && line[1] == '#')
-            continue;
-        else if (line[0] == '#' && line[1] == 'C') {
-            fields = split(line, '\t');
-            std::vector<std::string> sampleNames(fields.begin()+NUM_NON_GENOTYPE_COLUMNS,fields.end());
-            // print_vector_stream(sampleNames, std::cerr);
-            for (std::vector<std::string>::size_type i = 0; i != sampleNames.size(); i++) {
-                posToSpeciesMap[i] = IDsToSpeciesMap[sampleNames[i]];
+    clock_t start;
+    double durationOverall;
+    if (genotypeCache != NULL) {
+        sampleNames = genotypeCache->sampleNames;
+    } else if (bcfFile != NULL) {
+        sampleNames = bcfFile->sampleNames;
+    } else {
+        while (getline(*vcfFile, line)) {
+            line.erase(std::remove(line.begin(), line.end(), '\r'), line.end()); // Deal with any left over \r from files prepared on Windows
+            if (line[0] == '#' && line[1] == '#')
+                continue;
+            else if (line[0] == '#' && line[1] == 'C') {
+                fields = split(line, '\t');
+                sampleNames.assign(fields.begin()+NUM_NON_GENOTYPE_COLUMNS,fields.end());
+                break; // The rest of the file is processed by the pipeline below
+            }
+        }
+    }
+    // print_vector_stream(sampleNames, std::cerr);
+    nSamples = (int)sampleNames.size();
+    // Iterate over all the keys in the map to find the samples in the VCF:
+    // Give an error if no sample is found for a species:
+    for(std::map<string, std::vector<string>>::iterator it = speciesToIDsMap.begin(); it != speciesToIDsMap.end(); ++it) {
+        string sp =  it->first;
+        //std::cerr << "sp " << sp << std::endl;
+        std::vector<string> IDs = it->second;
+        std::vector<size_t> spPos = locateSet(sampleNames, IDs);
+        if (spPos.empty()) {
+            std::cerr << "Did not find any samples in the VCF for \"" << sp << "\"" << std::endl;
+            assert(!spPos.empty());
+        }
+        speciesToPosMap[sp] = spPos;
+    }
+    start = clock();
+    SetIndex sets(speciesToPosMap, nSamples);
+    std::vector<std::vector<int> > testTrioIDs(testTrios.size(), std::vector<int>(3)); // Test trio species -> IDs for the allele counts
+    for (int i = 0; i != testTrios.size(); i++) {
+        for (int j = 0; j != 3; j++) testTrioIDs[i][j] = sets.getID(testTrios[i][j]);
+    }
+    
+    // Pipeline stage 1: read the variant lines in batches
+    bool doneReading = false;
+    RegionLineReader* regionReader = NULL;
+    if (bcfFile != NULL && !opt::regions.empty()) regionReader = new RegionLineReader(bcfFile, opt::vcfFile, opt::regions);
+    else if (vcfFile != NULL && !opt::regions.empty()) regionReader = new RegionLineReader(vcfFile, opt::vcfFile, opt::regions);
+    std::vector<std::pair<uint64_t, uint64_t> > cacheRanges; size_t cacheRange = 0; uint64_t nextSite = 0; // The ranges of sites to read from the cache
+    if (genotypeCache != NULL) {
+        if (!opt::regions.empty()) cacheRanges = genotypeCache->sitesInRegions(opt::regions);
+        else cacheRanges.push_back(std::make_pair((uint64_t)0, genotypeCache->nSites));
+        if (!cacheRanges.empty()) nextSite = cacheRanges[0].first;
+    }
+    std::function<bool(AbbaBabaLineBatch&)> readLines = [&](AbbaBabaLineBatch& b) -> bool {
+        b.nLines = 0; size_t nBytes = 0;
+        if (genotypeCache != NULL) { // The sites are already in memory, so the batch is just a range of them
+            if (cacheRange < cacheRanges.size() && nextSite == cacheRanges[cacheRange].second) {
+                if (++cacheRange < cacheRanges.size()) nextSite = cacheRanges[cacheRange].first;
             }
-            // Iterate over all the keys in the map to find the samples in the VCF:
-            // Give an error if no sample is found for a species:
-            for(std::map<string, std::vector<string>>::iterator it = speciesToIDsMap.begin(); it != speciesToIDsMap.end(); ++it) {
-                string sp =  it->first;
-                //std::cerr << "sp " << sp << std::endl;
-                std::vector<string> IDs = it->second;
-                std::vector<size_t> spPos = locateSet(sampleNames, IDs);
-                if (spPos.empty()) {
-                    std::cerr << "Did not find any samples in the VCF for \"" << sp << "\"" << std::endl;
-                    assert(!spPos.empty());
+            b.firstSite = nextSite;
+            while (cacheRange < cacheRanges.size() && nextSite < cacheRanges[cacheRange].second && b.nLines < VCF_LINES_PER_BATCH) {
+                int variantNumber = (int)genotypeCache->variantNumber(nextSite);
+                if (variantNumber / reportProgressEvery > totalVariantNumber / reportProgressEvery) {
+                    durationOverall = ( clock() - start ) / (double) CLOCKS_PER_SEC;
+                    std::cerr << "Processed " << (variantNumber / reportProgressEvery) * reportProgressEvery << " variants in " << durationOverall << "secs" << std::endl;
                 }
-                speciesToPosMap[sp] = spPos;
+                totalVariantNumber = variantNumber; nextSite++; b.nLines++;
             }
-            start = clock();
-        } else {
+            return b.nLines > 0;
+        }
+        while (!doneReading && b.nLines < VCF_LINES_PER_BATCH && nBytes < VCF_BYTES_PER_BATCH) {
+            if (b.nLines == (int)b.lines.size()) b.lines.resize(b.nLines + 1);
+            string& thisLine = b.lines[b.nLines];
+            bool gotLine;
+            if (regionReader != NULL) gotLine = regionReader->getNextLine(thisLine);
+            else if (bcfFile != NULL) gotLine = bcfFile->getNextRecord(thisLine); // A binary record rather than a line
+            else gotLine = (bool)getline(*vcfFile, thisLine);
+            if (!gotLine) { doneReading = true; break; }
+            if (bcfFile == NULL && (thisLine.empty() || thisLine[0] == '#')) continue;
             totalVariantNumber++;
             if (totalVariantNumber % reportProgressEvery == 0) {
                 durationOverall = ( clock() - start ) / (double) CLOCKS_PER_SEC;
                 std::cerr << "Processed " << totalVariantNumber << " variants in " << durationOverall << "secs" << std::endl;
-                std::cerr << "GettingCounts " << durationGettingCounts << " calculation " << durationCalculation << "secs" << std::endl;
             }
-            fields = split(line, '\t'); chr = fields[0]; coord = fields[1];
-            std::vector<std::string> genotypes(fields.begin()+NUM_NON_GENOTYPE_COLUMNS,fields.end());
-            // Only consider biallelic SNPs
-            string refAllele = fields[3]; string altAllele = fields[4];
-            if (refAllele.length() > 1 || altAllele.length() > 1 || altAllele == "*") {
-                refAllele.clear(); refAllele.shrink_to_fit(); altAllele.clear(); altAllele.shrink_to_fit();
-                genotypes.clear(); genotypes.shrink_to_fit(); continue;
+            nBytes += thisLine.length(); b.nLines++;
+        }
+        return b.nLines > 0;
+    };
+    
+    // Pipeline stage 2: get the allele counts and frequencies, including the random splits for f_G
+    std::function<void(AbbaBabaLineBatch&)> getCounts = [&](AbbaBabaLineBatch& b) {
+        // The counts objects are allocated only once for each batch and then reset for every new line
+        while (b.counts.size() < b.nLines) b.counts.push_back(GeneralSetCountsWithSplits(sets, nSamples));
+        b.usable.assign(b.nLines, false); b.chrs.resize(b.nLines); b.coords.resize(b.nLines); b.positions.resize(b.nLines);
+        for (int l = 0; l != b.nLines; l++) {
+            GeneralSetCountsWithSplits* c = &b.counts[l];
+            if (genotypeCache != NULL) { // The cache has only biallelic SNPs
+                uint64_t site = b.firstSite + l;
+                b.chrs[l] = genotypeCache->chromNames[genotypeCache->chrom(site)]; b.coords[l] = numToString(genotypeCache->pos(site)); b.positions[l] = genotypeCache->pos(site);
+                c->reset(); c->getSplitCounts(genotypeCache->genotypes(site), splitSiteKey(opt::seed, b.chrs[l], genotypeCache->pos(site)));
+            } else if (bcfFile != NULL) { // The genotypes are decoded straight from the typed values, without any text
+                BcfRecord record(b.lines[l], *bcfFile);
+                b.chrs[l] = bcfFile->contigName(record.chromID); b.coords[l] = numToString(record.pos); b.positions[l] = record.pos;
+                if (!record.isBiallelicSNP()) continue;
+                c->reset(); c->getSplitCounts(record.genotypes(), splitSiteKey(opt::seed, b.chrs[l], record.pos));
+            } else {
+                b.fields.tokenize(b.lines[l]);
+                b.fields.assignField(0, b.chrs[l]); b.fields.assignField(1, b.coords[l]); b.positions[l] = stringToDouble(b.coords[l]);
+                if (!isBiallelicSNP(b.fields)) continue; // Only consider biallelic SNPs
+                c->reset(); c->getSplitCounts(b.fields, splitSiteKey(opt::seed, b.chrs[l], (uint64_t)b.positions[l]));
             }
-            
-            startGettingCounts = clock();
-            GeneralSetCountsWithSplits* c = new GeneralSetCountsWithSplits(speciesToPosMap, (int)genotypes.size());
-            c->getSplitCounts(genotypes, posToSpeciesMap);
-            genotypes.clear(); genotypes.shrink_to_fit();
-            durationGettingCounts = ( clock() - startGettingCounts ) / (double) CLOCKS_PER_SEC;
-            
-            startCalculation = clock();
-            double p_O = c->setDAFs.at("Outgroup");
-            if (p_O == -1) { delete c; continue; } // We need to make sure that the outgroup is defined
+            if (c->setDAFs[sets.outgroupID] == -1) continue; // We need to make sure that the outgroup is defined
+            b.usable[l] = true;
+        }
+    };
+    
+    // Pipeline stage 3: go through the sites in the order of the VCF and calculate the statistics for the test trios [trioFrom, trioTo)
+    // With --single-file, the windows go into a buffer with the site of each of them, to be put in order with the other threads' windows
+    struct WindowLines { ResultBuffer text; std::vector<size_t> lineEnds; std::vector<int> lineSites; };
+    int nThreads = std::min(opt::numThreads, std::max((int)testTrios.size(), 1));
+    std::vector<WindowLines> threadWindows(nThreads);
+    auto addTrioRange = [&](AbbaBabaLineBatch& b, int trioFrom, int trioTo, WindowLines& windows) {
+        for (int l = 0; l != b.nLines; l++) {
+            if (!b.usable[l]) continue;
+            GeneralSetCountsWithSplits* c = &b.counts[l];
+            const string& chr = b.chrs[l]; const string& coord = b.coords[l];
+            double p_O = c->setDAFs[sets.outgroupID];
             
             double p_S1; double p_S2; double p_S3; double ABBA; double BABA; double F_d_denom; double F_dM_denom;
-            for (int i = 0; i != testTrios.size(); i++) {
-                try { p_S1 = c->setDAFs.at(testTrios[i][0]); } catch (const std::out_of_range& oor) {
-                std::cerr << "Counts don't contain derived allele frequency for " << testTrios[i][0] << std::endl; }
+            for (int i = trioFrom; i != trioTo; i++) {
+                p_S1 = c->setDAFs[testTrioIDs[i][0]];
                 if (p_S1 == -1) continue;  // If any member of the trio has entirely missing data, just move on to the next trio
-                try { p_S2 = c->setDAFs.at(testTrios[i][1]); } catch (const std::out_of_range& oor) {
-                    std::cerr << "Counts don't contain derived allele frequency for " << testTrios[i][1] << std::endl; }
+                p_S2 = c->setDAFs[testTrioIDs[i][1]];
                 if (p_S2 == -1) continue;
-                try { p_S3 = c->setDAFs.at(testTrios[i][2]); } catch (const std::out_of_range& oor) {
-                    std::cerr << "Counts don't contain derived allele frequency for " << testTrios[i][0] << std::endl; }
+                p_S3 = c->setDAFs[testTrioIDs[i][2]];
                 if (p_S3 == -1) continue;
                 usedVars[i]++;
                 
@@ -219,8 +365,8 @@ void doAbbaBaba() {
                     }
                 } Genome_f_DM_denom[i] += F_dM_denom;
                 
-                if (c->setAlleleCountsSplit1.at(testTrios[i][2]) > 0 && c->setAlleleCountsSplit2.at(testTrios[i][2]) > 0) {
-                    double p_S3a = c->setAAFsplit1.at(testTrios[i][2]); double p_S3b = c->setAAFsplit2.at(testTrios[i][2]);
+                if (c->setAlleleCountsSplit1[testTrioIDs[i][2]] > 0 && c->setAlleleCountsSplit2[testTrioIDs[i][2]] > 0) {
+                    double p_S3a = c->setAAFsplit1[testTrioIDs[i][2]]; double p_S3b = c->setAAFsplit2[testTrioIDs[i][2]];
                     Genome_f_G_num[i] += ABBA - BABA;
                     Genome_f_G_denom[i] += ((1-p_S1)*p_S3a*p_S3b*(1-p_O)) - (p_S1*(1-p_S3a)*p_S3b*(1-p_O));
                     usedVars_f_G[i]++;
@@ -232,25 +378,54 @@ void doAbbaBaba() {
                 
                 ABBAtotals[i] += ABBA;
                 BABAtotals[i] += BABA;
-                testTrioResults[i][0].push_back(ABBA); testTrioResults[i][1].push_back(BABA); testTrioResults[i][2].push_back(F_d_denom);
-                testTrioResults[i][3].push_back(F_dM_denom); testTrioResults[i][4].push_back(stringToDouble(coord));
-                testTrioResults[i][0].pop_front(); testTrioResults[i][1].pop_front(); testTrioResults[i][2].pop_front();
-                testTrioResults[i][3].pop_front(); testTrioResults[i][4].pop_front();
+                double windowRow[N_WINDOW_COLUMNS] = { ABBA, BABA, F_d_denom, F_dM_denom, b.positions[l] };
+                testTrioResults[i].add(windowRow);
             
             
                 if (usedVars[i] > opt::windowSize && (usedVars[i] % opt::windowStep == 0)) {
-                    double wABBA = vector_sum(testTrioResults[i][0]); double wBABA = vector_sum(testTrioResults[i][1]);
+                    double wABBA = testTrioResults[i].sum(WINDOW_ABBA); double wBABA = testTrioResults[i].sum(WINDOW_BABA);
                     double wDnum = wABBA - wBABA; double wDdenom = wABBA + wBABA;
-                    double wF_d_denom = vector_sum(testTrioResults[i][2]); double wF_dM_denom = vector_sum(testTrioResults[i][3]);
-                    *outFiles[i] << chr << "\t" << testTrioResults[i][4][0] << "\t" << coord << "\t" << wDnum/wDdenom << "\t" << wDnum/wF_d_denom << "\t" << wDnum/wF_dM_denom << std::endl;
+                    double wF_d_denom = testTrioResults[i].sum(WINDOW_F_D_DENOM); double wF_dM_denom = testTrioResults[i].sum(WINDOW_F_DM_DENOM);
+                    ResultBuffer& outFile = (singleOutFile != NULL) ? windows.text : *outFiles[i];
+                    if (singleOutFile != NULL) outFile << testTrios[i][0] << "\t" << testTrios[i][1] << "\t" << testTrios[i][2] << "\t";
+                    outFile << chr << "\t" << testTrioResults[i].oldestValue(WINDOW_COORD) << "\t" << coord << "\t" << wDnum/wDdenom << "\t" << wDnum/wF_d_denom << "\t" << wDnum/wF_dM_denom << std::endl;
+                    if (singleOutFile != NULL) { windows.lineEnds.push_back(windows.text.str().length()); windows.lineSites.push_back(l); }
                 }
             }
-            durationCalculation = ( clock() - startCalculation ) / (double) CLOCKS_PER_SEC;
-            delete c;
-
         }
-    }
+    };
+    std::function<void(AbbaBabaLineBatch&)> addToTrios = [&](AbbaBabaLineBatch& b) {
+        if (nThreads == 1) {
+            addTrioRange(b, 0, (int)testTrios.size(), threadWindows[0]);
+        } else {
+            std::vector<std::thread> workers;
+            for (int t = 0; t != nThreads; t++) {
+                int trioFrom = (int)(((long long)testTrios.size() * t) / nThreads);
+                int trioTo = (int)(((long long)testTrios.size() * (t+1)) / nThreads);
+                workers.push_back(std::thread(addTrioRange, std::ref(b), trioFrom, trioTo, std::ref(threadWindows[t])));
+            }
+            for (int t = 0; t != nThreads; t++) workers[t].join();
+        }
+        if (singleOutFile == NULL) return;
+        // In the order of the sites, and of the trios at each site
+        std::vector<size_t> nextLine(nThreads, 0);
+        for (int l = 0; l != b.nLines; l++) {
+            for (int t = 0; t != nThreads; t++) {
+                WindowLines& windows = threadWindows[t];
+                for (size_t& j = nextLine[t]; j != windows.lineSites.size() && windows.lineSites[j] == l; j++) {
+                    size_t lineStart = (j == 0) ? 0 : windows.lineEnds[j - 1];
+                    singleOutFile->write(windows.text.str().data() + lineStart, windows.lineEnds[j] - lineStart);
+                }
+            }
+        }
+        for (int t = 0; t != nThreads; t++) { threadWindows[t].text.clear(); threadWindows[t].lineEnds.clear(); threadWindows[t].lineSites.clear(); }
+    };
+    
+    // The f_G splits are drawn from the seed and the site, not in sequence, so the batches can be counted on any thread
+    runBatchPipeline<AbbaBabaLineBatch>(opt::numThreads, readLines, getCounts, addToTrios);
     
+    for (int i = 0; i != outFiles.size(); i++) delete outFiles[i];
+    delete singleOutFile;
     for (int i = 0; i != testTrios.size(); i++) {
         std::cout << testTrios[i][0] << "\t" << testTrios[i][1] << "\t" << testTrios[i][2] << std::endl;
         std::cout << "D=" << (double)(ABBAtotals[i]-BABAtotals[i])/(ABBAtotals[i]+BABAtotals[i]) << std::endl;
@@ -285,12 +460,31 @@ void parseAbbaBabaOptions(int argc, char** argv) {
                 opt::windowStep = atoi(windowSizeStep[1].c_str());
                 break;
             case 'n': arg >> opt::runName; break;
+            case OPT_THREADS: arg >> opt::numThreads; break;
+            case OPT_SINGLE_FILE: arg >> opt::singleFile; break;
+            case OPT_SEED: arg >> opt::seed; break;
+            case 'r': {
+                GenomicRegion r = parseRegion(arg.str()); opt::regions.push_back(r);
+                if (opt::regionsName == "") opt::regionsName = r.chrom + ((r.end == INT_MAX) ? "" : "_" + numToString(r.start) + "_" + numToString(r.end));
+                break;
+            }
+            case OPT_REGIONS: {
+                std::vector<GenomicRegion> bedRegions = readBedRegions(arg.str());
+                opt::regions.insert(opt::regions.end(), bedRegions.begin(), bedRegions.end());
+                string bedName = stripExtension(arg.str()); bedName = bedName.substr(bedName.find_last_of('/') + 1);
+                opt::regionsName = bedName; break;
+            }
             case 'h':
                 std::cout << ABBA_USAGE_MESSAGE;
                 exit(EXIT_SUCCESS);
         }
     }
     
+    if (opt::numThreads < 1) {
+        std::cerr << "The number of threads must be at least 1\n";
+        die = true;
+    }
+    
     if (argc - optind < 3) {
         std::cerr << "missing arguments\n";
         die = true;
@@ -7,6 +7,16 @@
 //
 
 #include "Dmin.h"
+#include "Dsuite_pipeline.h"
+#include "Dmin_trios.h"
+#include "Dsuite_cache.h"
+#include "Dsuite_index.h"
+#include "Dsuite_bcf.h"
+#include "Dmin_checkpoint.h"
+#include "Dmin_combine_binary.h"
+#include "Dsuite_output.h"
+#include <limits.h>
+#include <sys/stat.h>
 
 #define SUBPROGRAM "Dtrios"
 
@@ -16,24 +26,52 @@ static const char *DMIN_USAGE_MESSAGE =
 "Usage: " PROGRAM_BIN " " SUBPROGRAM " [OPTIONS] INPUT_FILE.vcf SETS.txt\n"
 "Calculate the Dmin-statistic - the ABBA/BABA stat for all trios of species in the dataset (the outgroup being fixed)\n"
 "the calculation is as definded in Durand et al. 2011\n"
+"The INPUT_FILE can also be a BCF file, or a genotype cache (" GENOTYPE_CACHE_EXT ") made by " PROGRAM_BIN " cache\n"
 "The SETS.txt should have two columns: SAMPLE_ID    SPECIES_ID\n"
 "The outgroup (can be multiple samples) should be specified by using the keywork Outgroup in place of the SPECIES_ID\n"
 "\n"
 "       -h, --help                              display this help and exit\n"
 "       -j, --JKwindow                          (default=20000) Jackknife block size in SNPs\n"
 "       -r , --region=start,length              (optional) only process a subset of the VCF file\n"
+"                                               with an index made by " PROGRAM_BIN " index, reading starts straight at the subset\n"
+"       -r , --region=chr:start-end             (optional) only process the variants in this region (or a whole chromosome: --region=chr)\n"
+"                                               with a bgzipped VCF and a tabix (.tbi) or .csi index, reading starts straight at the region\n"
+"       --regions=REGIONS.bed                   (optional) only process the variants in the regions listed in a BED file\n"
+"                                               without an index, the sites are read in the order of the VCF file\n"
 "       -t , --tree=TREE_FILE.nwk               (optional) a file with a tree in the newick format specifying the relationships between populations/species\n"
 "                                               D values for trios arranged according to these relationships will be output in a file with _tree.txt suffix\n"
 "       -n, --run-name                          run-name will be included in the output file name\n"
+"       --threads=N                             (default=1) use N threads to split the trios between when accumulating the ABBA/BABA/BBAA counts\n"
+"       --sparse                                at each site, only visit the trios with the derived allele in at least two species\n"
+"                                               (the results are the same; each visit costs several times as much as a trio in the default loop, so this is only faster\n"
+"                                               when at a typical site fewer than about 1 in 10 species have the derived allele; try Dsuite_bench --derived=F to compare)\n"
+"       --trio-range=start,length               (optional) only calculate the trios numbered start to start+length-1 (counting from 1, in the order of the output)\n"
+"                                               e.g. to split a run with very many species between machines; the outputs can be put back together\n"
+"                                               with " PROGRAM_BIN " DtriosMerge\n"
+"       --checkpoint=MINUTES                    (optional) every MINUTES, save the state of the run to a file with _checkpoint.bin suffix\n"
+"                                               (which is removed when the run finishes)\n"
+"       --resume                                continue from the checkpoint of an earlier run with the same input files and options, if there is one\n"
+"       --binary-combine                        output the counts and jackknife blocks for " PROGRAM_BIN " DtriosCombine in one binary file with " COMBINE_BINARY_EXT " suffix\n"
+"                                               instead of the _combine.txt and _combine_stderr.txt files (smaller and faster to write and read, and the\n"
+"                                               values are not rounded to 6 digits)\n"
 "\n"
 "\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
 
 
+enum { OPT_THREADS = 1, OPT_SPARSE, OPT_REGIONS, OPT_TRIO_RANGE, OPT_CHECKPOINT, OPT_RESUME, OPT_BINARY_COMBINE };
+
 static const char* shortopts = "hr:n:t:j:";
 
 static const struct option longopts[] = {
     { "run-name",   required_argument, NULL, 'n' },
-    { "region",   no_argument, NULL, 'r' },
+    { "region",   required_argument, NULL, 'r' },
+    { "regions",   required_argument, NULL, OPT_REGIONS },
+    { "threads",   required_argument, NULL, OPT_THREADS },
+    { "sparse",   no_argument, NULL, OPT_SPARSE },
+    { "trio-range",   required_argument, NULL, OPT_TRIO_RANGE },
+    { "checkpoint",   required_argument, NULL, OPT_CHECKPOINT },
+    { "resume",   no_argument, NULL, OPT_RESUME },
+    { "binary-combine",   no_argument, NULL, OPT_BINARY_COMBINE },
     { "tree",   required_argument, NULL, 't' },
     { "JKwindow",   required_argument, NULL, 'j' },
     { "help",   no_argument, NULL, 'h' },
@@ -49,33 +87,40 @@ namespace opt
     int jkWindowSize = 20000;
     int regionStart = -1;
     int regionLength = -1;
+    static std::vector<GenomicRegion> regions; // From --region=chr:start-end and --regions
+    static string regionsName = ""; // Goes into the output file names
+    int numThreads = 1;
+    static bool sparse = false;
+    static int64_t trioRangeStart = -1;
+    static int64_t trioRangeLength = -1;
+    static double checkpointMinutes = 0;
+    static bool resume = false;
+    static bool binaryCombine = false;
 }
 
-inline unsigned nChoosek( unsigned n, unsigned k )
-{
-    if (k > n) return 0;
-    if (k * 2 > n) k = n-k;
-    if (k == 0) return 1;
-    
-    int result = n;
-    for( int i = 2; i <= k; ++i ) {
-        result *= (n-i+1);
-        result /= i;
-    }
-    return result;
-}
+// A batch of VCF lines on its way through the reading -> allele frequencies -> trio accumulation pipeline
+struct DminLineBatch {
+    std::vector<string> lines; int nLines;
+    uint64_t firstSite; // With a genotype cache the batch is the sites [firstSite, firstSite + nLines) instead of the lines
+    LineTokenizer fields; // Reused for every line in the batch
+    std::vector<GeneralSetCounts> siteCounts; // Also reused for every line
+    std::vector<double> Ps; // Derived allele frequencies of all the species for each line
+    std::vector<double> POs; // Derived allele frequency in the Outgroup for each line; -1 if the line can't be used
+    DminInputPosition endPosition; // Where the input continues after this batch, for checkpoints
+};
 
 int DminMain(int argc, char** argv) {
     parseDminOptions(argc, argv);
     string line; // for reading the input files
     string setsFileRoot = stripExtension(opt::setsFile);
+    string trioRangeName = (opt::trioRangeStart == -1) ? "" : "_trios_" + numToString(opt::trioRangeStart) + "_" + numToString(opt::trioRangeStart + opt::trioRangeLength);
     std::istream* treeFile;
-    std::ofstream* outFileTree;
+    ResultWriter* outFileTree = NULL;
     std::map<string,std::vector<int>> treeTaxonNamesToLoc; std::vector<int> treeLevels;
     if (opt::treeFile != "") {
         treeFile = new std::ifstream(opt::treeFile.c_str());
         if (!treeFile->good()) { std::cerr << "The file " << opt::treeFile << " could not be opened. Exiting..." << std::endl; exit(1);}
-        outFileTree = new std::ofstream(setsFileRoot+ "_" + opt::runName + "_tree.txt");
+        outFileTree = new ResultWriter(setsFileRoot+ "_" + opt::runName + trioRangeName + "_tree.txt", opt::numThreads > 1);
 
         getline(*treeFile, line);
         // First take care of any branch lengths
@@ -121,31 +166,33 @@ int DminMain(int argc, char** argv) {
         //}
     }
     
-    std::istream* vcfFile = createReader(opt::vcfFile.c_str());
+    std::istream* vcfFile = NULL; GenotypeCache* genotypeCache = NULL; BcfFile* bcfFile = NULL;
+    if (isGenotypeCache(opt::vcfFile)) genotypeCache = new GenotypeCache(opt::vcfFile);
+    else if (isBcf(opt::vcfFile)) { bcfFile = new BcfFile(opt::vcfFile); vcfFile = bcfFile->stream(); }
+    else vcfFile = createReader(opt::vcfFile.c_str());
     std::ifstream* setsFile = new std::ifstream(opt::setsFile.c_str());
     if (!setsFile->good()) { std::cerr << "The file " << opt::setsFile << " could not be opened. Exiting..." << std::endl; exit(1);}
-    std::ofstream* outFileBBAA;
-    std::ofstream* outFileDmin;
-    std::ofstream* outFileCombine;
-    std::ofstream* outFileCombineStdErr;
-    if (opt::regionStart == -1) {
-        outFileBBAA = new std::ofstream(setsFileRoot+ "_" + opt::runName + "_BBAA.txt");
-        outFileDmin = new std::ofstream(setsFileRoot+ "_" + opt::runName + "_Dmin.txt");
-        outFileCombine = new std::ofstream(setsFileRoot+ "_" + opt::runName + "_combine.txt");
-        outFileCombineStdErr = new std::ofstream(setsFileRoot+ "_" + opt::runName + "_combine_stderr.txt");
-    } else {
-        string fileNameString = setsFileRoot+"_"+opt::runName+"_"+numToString(opt::regionStart)+"_"+numToString(opt::regionStart+opt::regionLength);
-        outFileBBAA = new std::ofstream(fileNameString+"_BBAA.txt");
-        outFileDmin = new std::ofstream(fileNameString+"_Dmin.txt");
-        outFileCombine = new std::ofstream(fileNameString+"_combine.txt");
-        outFileCombineStdErr = new std::ofstream(fileNameString+"_combine_stderr.txt");
+    // The output files are written in large blocks; with more than one thread, from a thread of their own
+    ResultWriter* outFileBBAA;
+    ResultWriter* outFileDmin;
+    ResultWriter* outFileCombine = NULL;
+    ResultWriter* outFileCombineStdErr = NULL;
+    string fileNameString;
+    if (!opt::regions.empty()) fileNameString = setsFileRoot+"_"+opt::runName+"_"+opt::regionsName+trioRangeName;
+    else if (opt::regionStart == -1) fileNameString = setsFileRoot+ "_" + opt::runName + trioRangeName;
+    else fileNameString = setsFileRoot+"_"+opt::runName+"_"+numToString(opt::regionStart)+"_"+numToString(opt::regionStart+opt::regionLength)+trioRangeName;
+    outFileBBAA = new ResultWriter(fileNameString+"_BBAA.txt", opt::numThreads > 1);
+    outFileDmin = new ResultWriter(fileNameString+"_Dmin.txt", opt::numThreads > 1);
+    if (!opt::binaryCombine) {
+        outFileCombine = new ResultWriter(fileNameString+"_combine.txt", opt::numThreads > 1);
+        outFileCombineStdErr = new ResultWriter(fileNameString+"_combine_stderr.txt", opt::numThreads > 1);
     }
+    string checkpointFileName = fileNameString + DMIN_CHECKPOINT_EXT;
 
     
     std::map<string, std::vector<string>> speciesToIDsMap;
     std::map<string, string> IDsToSpeciesMap;
     std::map<string, std::vector<size_t>> speciesToPosMap;
-    std::map<size_t, string> posToSpeciesMap;
     
     // Get the sample sets
     bool outgroupSpecified = false;
@@ -171,8 +218,18 @@ int DminMain(int argc, char** argv) {
             // std::cerr << it->first << std::endl;
         }
     } std::cerr << "There are " << species.size() << " sets (excluding the Outgroup)" << std::endl;
-    int nCombinations = nChoosek((int)species.size(),3);
-    std::cerr << "Going to calculate " << nCombinations << " Dmin values" << std::endl;
+    if ((int)species.size() > MAX_TRIO_SPECIES) { std::cerr << "Error: there can be at most " << MAX_TRIO_SPECIES << " sets (excluding the Outgroup)" << std::endl; exit(1); }
+    int64_t nAllCombinations = (int64_t)nChoosek(species.size(), 3);
+    int64_t firstCombination = 0; int64_t lastCombination = nAllCombinations; // This run calculates the trios [firstCombination, lastCombination)
+    if (opt::trioRangeStart != -1) {
+        if (opt::trioRangeStart > nAllCombinations) { std::cerr << "Error: the --trio-range starts at trio " << opt::trioRangeStart << ", but there are only " << nAllCombinations << " trios" << std::endl; exit(1); }
+        firstCombination = opt::trioRangeStart - 1; lastCombination = std::min(nAllCombinations, firstCombination + opt::trioRangeLength);
+        std::cerr << "Going to calculate " << lastCombination - firstCombination << " of the " << nAllCombinations << " Dmin values (trios " << firstCombination + 1 << " to " << lastCombination << ")" << std::endl;
+    } else {
+        std::cerr << "Going to calculate " << nAllCombinations << " Dmin values" << std::endl;
+    }
+    if (lastCombination - firstCombination > INT_MAX) { std::cerr << "Error: the trios can't all be held in memory; there can be at most " << INT_MAX << " in one run (see --trio-range)" << std::endl; exit(1); }
+    int nCombinations = (int)(lastCombination - firstCombination);
     if (opt::treeFile != "") { // Chack that the tree contains all the populations/species
         for (int i = 0; i != species.size(); i++) {
             try {
@@ -186,134 +243,254 @@ int DminMain(int argc, char** argv) {
     }
     
     
-    // first, get all combinations of three sets (species):
-    std::vector<std::vector<string>> trios; trios.resize(nCombinations);
-    std::vector<std::vector<int>> triosInt; triosInt.resize(nCombinations);
-    std::vector<bool> v(species.size()); std::fill(v.begin(), v.begin() + 3, true); // prepare a selection vector
-    int pNum = 0;
-    do {
-        for (int i = 0; i < v.size(); ++i) {
-            if (v[i]) { trios[pNum].push_back(species[i]); triosInt[pNum].push_back(i); }
-        } pNum++;
-    } while (std::prev_permutation(v.begin(), v.end())); // Getting all permutations of the selection vector - so it selects all combinations
-    std::cerr << "Done permutations" << std::endl;
+    // The memory needed: the trio table itself (and the state of --sparse), then the D values of each finished jackknife block
+    double trioBytes = (double)nCombinations * TrioTable::bytesPerTrio(); double sparseBytes = 0;
+    if (opt::sparse) {
+        sparseBytes = (double)nCombinations * SparseTrioAccumulator::bytesPerTrio();
+        for (int t = 0; t != opt::numThreads; t++) sparseBytes += SparseTrioAccumulator::bytesForPart((int)species.size(), firstCombination, nCombinations, t, opt::numThreads);
+    }
+    std::cerr << "The trios need " << (trioBytes + sparseBytes) / (1 << 20) << "MB";
+    if (opt::sparse) std::cerr << " (" << sparseBytes / (1 << 20) << "MB of it for --sparse)";
+    std::cerr << ", plus " << (double)nCombinations * JackknifeBlockStore::bytesPerBlock() / (1 << 20) << "MB for each jackknife block";
+    if (genotypeCache != NULL) std::cerr << " (at most " << (double)nCombinations * JackknifeBlockStore::bytesPerBlock() * (genotypeCache->nSites / opt::jkWindowSize + 1) / (1 << 30) << "GB for the " << genotypeCache->nSites << " sites in the cache)";
+    std::cerr << std::endl;
     
     // And need to prepare the vectors to hold the D values:
-    std::vector<double> init(3,0.0); // Vector of initial values
-    std::vector<std::vector<double>> initDs(3); // vector with three empty (double) vectors
-    std::vector<std::vector<std::vector<double>>> regionDs; regionDs.assign(nCombinations, initDs);
-    std::vector<double> allPs(species.size(),0.0);
-    std::vector<double> ABBAtotals(nCombinations,0); std::vector<double> BABAtotals(nCombinations,0);
-    std::vector<double> BBAAtotals(nCombinations,0);
-    std::vector<double> localABBAtotals(nCombinations,0); std::vector<double> localBABAtotals(nCombinations,0);
-    std::vector<double> localBBAAtotals(nCombinations,0);
-    std::vector<int> usedVars(nCombinations,0); // Will count the number of used variants for each trio
-    int totalVariantNumber = 0;
+    // first, get all combinations of three sets (species) in lexicographic order; the names are only looked up when the results are output
+    TrioTable trioTable((int)species.size(), firstCombination, nCombinations, opt::jkWindowSize);
+    std::cerr << "Done permutations" << std::endl;
+    
+    // The derived allele frequencies of all sites are collected in batches and the trios are then split between threads;
+    // each thread only ever touches its own range of trios, so the accumulation needs no locking
+    int sitesPerBatch = std::max(100, std::min(100000, 10000000 / std::max(nCombinations, 1)));
+    std::vector<double> batchPs((size_t)sitesPerBatch * species.size(), 0.0); std::vector<double> batchPOs(sitesPerBatch, 0.0);
+    int nBatchSites = 0;
+    auto accumulateTrios = [&](int trioFrom, int trioTo) {
+        for (int s = 0; s != nBatchSites; s++) {
+            trioTable.accumulate(trioFrom, trioTo, &batchPs[(size_t)s * species.size()], batchPOs[s]);
+        }
+    };
+    // In the sparse mode each thread has its own accumulator, for the trios starting with its range of species
+    std::vector<SparseTrioAccumulator> sparseAccumulators;
+    if (opt::sparse) {
+        for (int t = 0; t != opt::numThreads; t++) sparseAccumulators.push_back(SparseTrioAccumulator(&trioTable, (int)species.size(), t, opt::numThreads));
+    }
+    auto accumulateSparse = [&](int t) {
+        for (int s = 0; s != nBatchSites; s++) {
+            sparseAccumulators[t].addSite(&batchPs[(size_t)s * species.size()], batchPOs[s]);
+        }
+    };
+    auto processBatch = [&]() {
+        if (nBatchSites == 0) return;
+        int nThreads = std::min(opt::numThreads, std::max(nCombinations, 1));
+        if (opt::sparse) {
+            if (opt::numThreads == 1) accumulateSparse(0);
+            else {
+                std::vector<std::thread> workers;
+                for (int t = 0; t != opt::numThreads; t++) workers.push_back(std::thread(accumulateSparse, t));
+                for (int t = 0; t != opt::numThreads; t++) workers[t].join();
+            }
+        } else if (nThreads == 1) {
+            accumulateTrios(0, nCombinations);
+        } else {
+            std::vector<std::thread> workers;
+            for (int t = 0; t != nThreads; t++) {
+                int trioFrom = (int)(((long long)nCombinations * t) / nThreads);
+                int trioTo = (int)(((long long)nCombinations * (t+1)) / nThreads);
+                workers.push_back(std::thread(accumulateTrios, trioFrom, trioTo));
+            }
+            for (int t = 0; t != nThreads; t++) workers[t].join();
+        }
+        nBatchSites = 0;
+    };
+    int totalVariantNumber = 0; int nSamples = 0;
     std::vector<string> sampleNames; std::vector<std::string> fields;
     // Find out how often to report progress, based on the number of trios
     int reportProgressEvery; if (nCombinations < 1000) reportProgressEvery = 100000;
     else if (nCombinations < 100000) reportProgressEvery = 10000;
     else reportProgressEvery = 1000;
-    clock_t start; clock_t startGettingCounts; clock_t startCalculation;
-    double durationOverall; double durationGettingCounts; double durationCalculation;
+    clock_t start;
+    double durationOverall;
     
-    while (getline(*vcfFile, line)) {
-        line.erase(std::remove(line.begin(), line.end(), '\r'), line.end()); // Deal with any left over \r from files prepared on Windows
-        if (line[0] == '#' && line[1] == '#')
-            continue;
-        else if (line[0] == '#' && line[1] == 'C') {
-            fields = split(line, '\t');
-            std::vector<std::string> sampleNames(fields.begin()+NUM_NON_GENOTYPE_COLUMNS,fields.end());
-            // print_vector_stream(sampleNames, std::cerr);
-            for (std::vector<std::string>::size_type i = 0; i != sampleNames.size(); i++) {
-                posToSpeciesMap[i] = IDsToSpeciesMap[sampleNames[i]];
+    if (genotypeCache != NULL) {
+        sampleNames = genotypeCache->sampleNames;
+    } else if (bcfFile != NULL) {
+        sampleNames = bcfFile->sampleNames;
+    } else {
+        while (getline(*vcfFile, line)) {
+            line.erase(std::remove(line.begin(), line.end(), '\r'), line.end()); // Deal with any left over \r from files prepared on Windows
+            if (line[0] == '#' && line[1] == '#')
+                continue;
+            else if (line[0] == '#' && line[1] == 'C') {
+                fields = split(line, '\t');
+                sampleNames.assign(fields.begin()+NUM_NON_GENOTYPE_COLUMNS,fields.end());
+                break; // The rest of the file is processed by the pipeline below
+            }
+        }
+        if (opt::regionStart != -1) totalVariantNumber = (int)seekToVariant(vcfFile, opt::vcfFile, opt::regionStart); // With an index from Dsuite index
+    }
+    // print_vector_stream(sampleNames, std::cerr);
+    nSamples = (int)sampleNames.size();
+    // Iterate over all the keys in the map to find the samples in the VCF:
+    // Give an error if no sample is found for a species:
+    for(std::map<string, std::vector<string>>::iterator it = speciesToIDsMap.begin(); it != speciesToIDsMap.end(); ++it) {
+        string sp =  it->first;
+        //std::cerr << "sp " << sp << std::endl;
+        std::vector<string> IDs = it->second;
+        std::vector<size_t> spPos = locateSet(sampleNames, IDs);
+        if (spPos.empty()) {
+            std::cerr << "Did not find any samples in the VCF for \"" << sp << "\"" << std::endl;
+            assert(!spPos.empty());
+        }
+        speciesToPosMap[sp] = spPos;
+    }
+    start = clock();
+    //  std::cerr << " " << std::endl;
+    //  std::cerr << "Outgroup at pos: "; print_vector_stream(speciesToPosMap["Outgroup"], std::cerr);
+    SetIndex sets(speciesToPosMap, nSamples);
+    std::vector<int> speciesIDs(species.size()); // The species in the trios -> IDs for the allele counts
+    for (std::vector<std::string>::size_type i = 0; i != species.size(); i++) speciesIDs[i] = sets.getID(species[i]);
+    
+    // Pipeline stage 1: read the variant lines in batches
+    bool doneReading = false;
+    RegionLineReader* regionReader = NULL;
+    if (bcfFile != NULL && !opt::regions.empty()) regionReader = new RegionLineReader(bcfFile, opt::vcfFile, opt::regions);
+    else if (vcfFile != NULL && !opt::regions.empty()) regionReader = new RegionLineReader(vcfFile, opt::vcfFile, opt::regions);
+    std::vector<std::pair<uint64_t, uint64_t> > cacheRanges; size_t cacheRange = 0; uint64_t nextSite = 0; // The ranges of sites to read from the cache
+    if (genotypeCache != NULL) {
+        if (!opt::regions.empty()) cacheRanges = genotypeCache->sitesInRegions(opt::regions);
+        else if (opt::regionStart != -1) cacheRanges.push_back(std::make_pair(genotypeCache->firstSiteFromVariant(opt::regionStart), genotypeCache->firstSiteFromVariant((int64_t)opt::regionStart + opt::regionLength + 1)));
+        else cacheRanges.push_back(std::make_pair((uint64_t)0, genotypeCache->nSites));
+        if (!cacheRanges.empty()) nextSite = cacheRanges[0].first;
+    }
+    auto readRecord = [&](string& thisLine) -> bool {
+        if (regionReader != NULL) return regionReader->getNextLine(thisLine);
+        else if (bcfFile != NULL) return bcfFile->getNextRecord(thisLine); // A binary record rather than a line
+        else return (bool)getline(*vcfFile, thisLine);
+    };
+    
+    // Continue from a checkpoint: the trio state is loaded, then the input is moved on to where the checkpoint was written
+    // The run key has everything that the results depend on, so that a checkpoint can't be used for a different run
+    string runKey = opt::vcfFile + "\n" + opt::setsFile + "\n" + numToString(opt::jkWindowSize) + "\n" + numToString(opt::regionStart) + "," + numToString(opt::regionLength) + "\n";
+    for (std::vector<GenomicRegion>::size_type r = 0; r != opt::regions.size(); r++) runKey += opt::regions[r].chrom + ":" + numToString(opt::regions[r].start) + "-" + numToString(opt::regions[r].end) + ",";
+    struct stat vcfStat;
+    if (stat(opt::vcfFile.c_str(), &vcfStat) == 0) runKey += "\n" + numToString((int64_t)vcfStat.st_size) + "," + numToString((int64_t)vcfStat.st_mtime);
+    for (std::vector<string>::size_type i = 0; i != species.size(); i++) runKey += "\n" + species[i];
+    bool resumed = false; DminInputPosition resumePosition;
+    if (opt::resume) {
+        if (readDminCheckpoint(checkpointFileName, runKey, trioTable, resumePosition)) {
+            resumed = true;
+            std::cerr << "Resuming from the checkpoint " << checkpointFileName << ", after " << resumePosition.variantNumber << " variants" << std::endl;
+        } else {
+            std::cerr << "There is no checkpoint " << checkpointFileName << "; starting from the beginning" << std::endl;
+        }
+    }
+    if (resumed) {
+        if (genotypeCache != NULL) {
+            nextSite = resumePosition.offset;
+            while (cacheRange < cacheRanges.size() && nextSite > cacheRanges[cacheRange].second) cacheRange++;
+            totalVariantNumber = (int)resumePosition.variantNumber;
+        } else if (regionReader == NULL && seekInputOffset(vcfFile, resumePosition)) {
+            totalVariantNumber = (int)resumePosition.variantNumber;
+        } else { // Read the variants before the checkpoint again, without doing anything with them
+            string skippedLine;
+            while (totalVariantNumber < resumePosition.variantNumber && readRecord(skippedLine)) {
+                if (bcfFile == NULL && (skippedLine.empty() || skippedLine[0] == '#')) continue;
+                totalVariantNumber++;
             }
-            // Iterate over all the keys in the map to find the samples in the VCF:
-            // Give an error if no sample is found for a species:
-            for(std::map<string, std::vector<string>>::iterator it = speciesToIDsMap.begin(); it != speciesToIDsMap.end(); ++it) {
-                string sp =  it->first;
-                //std::cerr << "sp " << sp << std::endl;
-                std::vector<string> IDs = it->second;
-                std::vector<size_t> spPos = locateSet(sampleNames, IDs);
-                if (spPos.empty()) {
-                    std::cerr << "Did not find any samples in the VCF for \"" << sp << "\"" << std::endl;
-                    assert(!spPos.empty());
+        }
+    }
+    time_t nextCheckpointTime = time(NULL) + (time_t)(opt::checkpointMinutes * 60);
+    std::function<bool(DminLineBatch&)> readLines = [&](DminLineBatch& b) -> bool {
+        b.nLines = 0; size_t nBytes = 0;
+        if (genotypeCache != NULL) { // The sites are already in memory, so the batch is just a range of them
+            if (cacheRange < cacheRanges.size() && nextSite == cacheRanges[cacheRange].second) {
+                if (++cacheRange < cacheRanges.size()) nextSite = cacheRanges[cacheRange].first;
+            }
+            b.firstSite = nextSite;
+            while (cacheRange < cacheRanges.size() && nextSite < cacheRanges[cacheRange].second && b.nLines < VCF_LINES_PER_BATCH) {
+                int variantNumber = (int)genotypeCache->variantNumber(nextSite);
+                if (variantNumber / reportProgressEvery > totalVariantNumber / reportProgressEvery) {
+                    durationOverall = ( clock() - start ) / (double) CLOCKS_PER_SEC;
+                    std::cerr << "Processed " << (variantNumber / reportProgressEvery) * reportProgressEvery << " variants in " << durationOverall << "secs" << std::endl;
                 }
-                speciesToPosMap[sp] = spPos;
+                totalVariantNumber = variantNumber; nextSite++; b.nLines++;
             }
-            start = clock();
-            //  std::cerr << " " << std::endl;
-            //  std::cerr << "Outgroup at pos: "; print_vector_stream(speciesToPosMap["Outgroup"], std::cerr);
-        } else {
+            b.endPosition.variantNumber = totalVariantNumber; b.endPosition.offsetType = INPUT_OFFSET_CACHE_SITE; b.endPosition.offset = nextSite;
+            return b.nLines > 0;
+        }
+        while (!doneReading && b.nLines < VCF_LINES_PER_BATCH && nBytes < VCF_BYTES_PER_BATCH) {
+            if (b.nLines == (int)b.lines.size()) b.lines.resize(b.nLines + 1);
+            string& thisLine = b.lines[b.nLines];
+            if (!readRecord(thisLine)) { doneReading = true; break; }
+            if (bcfFile == NULL && (thisLine.empty() || thisLine[0] == '#')) continue;
             totalVariantNumber++;
             if (opt::regionStart != -1) {
                 if (totalVariantNumber < opt::regionStart)
                     continue;
                 if (totalVariantNumber > (opt::regionStart+opt::regionLength)) {
-                    std::cerr << "DONE" << std::endl; break;
+                    std::cerr << "DONE" << std::endl; doneReading = true; break;
                 }
             }
             if (totalVariantNumber % reportProgressEvery == 0) {
                 durationOverall = ( clock() - start ) / (double) CLOCKS_PER_SEC;
                 std::cerr << "Processed " << totalVariantNumber << " variants in " << durationOverall << "secs" << std::endl;
-                //std::cerr << "GettingCounts " << durationGettingCounts << " calculation " << durationCalculation << "secs" << std::endl;
             }
-            fields = split(line, '\t');
-            std::vector<std::string> genotypes(fields.begin()+NUM_NON_GENOTYPE_COLUMNS,fields.end());
-
-            // Only consider biallelic SNPs
-            string refAllele = fields[3]; string altAllele = fields[4];
-            if (refAllele.length() > 1 || altAllele.length() > 1 || altAllele == "*") {
-                refAllele.clear(); refAllele.shrink_to_fit(); altAllele.clear(); altAllele.shrink_to_fit();
-                genotypes.clear(); genotypes.shrink_to_fit(); continue;
+            nBytes += thisLine.length(); b.nLines++;
+        }
+        b.endPosition.variantNumber = totalVariantNumber; b.endPosition.offsetType = INPUT_OFFSET_NONE;
+        if (opt::checkpointMinutes > 0 && regionReader == NULL) tellInputOffset(vcfFile, b.endPosition);
+        return b.nLines > 0;
+    };
+    
+    // Pipeline stage 2 (in parallel): get the derived allele frequencies for each line
+    std::function<void(DminLineBatch&)> getAlleleFrequencies = [&](DminLineBatch& b) {
+        b.Ps.resize((size_t)b.nLines * species.size()); b.POs.assign(b.nLines, -1);
+        if (b.siteCounts.empty()) b.siteCounts.push_back(GeneralSetCounts(sets, nSamples)); // Allocated once and reused for all the lines
+        for (int l = 0; l != b.nLines; l++) {
+            GeneralSetCounts* c = &b.siteCounts[0];
+            if (genotypeCache != NULL) { // The cache has only biallelic SNPs
+                c->reset(); c->getSetVariantCounts(genotypeCache->genotypes(b.firstSite + l));
+            } else if (bcfFile != NULL) { // The genotypes are decoded straight from the typed values, without any text
+                BcfRecord record(b.lines[l], *bcfFile);
+                if (!record.isBiallelicSNP()) continue;
+                c->reset(); c->getSetVariantCounts(record.genotypes());
+            } else {
+                b.fields.tokenize(b.lines[l]);
+                if (!isBiallelicSNP(b.fields)) continue; // Only consider biallelic SNPs
+                c->reset(); c->getSetVariantCounts(b.fields);
             }
+            double p_O = c->setDAFs[sets.outgroupID];
+            if (p_O == -1) continue; // We need to make sure that the outgroup is defined
             
-            startGettingCounts = clock();
-            GeneralSetCounts* c = new GeneralSetCounts(speciesToPosMap, (int)genotypes.size());
-            c->getSetVariantCounts(genotypes, posToSpeciesMap);
-            genotypes.clear(); genotypes.shrink_to_fit();
-            durationGettingCounts = ( clock() - startGettingCounts ) / (double) CLOCKS_PER_SEC;
-            
-            startCalculation = clock();
-            double p_O = c->setDAFs.at("Outgroup");
-            if (p_O == -1) { delete c; continue; } // We need to make sure that the outgroup is defined
-            
+            double* allPs = &b.Ps[(size_t)l * species.size()];
             for (std::vector<std::string>::size_type i = 0; i != species.size(); i++) {
-                allPs[i] = c->setDAFs.at(species[i]);
-            }
-            
-            // Now calculate the D stats:
-            double p_S1; double p_S2; double p_S3; double ABBA; double BABA; double BBAA;
-            for (int i = 0; i != trios.size(); i++) {
-                p_S1 = allPs[triosInt[i][0]];
-                if (p_S1 == -1) continue;  // If any member of the trio has entirely missing data, just move on to the next trio
-                p_S2 = allPs[triosInt[i][1]];
-                if (p_S2 == -1) continue;
-                p_S3 = allPs[triosInt[i][2]];
-                if (p_S3 == -1) continue;
-                usedVars[i]++;
-                
-                ABBA = ((1-p_S1)*p_S2*p_S3*(1-p_O)); ABBAtotals[i] += ABBA; localABBAtotals[i] += ABBA;
-                BABA = (p_S1*(1-p_S2)*p_S3*(1-p_O)); BABAtotals[i] += BABA; localBABAtotals[i] += BABA;
-                BBAA = ((1-p_S3)*p_S2*p_S1*(1-p_O)); BBAAtotals[i] += BBAA; localBBAAtotals[i] += BBAA;
-                
-                
-
-                
-                if (usedVars[i] % opt::jkWindowSize == 0) {
-                    double localDnums1 = localABBAtotals[i] - localBABAtotals[i]; double localDnums2 = localABBAtotals[i] - localBBAAtotals[i]; double localDnums3 = localBBAAtotals[i] - localBABAtotals[i];
-                    double localDdenoms1 = localABBAtotals[i] + localBABAtotals[i]; double localDdenoms2 = localABBAtotals[i] + localBBAAtotals[i]; double localDdenoms3 = localBBAAtotals[i] + localBABAtotals[i];
-                    double regionD0 = localDnums1/localDdenoms1; double regionD1 = localDnums2/localDdenoms2;
-                    double regionD2 = localDnums3/localDdenoms3;
-                    regionDs[i][0].push_back(regionD0); regionDs[i][1].push_back(regionD1); regionDs[i][2].push_back(regionD2);
-                    localABBAtotals[i] = 0; localBABAtotals[i] = 0; localBBAAtotals[i] = 0;
-                }
-                // }
+                allPs[i] = c->setDAFs[speciesIDs[i]];
             }
-            durationCalculation = ( clock() - startCalculation ) / (double) CLOCKS_PER_SEC;
-            delete c;
+            b.POs[l] = p_O;
         }
-    }
+    };
+    
+    // Pipeline stage 3: collect the allele frequencies (in the order of the VCF) and calculate the D stats
+    std::function<void(DminLineBatch&)> addToTrios = [&](DminLineBatch& b) {
+        for (int l = 0; l != b.nLines; l++) {
+            if (b.POs[l] == -1) continue;
+            std::copy(b.Ps.begin() + (size_t)l * species.size(), b.Ps.begin() + (size_t)(l+1) * species.size(), batchPs.begin() + (size_t)nBatchSites * species.size());
+            batchPOs[nBatchSites] = b.POs[l]; nBatchSites++;
+            if (nBatchSites == sitesPerBatch) processBatch();
+        }
+        if (opt::checkpointMinutes > 0 && time(NULL) >= nextCheckpointTime) {
+            processBatch();
+            for (int t = 0; t != sparseAccumulators.size(); t++) sparseAccumulators[t].finish(); // All the trios are then up to date
+            writeDminCheckpoint(checkpointFileName, runKey, trioTable, b.endPosition);
+            std::cerr << "Saved a checkpoint after " << b.endPosition.variantNumber << " variants" << std::endl;
+            nextCheckpointTime = time(NULL) + (time_t)(opt::checkpointMinutes * 60);
+        }
+    };
+    
+    runBatchPipeline<DminLineBatch>(opt::numThreads, readLines, getAlleleFrequencies, addToTrios);
+    processBatch();
+    for (int t = 0; t != sparseAccumulators.size(); t++) sparseAccumulators[t].finish();
     std::cerr << "Done processing VCF. Preparing output files..." << '\n';
     *outFileBBAA << "P1\tP2\tP3\tDstatistic\tp-value" << std::endl;
     *outFileDmin << "P1\tP2\tP3\tDstatistic\tp-value" << std::endl;
@@ -321,21 +498,26 @@ int DminMain(int argc, char** argv) {
         *outFileTree << "P1\tP2\tP3\tDstatistic\tp-value" << std::endl;
     }
     int exceptionCount = 0;
-    for (int i = 0; i != trios.size(); i++) { //
+    std::vector<std::vector<double> > blockDs(3); // The jackknife block Ds of one trio, reused for all of them
+    string trio[3];
+    CombineBinaryWriter* combineBinary = opt::binaryCombine ? new CombineBinaryWriter(fileNameString + COMBINE_BINARY_EXT, species) : NULL;
+    for (int i = 0; i != nCombinations; i++) { //
+        trio[0] = species[trioTable.species1[i]]; trio[1] = species[trioTable.species2[i]]; trio[2] = species[trioTable.species3[i]];
+        for (int k = 0; k != 3; k++) trioTable.regionDs.get(i, k, blockDs[k]);
         // Get the D values
-        double Dnum1 = ABBAtotals[i] - BABAtotals[i];
-        double Dnum2 = ABBAtotals[i] - BBAAtotals[i];
-        double Dnum3 = BBAAtotals[i] - BABAtotals[i];
+        double Dnum1 = trioTable.ABBAtotals[i] - trioTable.BABAtotals[i];
+        double Dnum2 = trioTable.ABBAtotals[i] - trioTable.BBAAtotals[i];
+        double Dnum3 = trioTable.BBAAtotals[i] - trioTable.BABAtotals[i];
         
-        double Ddenom1 = ABBAtotals[i] + BABAtotals[i];
-        double Ddenom2 = ABBAtotals[i] + BBAAtotals[i];
-        double Ddenom3 = BBAAtotals[i] + BABAtotals[i];
+        double Ddenom1 = trioTable.ABBAtotals[i] + trioTable.BABAtotals[i];
+        double Ddenom2 = trioTable.ABBAtotals[i] + trioTable.BBAAtotals[i];
+        double Ddenom3 = trioTable.BBAAtotals[i] + trioTable.BABAtotals[i];
         double D1 = Dnum1/Ddenom1; double D2 = Dnum2/Ddenom2; double D3 = Dnum3/Ddenom3;
         double D1_p; double D2_p; double D3_p;
         try {
             // Get the standard error values:
-            double D1stdErr = jackknive_std_err(regionDs[i][0]); double D2stdErr = jackknive_std_err(regionDs[i][1]);
-            double D3stdErr = jackknive_std_err(regionDs[i][2]);
+            double D1stdErr = jackknive_std_err(blockDs[0]); double D2stdErr = jackknive_std_err(blockDs[1]);
+            double D3stdErr = jackknive_std_err(blockDs[2]);
             // Get the Z-scores
             double D1_Z = fabs(D1)/D1stdErr; double D2_Z = fabs(D2)/D2stdErr;
             double D3_Z = fabs(D3)/D3stdErr;
@@ -346,7 +528,7 @@ int DminMain(int argc, char** argv) {
             exceptionCount++;
             if (exceptionCount <= 10) {
                 std::cerr << msg << std::endl;
-                std::cerr << "Could not calculate p-values for the trio: " << trios[i][0] << " " << trios[i][1] << " " << trios[i][2] << std::endl;
+                std::cerr << "Could not calculate p-values for the trio: " << trio[0] << " " << trio[1] << " " << trio[2] << std::endl;
                 std::cerr << "You should probably decrease the the jackknife block size (-j option)" << std::endl;
                 std::cerr << std::endl;
             }
@@ -354,62 +536,62 @@ int DminMain(int argc, char** argv) {
         }
         
         // Find which topology is in agreement with the counts of the BBAA, BABA, and ABBA patterns
-        if (BBAAtotals[i] >= BABAtotals[i] && BBAAtotals[i] >= ABBAtotals[i]) {
+        if (trioTable.BBAAtotals[i] >= trioTable.BABAtotals[i] && trioTable.BBAAtotals[i] >= trioTable.ABBAtotals[i]) {
             if (D1 >= 0)
-                *outFileBBAA << trios[i][0] << "\t" << trios[i][1] << "\t" << trios[i][2];
+                *outFileBBAA << trio[0] << "\t" << trio[1] << "\t" << trio[2];
             else
-                *outFileBBAA << trios[i][1] << "\t" << trios[i][0] << "\t" << trios[i][2];
+                *outFileBBAA << trio[1] << "\t" << trio[0] << "\t" << trio[2];
             *outFileBBAA << "\t" << fabs(D1) << "\t" << D1_p << std::endl;;
-            //*outFileBBAA << BBAAtotals[i] << "\t" << BABAtotals[i] << "\t" << ABBAtotals[i] << std::endl;
-        } else if (BABAtotals[i] >= BBAAtotals[i] && BABAtotals[i] >= ABBAtotals[i]) {
+            //*outFileBBAA << trioTable.BBAAtotals[i] << "\t" << trioTable.BABAtotals[i] << "\t" << trioTable.ABBAtotals[i] << std::endl;
+        } else if (trioTable.BABAtotals[i] >= trioTable.BBAAtotals[i] && trioTable.BABAtotals[i] >= trioTable.ABBAtotals[i]) {
             if (D2 >= 0)
-                *outFileBBAA << trios[i][0] << "\t" << trios[i][2] << "\t" << trios[i][1];
+                *outFileBBAA << trio[0] << "\t" << trio[2] << "\t" << trio[1];
             else
-                *outFileBBAA << trios[i][2] << "\t" << trios[i][0] << "\t" << trios[i][1];
+                *outFileBBAA << trio[2] << "\t" << trio[0] << "\t" << trio[1];
             *outFileBBAA << "\t" << fabs(D2) << "\t" << D2_p << std::endl;;
-            //*outFileBBAA << BABAtotals[i] << "\t" << BBAAtotals[i] << "\t" << ABBAtotals[i] << std::endl;
-        } else if (ABBAtotals[i] >= BBAAtotals[i] && ABBAtotals[i] >= BABAtotals[i]) {
+            //*outFileBBAA << trioTable.BABAtotals[i] << "\t" << trioTable.BBAAtotals[i] << "\t" << trioTable.ABBAtotals[i] << std::endl;
+        } else if (trioTable.ABBAtotals[i] >= trioTable.BBAAtotals[i] && trioTable.ABBAtotals[i] >= trioTable.BABAtotals[i]) {
             if (D3 >= 0)
-                *outFileBBAA << trios[i][2] << "\t" << trios[i][1] << "\t" << trios[i][0];
+                *outFileBBAA << trio[2] << "\t" << trio[1] << "\t" << trio[0];
             else
-                *outFileBBAA << trios[i][1] << "\t" << trios[i][2] << "\t" << trios[i][0];
+                *outFileBBAA << trio[1] << "\t" << trio[2] << "\t" << trio[0];
             *outFileBBAA << "\t" << fabs(D3) << "\t" << D3_p << std::endl;;
-            //*outFileBBAA << ABBAtotals[i] << "\t" << BABAtotals[i] << "\t" << BBAAtotals[i] << std::endl;
+            //*outFileBBAA << trioTable.ABBAtotals[i] << "\t" << trioTable.BABAtotals[i] << "\t" << trioTable.BBAAtotals[i] << std::endl;
         }
         
         // Find Dmin:
         if (fabs(D1) <= fabs(D2) && fabs(D1) <= fabs(D3)) { // (P3 == S3)
             if (D1 >= 0)
-                *outFileDmin << trios[i][0] << "\t" << trios[i][1] << "\t" << trios[i][2] << "\t" << D1 << "\t" << D1_p << std::endl;
+                *outFileDmin << trio[0] << "\t" << trio[1] << "\t" << trio[2] << "\t" << D1 << "\t" << D1_p << std::endl;
             else
-                *outFileDmin << trios[i][1] << "\t" << trios[i][0] << "\t" << trios[i][2] << "\t" << fabs(D1) << "\t" << D1_p << std::endl;
-            // if (BBAAtotals[i] < BABAtotals[i] || BBAAtotals[i] < ABBAtotals[i])
+                *outFileDmin << trio[1] << "\t" << trio[0] << "\t" << trio[2] << "\t" << fabs(D1) << "\t" << D1_p << std::endl;
+            // if (trioTable.BBAAtotals[i] < trioTable.BABAtotals[i] || trioTable.BBAAtotals[i] < trioTable.ABBAtotals[i])
             //     std::cerr << "\t" << "WARNING: Dmin tree different from DAF tree" << std::endl;
         } else if (fabs(D2) <= fabs(D1) && fabs(D2) <= fabs(D3)) { // (P3 == S2)
             if (D2 >= 0)
-                *outFileDmin << trios[i][0] << "\t" << trios[i][2] << "\t" << trios[i][1] << "\t" << D2 << "\t" << D2_p << std::endl;
+                *outFileDmin << trio[0] << "\t" << trio[2] << "\t" << trio[1] << "\t" << D2 << "\t" << D2_p << std::endl;
             else
-                *outFileDmin << trios[i][2] << "\t" << trios[i][0] << "\t" << trios[i][1] << "\t" << fabs(D2) << "\t" << D2_p << std::endl;
-            // if (BABAtotals[i] < BBAAtotals[i] || BABAtotals[i] < ABBAtotals[i])
+                *outFileDmin << trio[2] << "\t" << trio[0] << "\t" << trio[1] << "\t" << fabs(D2) << "\t" << D2_p << std::endl;
+            // if (trioTable.BABAtotals[i] < trioTable.BBAAtotals[i] || trioTable.BABAtotals[i] < trioTable.ABBAtotals[i])
             //     std::cerr << "\t" << "WARNING: Dmin tree different from DAF tree" << std::endl;
         } else if (fabs(D3) <= fabs(D1) && fabs(D3) <= fabs(D2)) { // (P3 == S1)
             if (D3 >= 0)
-                *outFileDmin << trios[i][2] << "\t" << trios[i][1] << "\t" << trios[i][0] << "\t" << D3 << "\t" << D3_p << std::endl;
+                *outFileDmin << trio[2] << "\t" << trio[1] << "\t" << trio[0] << "\t" << D3 << "\t" << D3_p << std::endl;
             else
-                *outFileDmin << trios[i][1] << "\t" << trios[i][2] << "\t" << trios[i][0] << "\t" << fabs(D3) << "\t" << D3_p << std::endl;
-            // if (ABBAtotals[i] < BBAAtotals[i] || ABBAtotals[i] < BABAtotals[i])
+                *outFileDmin << trio[1] << "\t" << trio[2] << "\t" << trio[0] << "\t" << fabs(D3) << "\t" << D3_p << std::endl;
+            // if (trioTable.ABBAtotals[i] < trioTable.BBAAtotals[i] || trioTable.ABBAtotals[i] < trioTable.BABAtotals[i])
             //     std::cerr << "\t" << "WARNING: Dmin tree different from DAF tree" << std::endl;
         }
         
         // Find which arrangement of trios is consistent with the input tree (if provided):
         if (opt::treeFile != "") {
-            int loc1 = treeTaxonNamesToLoc[trios[i][0]][0];
-            int loc2 = treeTaxonNamesToLoc[trios[i][1]][0];
-            int loc3 = treeTaxonNamesToLoc[trios[i][2]][0];
+            int loc1 = treeTaxonNamesToLoc[trio[0]][0];
+            int loc2 = treeTaxonNamesToLoc[trio[1]][0];
+            int loc3 = treeTaxonNamesToLoc[trio[2]][0];
             
-            int arrangement = 0;    // 1 - trios[i][0] and trios[i][2] are P1 and P2
-                                    // 2 - trios[i][0] and trios[i][1] are P1 and P2
-                                    // 3 - trios[i][1] and trios[i][2] are P1 and P2
+            int arrangement = 0;    // 1 - trio[0] and trio[2] are P1 and P2
+                                    // 2 - trio[0] and trio[1] are P1 and P2
+                                    // 3 - trio[1] and trio[2] are P1 and P2
             int midLoc = std::max(std::min(loc1,loc2), std::min(std::max(loc1,loc2),loc3));
             if (midLoc == loc1) {
                 if (loc2 < loc1) {
@@ -447,32 +629,36 @@ int DminMain(int argc, char** argv) {
             {
                 case 1:
                     if (D2 >= 0)
-                        *outFileTree << trios[i][0] << "\t" << trios[i][2] << "\t" << trios[i][1] << "\t" << D2 << "\t" << D2_p << std::endl;
+                        *outFileTree << trio[0] << "\t" << trio[2] << "\t" << trio[1] << "\t" << D2 << "\t" << D2_p << std::endl;
                     else
-                        *outFileTree << trios[i][2] << "\t" << trios[i][0] << "\t" << trios[i][1] << "\t" << fabs(D2) << "\t" << D2_p << std::endl;
+                        *outFileTree << trio[2] << "\t" << trio[0] << "\t" << trio[1] << "\t" << fabs(D2) << "\t" << D2_p << std::endl;
                     break;
                 case 2:
                     if (D1 >= 0)
-                        *outFileTree << trios[i][0] << "\t" << trios[i][1] << "\t" << trios[i][2] << "\t" << D1 << "\t" << D1_p << std::endl;
+                        *outFileTree << trio[0] << "\t" << trio[1] << "\t" << trio[2] << "\t" << D1 << "\t" << D1_p << std::endl;
                     else
-                        *outFileTree << trios[i][1] << "\t" << trios[i][0] << "\t" << trios[i][2] << "\t" << fabs(D1) << "\t" << D1_p << std::endl;
+                        *outFileTree << trio[1] << "\t" << trio[0] << "\t" << trio[2] << "\t" << fabs(D1) << "\t" << D1_p << std::endl;
                     break;
                 case 3:
                     if (D3 >= 0)
-                        *outFileTree << trios[i][2] << "\t" << trios[i][1] << "\t" << trios[i][0] << "\t" << D3 << "\t" << D3_p << std::endl;
+                        *outFileTree << trio[2] << "\t" << trio[1] << "\t" << trio[0] << "\t" << D3 << "\t" << D3_p << std::endl;
                     else
-                        *outFileTree << trios[i][1] << "\t" << trios[i][2] << "\t" << trios[i][0] << "\t" << fabs(D3) << "\t" << D3_p << std::endl;
+                        *outFileTree << trio[1] << "\t" << trio[2] << "\t" << trio[0] << "\t" << fabs(D3) << "\t" << D3_p << std::endl;
                     break;
             }
 
         }
         
         // Output a simple file that can be used for combining multiple local runs:
-        *outFileCombine << trios[i][0] << "\t" << trios[i][1] << "\t" << trios[i][2] << "\t" << BBAAtotals[i] << "\t" << BABAtotals[i] << "\t" << ABBAtotals[i] << std::endl;
-        print_vector(regionDs[i][0], *outFileCombineStdErr, ',', false); *outFileCombineStdErr << "\t"; print_vector(regionDs[i][1], *outFileCombineStdErr, ',', false); *outFileCombineStdErr << "\t";
-        print_vector(regionDs[i][2], *outFileCombineStdErr, ',',false); *outFileCombineStdErr << std::endl;
+        if (combineBinary != NULL) {
+            combineBinary->addTrio(trioTable.species1[i], trioTable.species2[i], trioTable.species3[i], trioTable.BBAAtotals[i], trioTable.BABAtotals[i], trioTable.ABBAtotals[i], blockDs.data());
+        } else {
+            *outFileCombine << trio[0] << "\t" << trio[1] << "\t" << trio[2] << "\t" << trioTable.BBAAtotals[i] << "\t" << trioTable.BABAtotals[i] << "\t" << trioTable.ABBAtotals[i] << std::endl;
+            print_vector(blockDs[0], *outFileCombineStdErr, ',', false); *outFileCombineStdErr << "\t"; print_vector(blockDs[1], *outFileCombineStdErr, ',', false); *outFileCombineStdErr << "\t";
+            print_vector(blockDs[2], *outFileCombineStdErr, ',',false); *outFileCombineStdErr << std::endl;
+        }
         
-        //std::cerr << trios[i][0] << "\t" << trios[i][1] << "\t" << trios[i][2] << "\t" << D1 << "\t" << D2 << "\t" << D3 << "\t" << BBAAtotals[i] << "\t" << BABAtotals[i] << "\t" << ABBAtotals[i] << std::endl;
+        //std::cerr << trio[0] << "\t" << trio[1] << "\t" << trio[2] << "\t" << D1 << "\t" << D2 << "\t" << D3 << "\t" << trioTable.BBAAtotals[i] << "\t" << trioTable.BABAtotals[i] << "\t" << trioTable.ABBAtotals[i] << std::endl;
     }
     if (exceptionCount > 10) {
         std::cerr << "..." << std::endl;
@@ -480,6 +666,9 @@ int DminMain(int argc, char** argv) {
         std::cerr << "You should definitely decrease the the jackknife block size!!!" << std::endl;
         std::cerr << std::endl;
     }
+    if (combineBinary != NULL) combineBinary->close();
+    delete outFileBBAA; delete outFileDmin; delete outFileTree; delete outFileCombine; delete outFileCombineStdErr;
+    if (opt::checkpointMinutes > 0 || resumed) remove(checkpointFileName.c_str()); // The run is finished
     return 0;
     
 }
@@ -497,14 +686,51 @@ void parseDminOptions(int argc, char** argv) {
             case 'n': arg >> opt::runName; break;
             case 't': arg >> opt::treeFile; break;
             case 'j': arg >> opt::jkWindowSize; break;
+            case OPT_THREADS: arg >> opt::numThreads; break;
+            case OPT_SPARSE: opt::sparse = true; break;
+            case OPT_CHECKPOINT: arg >> opt::checkpointMinutes; break;
+            case OPT_RESUME: opt::resume = true; break;
+            case OPT_BINARY_COMBINE: opt::binaryCombine = true; break;
+            case OPT_TRIO_RANGE: regionArgs = split(arg.str(), ',');
+                if (regionArgs.size() != 2) { std::cerr << "The --trio-range should be start,length\n"; die = true; break; }
+                opt::trioRangeStart = (int64_t)stringToDouble(regionArgs[0]); opt::trioRangeLength = (int64_t)stringToDouble(regionArgs[1]);
+                if (opt::trioRangeStart < 1 || opt::trioRangeLength < 1) { std::cerr << "The --trio-range start and length should be at least 1\n"; die = true; }
+                break;
             case 'r': arg >> regionArgString; regionArgs = split(regionArgString, ',');
-                opt::regionStart = (int)stringToDouble(regionArgs[0]); opt::regionLength = (int)stringToDouble(regionArgs[1]);  break;
+                if (regionArgString.find(':') == string::npos && regionArgs.size() == 2) { // start,length
+                    opt::regionStart = (int)stringToDouble(regionArgs[0]); opt::regionLength = (int)stringToDouble(regionArgs[1]);
+                } else { // chr:start-end
+                    GenomicRegion r = parseRegion(regionArgString); opt::regions.push_back(r);
+                    if (opt::regionsName == "") opt::regionsName = r.chrom + ((r.end == INT_MAX) ? "" : "_" + numToString(r.start) + "_" + numToString(r.end));
+                }
+                break;
+            case OPT_REGIONS: {
+                std::vector<GenomicRegion> bedRegions = readBedRegions(arg.str());
+                opt::regions.insert(opt::regions.end(), bedRegions.begin(), bedRegions.end());
+                string bedName = stripExtension(arg.str()); bedName = bedName.substr(bedName.find_last_of('/') + 1);
+                opt::regionsName = bedName; break;
+            }
             case 'h':
                 std::cout << DMIN_USAGE_MESSAGE;
                 exit(EXIT_SUCCESS);
         }
     }
     
+    if (opt::numThreads < 1) {
+        std::cerr << "The number of threads must be at least 1\n";
+        die = true;
+    }
+    
+    if (opt::checkpointMinutes < 0) {
+        std::cerr << "The --checkpoint interval can't be negative\n";
+        die = true;
+    }
+    
+    if (opt::regionStart != -1 && !opt::regions.empty()) {
+        std::cerr << "Please use either --region=start,length or genomic coordinates (--region=chr:start-end, --regions), not both\n";
+        die = true;
+    }
+    
     if (argc - optind < 2) {
         std::cerr << "missing arguments\n";
         die = true;
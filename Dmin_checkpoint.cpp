@@ -0,0 +1,89 @@
+//
+//  Dmin_checkpoint.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#include "Dmin_checkpoint.h"
+#include "Dsuite_bgzf.h"
+#include <unistd.h>
+#include <string.h>
+
+static const uint32_t DMIN_CHECKPOINT_VERSION = 1;
+
+void tellInputOffset(std::istream* file, DminInputPosition& position) {
+    position.offsetType = INPUT_OFFSET_NONE; position.offset = 0;
+    if (ibgzfstream* bgzfFile = dynamic_cast<ibgzfstream*>(file)) {
+        if (bgzfFile->tellVirtual(position.offset)) position.offsetType = INPUT_OFFSET_BGZF;
+    } else if (std::ifstream* plainFile = dynamic_cast<std::ifstream*>(file)) {
+        std::streamoff offset = plainFile->tellg();
+        if (offset >= 0) { position.offsetType = INPUT_OFFSET_BYTES; position.offset = (uint64_t)offset; }
+    }
+}
+
+bool seekInputOffset(std::istream* file, const DminInputPosition& position) {
+    if (position.offsetType == INPUT_OFFSET_BGZF) {
+        ibgzfstream* bgzfFile = dynamic_cast<ibgzfstream*>(file);
+        return bgzfFile != NULL && bgzfFile->seekVirtual(position.offset);
+    } else if (position.offsetType == INPUT_OFFSET_BYTES) {
+        std::ifstream* plainFile = dynamic_cast<std::ifstream*>(file);
+        if (plainFile == NULL) return false;
+        plainFile->clear();
+        return (bool)plainFile->seekg((std::streamoff)position.offset);
+    }
+    return false;
+}
+
+void writeDminCheckpoint(const string& fileName, const string& runKey, const TrioTable& table, const DminInputPosition& position) {
+    string tempFileName = fileName + ".tmp";
+    FILE* f = fopen(tempFileName.c_str(), "wb");
+    if (f == NULL) { std::cerr << "Warning: could not open " << tempFileName << " to write a checkpoint" << std::endl; return; }
+    uint32_t version = DMIN_CHECKPOINT_VERSION; uint32_t keyLength = (uint32_t)runKey.length();
+    uint32_t localCountSize = sizeof(LocalCount); uint32_t blockValueSize = sizeof(JackknifeBlockValue);
+    int64_t firstTrio = table.firstTrio; int64_t nTrios = table.nTrios;
+    bool ok = fwrite("DSCP", 4, 1, f) == 1 && fwrite(&version, sizeof(version), 1, f) == 1
+        && fwrite(&keyLength, sizeof(keyLength), 1, f) == 1 && fwrite(runKey.data(), 1, keyLength, f) == keyLength
+        && fwrite(&localCountSize, sizeof(localCountSize), 1, f) == 1 && fwrite(&blockValueSize, sizeof(blockValueSize), 1, f) == 1
+        && fwrite(&firstTrio, sizeof(firstTrio), 1, f) == 1 && fwrite(&nTrios, sizeof(nTrios), 1, f) == 1
+        && fwrite(&position.variantNumber, sizeof(position.variantNumber), 1, f) == 1
+        && fwrite(&position.offsetType, sizeof(position.offsetType), 1, f) == 1 && fwrite(&position.offset, sizeof(position.offset), 1, f) == 1
+        && table.save(f) && fwrite("DSCE", 4, 1, f) == 1;
+    ok = (fflush(f) == 0) && ok;
+    ok = (fsync(fileno(f)) == 0) && ok; // On disk before it replaces the previous checkpoint
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tempFileName.c_str(), fileName.c_str()) != 0) {
+        std::cerr << "Warning: could not write the checkpoint " << fileName << std::endl;
+        remove(tempFileName.c_str());
+    }
+}
+
+bool readDminCheckpoint(const string& fileName, const string& runKey, TrioTable& table, DminInputPosition& position) {
+    FILE* f = fopen(fileName.c_str(), "rb");
+    if (f == NULL) return false;
+    char magic[4]; uint32_t version = 0; uint32_t keyLength = 0;
+    if (fread(magic, 4, 1, f) != 1 || memcmp(magic, "DSCP", 4) != 0 || fread(&version, sizeof(version), 1, f) != 1 || version != DMIN_CHECKPOINT_VERSION) {
+        std::cerr << "Error: " << fileName << " is not a checkpoint written by this version of " PROGRAM_BIN << std::endl; exit(EXIT_FAILURE);
+    }
+    string key;
+    if (fread(&keyLength, sizeof(keyLength), 1, f) == 1) {
+        key.resize(keyLength);
+        if (keyLength > 0 && fread(&key[0], 1, keyLength, f) != keyLength) key = "";
+    }
+    uint32_t localCountSize = 0, blockValueSize = 0; int64_t firstTrio = -1, nTrios = -1;
+    bool ok = fread(&localCountSize, sizeof(localCountSize), 1, f) == 1 && fread(&blockValueSize, sizeof(blockValueSize), 1, f) == 1
+        && fread(&firstTrio, sizeof(firstTrio), 1, f) == 1 && fread(&nTrios, sizeof(nTrios), 1, f) == 1;
+    if (key != runKey || !ok || firstTrio != table.firstTrio || nTrios != table.nTrios) {
+        std::cerr << "Error: the checkpoint " << fileName << " is from a run with different input files or options" << std::endl;
+        std::cerr << "Please run with the same options, or delete the checkpoint to start again" << std::endl; exit(EXIT_FAILURE);
+    }
+    if (localCountSize != sizeof(LocalCount) || blockValueSize != sizeof(JackknifeBlockValue)) {
+        std::cerr << "Error: the checkpoint " << fileName << " was written by a " PROGRAM_BIN " built with different precision options" << std::endl; exit(EXIT_FAILURE);
+    }
+    ok = fread(&position.variantNumber, sizeof(position.variantNumber), 1, f) == 1
+        && fread(&position.offsetType, sizeof(position.offsetType), 1, f) == 1 && fread(&position.offset, sizeof(position.offset), 1, f) == 1
+        && table.load(f) && fread(magic, 4, 1, f) == 1 && memcmp(magic, "DSCE", 4) == 0;
+    fclose(f);
+    if (!ok) { std::cerr << "Error: the checkpoint " << fileName << " is truncated" << std::endl; exit(EXIT_FAILURE); }
+    return true;
+}
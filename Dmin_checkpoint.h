@@ -0,0 +1,43 @@
+//
+//  Dmin_checkpoint.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dmin_checkpoint_h
+#define Dmin_checkpoint_h
+
+#include "Dsuite_utils.h"
+#include "Dmin_trios.h"
+#include <stdint.h>
+
+#define DMIN_CHECKPOINT_EXT "_checkpoint.bin"
+
+// How the place in the input to continue from is stored
+enum { INPUT_OFFSET_NONE = 0, // Unknown (e.g. a plain gzip file): the variants before it are read again and skipped
+       INPUT_OFFSET_BYTES, // A byte offset in an uncompressed file
+       INPUT_OFFSET_BGZF, // A BGZF virtual offset
+       INPUT_OFFSET_CACHE_SITE }; // A site number in a genotype cache
+
+struct DminInputPosition {
+    int64_t variantNumber; // The variants read so far (as counted for --region=start,length and the progress messages)
+    uint32_t offsetType;
+    uint64_t offset;
+};
+
+// Where the next line will be read from a VCF or BCF stream; INPUT_OFFSET_NONE if that can't be found out
+void tellInputOffset(std::istream* file, DminInputPosition& position);
+// Continue reading a stream from a position from tellInputOffset(); false if it can't be done
+bool seekInputOffset(std::istream* file, const DminInputPosition& position);
+
+// A Dtrios checkpoint (OUTPUT_checkpoint.bin) holds all the accumulated trio state and the place in the input it corresponds to
+// Layout (native byte order): "DSCP", uint32 version, uint32 runKey length, the runKey, uint32 sizeof(LocalCount),
+// uint32 sizeof(JackknifeBlockValue), int64 firstTrio, int64 nTrios, the DminInputPosition fields, TrioTable::save(), "DSCE"
+// The runKey describes the run (input files and options), so that a checkpoint is only used to resume the same run
+// It is written to a temporary file which is then renamed over the previous checkpoint, so there is always a complete one
+void writeDminCheckpoint(const string& fileName, const string& runKey, const TrioTable& table, const DminInputPosition& position);
+// False if there is no checkpoint; exits with an error message if the checkpoint is for a different run or damaged
+bool readDminCheckpoint(const string& fileName, const string& runKey, TrioTable& table, DminInputPosition& position);
+
+#endif /* Dmin_checkpoint_h */
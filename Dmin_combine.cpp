@@ -7,6 +7,10 @@
 //
 
 #include "Dmin_combine.h"
+#include "Dsuite_pipeline.h"
+#include "Dsuite_output.h"
+#include <atomic>
+#include <string.h>
 
 #define SUBPROGRAM "DtriosCombine"
 
@@ -16,21 +20,25 @@ static const char *DMINCOMBINE_USAGE_MESSAGE =
 "Usage: " PROGRAM_BIN " " SUBPROGRAM " [OPTIONS] DminFile1 DminFile2 DminFile3 ....\n"
 "Combine the BBAA, ABBA, and BABA counts from multiple files (e.g per-chromosome) and output the overall Dmin stats\n"
 "also the D stats for the trio arrangement where the BBAA is the most common pattern\n"
+"For each DminFile, the binary DminFile" COMBINE_BINARY_EXT " (Dtrios --binary-combine) is read if there is one,\n"
+"otherwise DminFile_combine.txt and DminFile_combine_stderr.txt (or the same with .gz)\n"
 "\n"
 "       -h, --help                              display this help and exit\n"
 "       -n, --run-name                          run-name will be included in the output file name\n"
 "       -s , --subset=start,length              (optional) only process a subset of the trios\n"
+"       --threads=N                             (default=1) use N threads to combine the trios (the files are read by another thread)\n"
 "\n"
 "\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
 
 
-enum { OPT_AA_EQ_O }; 
+enum { OPT_THREADS = 1 };
 
 static const char* shortopts = "hn:s:";
 
 static const struct option longopts[] = {
     { "subset",   required_argument, NULL, 's' },
     { "run-name",   required_argument, NULL, 'n' },
+    { "threads",   required_argument, NULL, OPT_THREADS },
     { "help",   no_argument, NULL, 'h' },
     { NULL, 0, NULL, 0 }
 };
@@ -41,175 +49,255 @@ namespace opt
     static string runName = "combined";
     int subsetStart = -1;
     int subsetLength = -1;
+    static int numThreads = 1;
 }
 
 
+// How many trios go into one batch passed between the pipeline stages
+static const int COMBINE_TRIOS_PER_BATCH = 1000;
+
+// Opens name or name.gz
+static std::istream* openTextFile(const string& name) {
+    if (file_exists(name)) return createReader(name.c_str());
+    else if (file_exists(name + ".gz")) return createReader((name + ".gz").c_str());
+    std::cerr << "Can't fine the file: " << name << " or " << name + ".gz" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+// The same value as stringToDouble, without a stringstream for each number: anything that doesn't read as a finite number gives 0
+static double combineFieldToDouble(const LineTokenizer& fields, size_t i) {
+    char buffer[64]; size_t length = std::min(fields.fieldLength(i), sizeof(buffer) - 1);
+    memcpy(buffer, fields.field(i), length); buffer[length] = '\0';
+    char* end; double d = strtod(buffer, &end);
+    if (end == buffer || !std::isfinite(d)) return 0;
+    return d;
+}
+
+CombineInput::CombineInput(const string& dminFile) : countsFile(NULL), blocksFile(NULL), binaryFile(NULL), nextTrio(0) {
+    if (file_exists(dminFile + COMBINE_BINARY_EXT)) {
+        binaryFile = new CombineBinaryFile(dminFile + COMBINE_BINARY_EXT);
+    } else {
+        countsFile = openTextFile(dminFile + "_combine.txt");
+        blocksFile = openTextFile(dminFile + "_combine_stderr.txt");
+    }
+}
+
+bool CombineInput::readTrio(CombineTrioRecord& record) {
+    if (binaryFile != NULL) {
+        record.hasCounts = record.hasBlockDs = (nextTrio < binaryFile->nTrios);
+        record.binaryTrio = nextTrio;
+        if (record.hasCounts) nextTrio++;
+    } else {
+        record.hasCounts = (bool)getline(*countsFile, record.countsLine);
+        record.hasBlockDs = (bool)getline(*blocksFile, record.blockDsLine);
+    }
+    return record.hasCounts || record.hasBlockDs;
+}
+
+void CombineInput::skipTrio() {
+    if (binaryFile != NULL) {
+        if (nextTrio < binaryFile->nTrios) nextTrio++;
+    } else {
+        getline(*countsFile, line); getline(*blocksFile, line);
+    }
+}
+
+void CombineInput::parseCounts(const CombineTrioRecord& record, CombineParseScratch& scratch, string& s1, string& s2, string& s3, double& BBAA, double& BABA, double& ABBA) const {
+    if (binaryFile != NULL) {
+        const CombineBinaryTrio& trio = binaryFile->trio(record.binaryTrio);
+        s1 = binaryFile->speciesNames[trio.species[0]]; s2 = binaryFile->speciesNames[trio.species[1]]; s3 = binaryFile->speciesNames[trio.species[2]];
+        BBAA = trio.BBAA; BABA = trio.BABA; ABBA = trio.ABBA;
+        return;
+    }
+    LineTokenizer& patternCounts = scratch.fields;
+    patternCounts.tokenize(record.countsLine);
+    assert(patternCounts.size() == 6);
+    patternCounts.assignField(0, s1); patternCounts.assignField(1, s2); patternCounts.assignField(2, s3);
+    BBAA = combineFieldToDouble(patternCounts, 3);
+    BABA = combineFieldToDouble(patternCounts, 4);
+    ABBA = combineFieldToDouble(patternCounts, 5);
+}
+
+void CombineInput::parseBlockDs(const CombineTrioRecord& record, CombineParseScratch& scratch, std::vector<double>& BBAA_Ds, std::vector<double>& BABA_Ds, std::vector<double>& ABBA_Ds) const {
+    std::vector<double>* Ds[3] = { &BBAA_Ds, &BABA_Ds, &ABBA_Ds };
+    if (binaryFile != NULL) {
+        uint32_t nBlocks = binaryFile->trio(record.binaryTrio).nBlocks;
+        for (int k = 0; k != 3; k++) {
+            const float* blockDs = binaryFile->blockDs(record.binaryTrio, k);
+            for (uint32_t b = 0; b != nBlocks; b++) if (!isnan(blockDs[b])) Ds[k]->push_back(blockDs[b]);
+        }
+        return;
+    }
+    LineTokenizer& localDs = scratch.fields;
+    localDs.tokenize(record.blockDsLine);
+    //assert(localDs.size() == 3 || localDs.size() == 0);
+    if (localDs.size() == 3) {
+        for (int k = 0; k != 3; k++) { localDs.assignField(k, scratch.columns[k]); scratch.localDs[k].tokenize(scratch.columns[k], ','); }
+        for (size_t j = 0; j < scratch.localDs[0].size(); j++) {
+            for (int k = 0; k != 3; k++) {
+                if (j >= scratch.localDs[k].size()) continue;
+                double thisLocalD = combineFieldToDouble(scratch.localDs[k], j);
+                if (!isnan(thisLocalD)) Ds[k]->push_back(thisLocalD);
+            }
+        }
+    } else {
+        print_vector(split(record.blockDsLine, '\t'), std::cerr);
+    }
+}
+
+// A batch of trios on their way through the reading -> combining -> output pipeline
+struct CombineTrioBatch {
+    int nTrios; int firstTrioNumber; // Counting from 1, as in --subset
+    std::vector<std::vector<CombineTrioRecord> > records; // For each trio, the records from all the runs; reused for every batch
+    CombineParseScratch scratch;
+    std::vector<double> BBAA_local_Ds; std::vector<double> ABBA_local_Ds; std::vector<double> BABA_local_Ds;
+    ResultBuffer BBAAoutput; ResultBuffer DminOutput; // The output lines of the batch
+    bool allDone; // A trio without jackknife blocks was found: the output ends with the trio before it
+};
+
 int DminCombineMain(int argc, char** argv) {
     parseDminCombineOptions(argc, argv);
-    string line; // for reading the input files
     
-    std::vector<std::istream*> dminstdErrFiles; std::vector<std::istream*> dminBBAAscoreFiles;
+    std::vector<CombineInput*> dminInputs;
     for (int i = 0; i < opt::dminFiles.size(); i++) {
-        std::istream* dminBBAAscoreFile;
-        if (file_exists(opt::dminFiles[i] + "_combine.txt")) {
-            dminBBAAscoreFile = createReader((opt::dminFiles[i] + "_combine.txt").c_str());
-        } else if(file_exists(opt::dminFiles[i] + "_combine.txt.gz")) {
-            dminBBAAscoreFile = createReader((opt::dminFiles[i] + "_combine.txt.gz").c_str());
-        } else {
-            std::cerr << "Can't fine the file: " << opt::dminFiles[i] + "_combine.txt" << " or " << opt::dminFiles[i] + "_combine.txt.gz" << std::endl;
-        }
-        dminBBAAscoreFiles.push_back(dminBBAAscoreFile);
-        std::istream* dminstdErrFile;
-        if (file_exists(opt::dminFiles[i] + "_combine_stderr.txt")) {
-            dminstdErrFile = createReader((opt::dminFiles[i] + "_combine_stderr.txt").c_str());
-        } else if(file_exists(opt::dminFiles[i] + "_combine_stderr.txt.gz")) {
-            dminstdErrFile = createReader((opt::dminFiles[i] + "_combine_stderr.txt.gz").c_str());
-        } else {
-            std::cerr << "Can't fine the file: " << opt::dminFiles[i] + "_combine_stderr.txt" << " or " << opt::dminFiles[i] + "_combine_stderr.txt.gz" << std::endl;
-        }
-        dminstdErrFiles.push_back(dminstdErrFile);
+        dminInputs.push_back(new CombineInput(opt::dminFiles[i]));
         std::cerr << "Reading file " << opt::dminFiles[i] << std::endl;
     }
     
     
     // Now get the standard error values
-    std::ofstream* outFileBBAA = new std::ofstream(opt::runName + "_BBAA.txt"); std::ofstream* outFileDmin = new std::ofstream(opt::runName + "_Dmin.txt");
-    std::vector<double> BBAA_local_Ds; std::vector<double> ABBA_local_Ds; std::vector<double> BABA_local_Ds;
-    string s1; string s2; string s3;
-    double BBAAtotal = 0; double ABBAtotal = 0; double BABAtotal = 0;
-    bool allDone = false;
-    int processedTriosNumber = 0;
-    do {
-        processedTriosNumber++;
-        if (processedTriosNumber % 10000 == 0) {
-            //durationOverall = ( std::clock() - start ) / (double) CLOCKS_PER_SEC;
-            std::cerr << "Processed " << processedTriosNumber << " trios" << std::endl;
-            //std::cerr << "GettingCounts " << durationGettingCounts << " calculation " << durationCalculation << "secs" << std::endl;
-        }
-        if (opt::subsetStart != -1) {
-            if (processedTriosNumber < opt::subsetStart) {
-                for (int i = 0; i < dminBBAAscoreFiles.size(); i++) { getline(*dminBBAAscoreFiles[i], line); }
-                for (int i = 0; i < dminstdErrFiles.size(); i++) { getline(*dminstdErrFiles[i], line); }
-                continue;
-            }
-            if (processedTriosNumber > (opt::subsetStart+opt::subsetLength)) {
-                std::cerr << "DONE" << std::endl; break;
-            }
-        }
-        for (int i = 0; i < dminBBAAscoreFiles.size(); i++) {
-            if (getline(*dminBBAAscoreFiles[i], line)) {
-                std::vector<string> patternCounts = split(line, '\t');
-                assert(patternCounts.size() == 6);
-                if (i == 0) {
-                    s1 = patternCounts[0];
-                    s2 = patternCounts[1];
-                    s3 = patternCounts[2];
-                } else {
-                    assert(s1 == patternCounts[0]); assert(s2 == patternCounts[1]); assert(s3 == patternCounts[2]);
+    ResultWriter* outFileBBAA = new ResultWriter(opt::runName + "_BBAA.txt", opt::numThreads > 1); ResultWriter* outFileDmin = new ResultWriter(opt::runName + "_Dmin.txt", opt::numThreads > 1);
+    
+    // The trios are read in batches on one thread, combined and output in order
+    int processedTriosNumber = 0; bool inputFinished = false; bool subsetFinished = false;
+    std::atomic<bool> allDone(false);
+    std::function<bool(CombineTrioBatch&)> readTrios = [&](CombineTrioBatch& b) -> bool {
+        b.nTrios = 0; b.firstTrioNumber = processedTriosNumber + 1;
+        while (b.nTrios < COMBINE_TRIOS_PER_BATCH && !inputFinished && !subsetFinished && !allDone) {
+            processedTriosNumber++;
+            if (opt::subsetStart != -1) {
+                if (processedTriosNumber < opt::subsetStart) {
+                    for (int i = 0; i < dminInputs.size(); i++) dminInputs[i]->skipTrio();
+                    b.firstTrioNumber = processedTriosNumber + 1;
+                    continue;
+                }
+                if (processedTriosNumber > (opt::subsetStart+opt::subsetLength)) {
+                    subsetFinished = true; break;
                 }
-                double BBAA = stringToDouble(patternCounts[3]);
-                double BABA = stringToDouble(patternCounts[4]);
-                double ABBA = stringToDouble(patternCounts[5]);
-                BBAAtotal += BBAA; ABBAtotal += ABBA; BABAtotal += BABA;
             }
+            if (b.records.size() == b.nTrios) b.records.push_back(std::vector<CombineTrioRecord>(dminInputs.size()));
+            bool anyRecords = false;
+            for (int i = 0; i < dminInputs.size(); i++) if (dminInputs[i]->readTrio(b.records[b.nTrios][i])) anyRecords = true;
+            if (!anyRecords) { inputFinished = true; break; } // This would be a trio without any jackknife blocks
+            b.nTrios++;
         }
-        //std::cerr << "ABBAtotal = " << ABBAtotal << std::endl;
-        //std::cerr << "BABAtotal = " << BABAtotal << std::endl;
-        double Dnum1 = ABBAtotal - BABAtotal; // assert(Dnum1 == Dnums[i][0]);
-        double Dnum2 = ABBAtotal - BBAAtotal; // assert(Dnum2 == Dnums[i][1]);
-        double Dnum3 = BBAAtotal - BABAtotal; // assert(Dnum3 == Dnums[i][2]);
-        double Ddenom1 = ABBAtotal + BABAtotal; // assert(Ddenom1 == Ddenoms[i][0]);
-        double Ddenom2 = ABBAtotal + BBAAtotal; // assert(Ddenom2 == Ddenoms[i][1]);
-        double Ddenom3 = BBAAtotal + BABAtotal; // assert(Ddenom3 == Ddenoms[i][2]);
-        //std::cerr << "Dnum1 = " << Dnum1 << std::endl;
-        //std::cerr << "Ddenom1 = " << Ddenom1 << std::endl;
-        double D1 = Dnum1/Ddenom1; double D2 = Dnum2/Ddenom2; double D3 = Dnum3/Ddenom3;
-        //std::cerr << "D1 = " << D1 << std::endl;
-        for (int i = 0; i < dminstdErrFiles.size(); i++) {
-            if (getline(*dminstdErrFiles[i], line)) {
-                std::vector<string> localDs = split(line, '\t');
-                //assert(localDs.size() == 3 || localDs.size() == 0);
-                if (localDs.size() == 3) {
-                    std::vector<string> BBAA_D_strings = split(localDs[0], ',');
-                    std::vector<string> BABA_D_strings = split(localDs[1], ',');
-                    std::vector<string> ABBA_D_strings = split(localDs[2], ',');
-                    for (int j = 0; j < BBAA_D_strings.size(); j++) {
-                        //std::cerr << "BBAA_D_strings[j] = " << BBAA_D_strings[j] << std::endl;
-                        double thisBBAA_localD = stringToDouble(BBAA_D_strings[j]);
-                        if (!isnan(thisBBAA_localD)) BBAA_local_Ds.push_back(thisBBAA_localD);
-                        // std::cerr << "BABA_D_strings[j] = " << BABA_D_strings[j] << std::endl;
-                        double thisBABA_localD = stringToDouble(BABA_D_strings[j]);
-                        if (!isnan(thisBABA_localD)) BABA_local_Ds.push_back(thisBABA_localD);
-                        //std::cerr << "ABBA_D_strings[j] = " << ABBA_D_strings[j] << std::endl;
-                        double thisABBA_localD = stringToDouble(ABBA_D_strings[j]);
-                        if (!isnan(thisABBA_localD)) ABBA_local_Ds.push_back(thisABBA_localD);
+        return b.nTrios > 0;
+    };
+    std::function<void(CombineTrioBatch&)> combineTrios = [&](CombineTrioBatch& b) {
+        b.BBAAoutput.clear(); b.DminOutput.clear(); b.allDone = false;
+        std::vector<double>& BBAA_local_Ds = b.BBAA_local_Ds; std::vector<double>& ABBA_local_Ds = b.ABBA_local_Ds; std::vector<double>& BABA_local_Ds = b.BABA_local_Ds;
+        ResultBuffer& outFileBBAA = b.BBAAoutput; ResultBuffer& outFileDmin = b.DminOutput;
+        string s1; string s2; string s3;
+        for (int t = 0; t != b.nTrios; t++) {
+            BBAA_local_Ds.clear(); ABBA_local_Ds.clear(); BABA_local_Ds.clear();
+            double BBAAtotal = 0; double ABBAtotal = 0; double BABAtotal = 0;
+            for (int i = 0; i < dminInputs.size(); i++) {
+                const CombineTrioRecord& record = b.records[t][i];
+                if (record.hasCounts) {
+                    string t1, t2, t3; double BBAA, BABA, ABBA;
+                    dminInputs[i]->parseCounts(record, b.scratch, t1, t2, t3, BBAA, BABA, ABBA);
+                    if (i == 0) {
+                        s1 = t1; s2 = t2; s3 = t3;
+                    } else {
+                        assert(s1 == t1); assert(s2 == t2); assert(s3 == t3);
                     }
-                } else {
-                    print_vector(localDs,std::cerr);
+                    BBAAtotal += BBAA; ABBAtotal += ABBA; BABAtotal += BABA;
                 }
             }
+            double Dnum1 = ABBAtotal - BABAtotal; // assert(Dnum1 == Dnums[i][0]);
+            double Dnum2 = ABBAtotal - BBAAtotal; // assert(Dnum2 == Dnums[i][1]);
+            double Dnum3 = BBAAtotal - BABAtotal; // assert(Dnum3 == Dnums[i][2]);
+            double Ddenom1 = ABBAtotal + BABAtotal; // assert(Ddenom1 == Ddenoms[i][0]);
+            double Ddenom2 = ABBAtotal + BBAAtotal; // assert(Ddenom2 == Ddenoms[i][1]);
+            double Ddenom3 = BBAAtotal + BABAtotal; // assert(Ddenom3 == Ddenoms[i][2]);
+            //std::cerr << "Dnum1 = " << Dnum1 << std::endl;
+            //std::cerr << "Ddenom1 = " << Ddenom1 << std::endl;
+            double D1 = Dnum1/Ddenom1; double D2 = Dnum2/Ddenom2; double D3 = Dnum3/Ddenom3;
+            //std::cerr << "D1 = " << D1 << std::endl;
+            for (int i = 0; i < dminInputs.size(); i++) {
+                if (b.records[t][i].hasBlockDs) dminInputs[i]->parseBlockDs(b.records[t][i], b.scratch, BBAA_local_Ds, BABA_local_Ds, ABBA_local_Ds);
+            }
+            if (BBAA_local_Ds.size() == 0 || BABA_local_Ds.size() == 0 || ABBA_local_Ds.size() == 0) { // no info to estimate the standard error; probably all lines have been processed
+                b.allDone = true; allDone = true; break;
+            }
+            // std::cerr << "D1 = " << D1 << std::endl;
+            //print_vector(BBAA_local_Ds, std::cerr);
+            double BBAAstdErr = jackknive_std_err(BBAA_local_Ds);
+            //print_vector(BABA_local_Ds, std::cerr);
+            double BABAstdErr = jackknive_std_err(BABA_local_Ds);
+            //print_vectorABBA_local_Ds, std::cerr);
+            //std::cerr << "D1 = " << D1 << std::endl;
+            double ABBAstdErr = jackknive_std_err(ABBA_local_Ds);
+            //std::cerr << "D1 = " << D1 << std::endl;
+            //std::cerr << "BBAAstdErr" << BBAAstdErr << std::endl;
+            double D1_Z = fabs(D1)/BBAAstdErr; double D2_Z = fabs(D2)/BABAstdErr;
+            double D3_Z = fabs(D3)/ABBAstdErr;
+            
+            // Find which topology is in agreement with the counts of the BBAA, BABA, and ABBA patterns
+            if (BBAAtotal >= BABAtotal && BBAAtotal >= ABBAtotal) {
+                if (D1 >= 0)
+                    outFileBBAA << s1 << "\t" << s2 << "\t" << s3;
+                else
+                    outFileBBAA << s2 << "\t" << s1 << "\t" << s3;
+                outFileBBAA << "\t" << fabs(D1) << "\t" << D1_Z << "\t";
+                outFileBBAA << BBAAtotal << "\t" << BABAtotal << "\t" << ABBAtotal << std::endl;
+            } else if (BABAtotal >= BBAAtotal && BABAtotal >= ABBAtotal) {
+                if (D2 >= 0)
+                    outFileBBAA << s1 << "\t" << s3 << "\t" << s2;
+                else
+                    outFileBBAA << s3 << "\t" << s1 << "\t" << s2;
+                outFileBBAA << "\t" << fabs(D2) << "\t" << D2_Z << "\t";
+                outFileBBAA << BABAtotal << "\t" << BBAAtotal << "\t" << ABBAtotal << std::endl;
+            } else if (ABBAtotal >= BBAAtotal && ABBAtotal >= BABAtotal) {
+                if (D3 >= 0)
+                    outFileBBAA << s3 << "\t" << s2 << "\t" << s1;
+                else
+                    outFileBBAA << s2 << "\t" << s3 << "\t" << s1;
+                outFileBBAA << "\t" << fabs(D3) << "\t" << D3_Z << "\t";
+                outFileBBAA << ABBAtotal << "\t" << BABAtotal << "\t" << BBAAtotal << std::endl;
+            }
+            
+            // Find Dmin:
+            if (fabs(D1) <= fabs(D2) && fabs(D1) <= fabs(D3)) { // (P3 == S3)
+                if (D1 >= 0)
+                    outFileDmin << s1 << "\t" << s2 << "\t" << s3 << "\t" << D1 << "\t" << D1_Z << "\t" << std::endl;
+                else
+                    outFileDmin << s1 << "\t" << s2 << "\t" << s3 << "\t" << fabs(D1) << "\t" << D1_Z << "\t"<< std::endl;
+            } else if (fabs(D2) <= fabs(D1) && fabs(D2) <= fabs(D3)) { // (P3 == S2)
+                if (D2 >= 0)
+                    outFileDmin << s1 << "\t" << s3 << "\t" << s2 << "\t" << D2 << "\t" << D2_Z << "\t"<< std::endl;
+                else
+                    outFileDmin << s3 << "\t" << s1 << "\t" << s2 << "\t" << fabs(D2) << "\t" << D2_Z << "\t"<< std::endl;
+            } else if (fabs(D3) <= fabs(D1) && fabs(D3) <= fabs(D2)) { // (P3 == S1)
+                if (D3 >= 0)
+                    outFileDmin << s3 << "\t" << s2 << "\t" << s1 << "\t" << D3 << "\t" << D3_Z << "\t"<< std::endl;
+                else
+                    outFileDmin << s2 << "\t" << s3 << "\t" << s1 << "\t" << fabs(D3) << "\t" << D3_Z << "\t" << std::endl;;
+            }
+            
         }
-        if (BBAA_local_Ds.size() == 0 || BABA_local_Ds.size() == 0 || ABBA_local_Ds.size() == 0) { // no info to estimate the standard error; probably all lines have been processed
-            allDone = true; break;
-        }
-        // std::cerr << "D1 = " << D1 << std::endl;
-        //print_vector(BBAA_local_Ds, std::cerr);
-        double BBAAstdErr = jackknive_std_err(BBAA_local_Ds);
-        //print_vector(BABA_local_Ds, std::cerr);
-        double BABAstdErr = jackknive_std_err(BABA_local_Ds);
-        //print_vectorABBA_local_Ds, std::cerr);
-        //std::cerr << "D1 = " << D1 << std::endl;
-        double ABBAstdErr = jackknive_std_err(ABBA_local_Ds);
-        //std::cerr << "D1 = " << D1 << std::endl;
-        //std::cerr << "BBAAstdErr" << BBAAstdErr << std::endl;
-        double D1_Z = fabs(D1)/BBAAstdErr; double D2_Z = fabs(D2)/BABAstdErr;
-        double D3_Z = fabs(D3)/ABBAstdErr;
-        
-        // Find which topology is in agreement with the counts of the BBAA, BABA, and ABBA patterns
-        if (BBAAtotal >= BABAtotal && BBAAtotal >= ABBAtotal) {
-            if (D1 >= 0)
-                *outFileBBAA << s1 << "\t" << s2 << "\t" << s3;
-            else
-                *outFileBBAA << s2 << "\t" << s1 << "\t" << s3;
-            *outFileBBAA << "\t" << fabs(D1) << "\t" << D1_Z << "\t";
-            *outFileBBAA << BBAAtotal << "\t" << BABAtotal << "\t" << ABBAtotal << std::endl;
-        } else if (BABAtotal >= BBAAtotal && BABAtotal >= ABBAtotal) {
-            if (D2 >= 0)
-                *outFileBBAA << s1 << "\t" << s3 << "\t" << s2;
-            else
-                *outFileBBAA << s3 << "\t" << s1 << "\t" << s2;
-            *outFileBBAA << "\t" << fabs(D2) << "\t" << D2_Z << "\t";
-            *outFileBBAA << BABAtotal << "\t" << BBAAtotal << "\t" << ABBAtotal << std::endl;
-        } else if (ABBAtotal >= BBAAtotal && ABBAtotal >= BABAtotal) {
-            if (D3 >= 0)
-                *outFileBBAA << s3 << "\t" << s2 << "\t" << s1;
-            else
-                *outFileBBAA << s2 << "\t" << s3 << "\t" << s1;
-            *outFileBBAA << "\t" << fabs(D3) << "\t" << D3_Z << "\t";
-            *outFileBBAA << ABBAtotal << "\t" << BABAtotal << "\t" << BBAAtotal << std::endl;
-        }
-        
-        // Find Dmin:
-        if (fabs(D1) <= fabs(D2) && fabs(D1) <= fabs(D3)) { // (P3 == S3)
-            if (D1 >= 0)
-                *outFileDmin << s1 << "\t" << s2 << "\t" << s3 << "\t" << D1 << "\t" << D1_Z << "\t" << std::endl;
-            else
-                *outFileDmin << s1 << "\t" << s2 << "\t" << s3 << "\t" << fabs(D1) << "\t" << D1_Z << "\t"<< std::endl;
-        } else if (fabs(D2) <= fabs(D1) && fabs(D2) <= fabs(D3)) { // (P3 == S2)
-            if (D2 >= 0)
-                *outFileDmin << s1 << "\t" << s3 << "\t" << s2 << "\t" << D2 << "\t" << D2_Z << "\t"<< std::endl;
-            else
-                *outFileDmin << s3 << "\t" << s1 << "\t" << s2 << "\t" << fabs(D2) << "\t" << D2_Z << "\t"<< std::endl;
-        } else if (fabs(D3) <= fabs(D1) && fabs(D3) <= fabs(D2)) { // (P3 == S1)
-            if (D3 >= 0)
-                *outFileDmin << s3 << "\t" << s2 << "\t" << s1 << "\t" << D3 << "\t" << D3_Z << "\t"<< std::endl;
-            else
-                *outFileDmin << s2 << "\t" << s3 << "\t" << s1 << "\t" << fabs(D3) << "\t" << D3_Z << "\t" << std::endl;;
-        }
-        
-        BBAA_local_Ds.clear(); ABBA_local_Ds.clear(); BABA_local_Ds.clear();
-        BBAAtotal = 0; ABBAtotal = 0; BABAtotal = 0;
-    } while(!allDone);
+    };
+    bool outputFinished = false;
+    std::function<void(CombineTrioBatch&)> writeTrios = [&](CombineTrioBatch& b) {
+        if (outputFinished) return;
+        *outFileBBAA << b.BBAAoutput; *outFileDmin << b.DminOutput;
+        if (b.allDone) outputFinished = true;
+        int lastTrioNumber = b.firstTrioNumber + b.nTrios - 1;
+        if (lastTrioNumber / 10000 != (b.firstTrioNumber - 1) / 10000) std::cerr << "Processed " << (lastTrioNumber / 10000) * 10000 << " trios" << std::endl;
+    };
+    runBatchPipeline<CombineTrioBatch>(opt::numThreads, readTrios, combineTrios, writeTrios);
+    if (subsetFinished) std::cerr << "DONE" << std::endl;
+    outFileBBAA->close(); outFileDmin->close();
     
     return 0;
     
@@ -226,6 +314,7 @@ void parseDminCombineOptions(int argc, char** argv) {
         {
             case '?': die = true; break;
             case 'n': arg >> opt::runName; break;
+            case OPT_THREADS: arg >> opt::numThreads; break;
             case 's': arg >> subsetArgString; subsetArgs = split(subsetArgString, ',');
                 opt::subsetStart = (int)stringToDouble(subsetArgs[0]); opt::subsetLength = (int)stringToDouble(subsetArgs[1]);  break;
             case 'h':
@@ -235,6 +324,11 @@ void parseDminCombineOptions(int argc, char** argv) {
     }
     
     
+    if (opt::numThreads < 1) {
+        std::cerr << "The number of threads must be at least 1\n";
+        die = true;
+    }
+    
     int nFilenames = argc - optind;
     if (nFilenames < 1) {
         std::cerr << "missing arguments\n";
@@ -10,6 +10,39 @@
 #define Dmin_combine_h
 
 #include "Dsuite_utils.h"
+#include "Dmin_combine_binary.h"
+
+// One trio from the combine output of one Dtrios run, as it was read (without parsing it yet)
+struct CombineTrioRecord {
+    bool hasCounts; bool hasBlockDs; // false when this run's files have finished
+    string countsLine; string blockDsLine; // From the text files
+    uint64_t binaryTrio; // From the binary file
+};
+
+// Reused for parsing all the records handled by one thread
+struct CombineParseScratch {
+    LineTokenizer fields; LineTokenizer localDs[3]; string columns[3];
+};
+
+// The combine output of one Dtrios run: readTrio goes through the trios in order (on one thread),
+// then parseCounts and parseBlockDs get the values out of the records (on any thread)
+// From the binary file if there is one, otherwise from the text files
+class CombineInput {
+public:
+    CombineInput(const string& dminFile);
+    ~CombineInput() { delete countsFile; delete blocksFile; delete binaryFile; }
+    
+    bool readTrio(CombineTrioRecord& record); // false when there is nothing more in either file
+    void skipTrio();
+    
+    void parseCounts(const CombineTrioRecord& record, CombineParseScratch& scratch, string& s1, string& s2, string& s3, double& BBAA, double& BABA, double& ABBA) const;
+    // Adds the ones that are not nan
+    void parseBlockDs(const CombineTrioRecord& record, CombineParseScratch& scratch, std::vector<double>& BBAA_Ds, std::vector<double>& BABA_Ds, std::vector<double>& ABBA_Ds) const;
+    
+private:
+    std::istream* countsFile; std::istream* blocksFile; string line;
+    CombineBinaryFile* binaryFile; uint64_t nextTrio;
+};
 
 void parseDminCombineOptions(int argc, char** argv);
 int DminCombineMain(int argc, char** argv);
@@ -0,0 +1,110 @@
+//
+//  Dmin_combine_binary.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#include "Dmin_combine_binary.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+static const uint32_t COMBINE_BINARY_VERSION = 1;
+
+static uint64_t roundUpTo8(uint64_t n) { return (n + 7) & ~(uint64_t)7; }
+
+static uint64_t recordSize(uint32_t nBlocks) { return sizeof(CombineBinaryTrio) + roundUpTo8((uint64_t)nBlocks * 3 * sizeof(float)); }
+
+CombineBinaryWriter::CombineBinaryWriter(const string& fileName, const std::vector<string>& speciesNames) : fileName(fileName) {
+    file = fopen(fileName.c_str(), "wb");
+    if (file == NULL) { std::cerr << "Error: could not open " << fileName << " for write" << std::endl; exit(EXIT_FAILURE); }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    string speciesTable;
+    for (std::vector<string>::size_type i = 0; i != speciesNames.size(); i++) { speciesTable += speciesNames[i]; speciesTable += '\0'; }
+    speciesTable.resize(roundUpTo8(speciesTable.length()), '\0');
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "DSCB", 4); header.version = COMBINE_BINARY_VERSION;
+    header.nSpecies = (uint32_t)speciesNames.size(); header.speciesTableBytes = (uint32_t)speciesTable.length();
+    header.fileSize = sizeof(header) + speciesTable.length();
+    fwrite(&header, sizeof(header), 1, file); // Filled in by close()
+    fwrite(speciesTable.data(), 1, speciesTable.length(), file);
+}
+
+CombineBinaryWriter::~CombineBinaryWriter() {
+    if (file != NULL) close();
+}
+
+void CombineBinaryWriter::addTrio(int s1, int s2, int s3, double BBAA, double BABA, double ABBA, const std::vector<double> blockDs[3]) {
+    CombineBinaryTrio trio; memset(&trio, 0, sizeof(trio));
+    trio.species[0] = (uint16_t)s1; trio.species[1] = (uint16_t)s2; trio.species[2] = (uint16_t)s3;
+    trio.nBlocks = (uint32_t)blockDs[0].size();
+    trio.BBAA = BBAA; trio.BABA = BABA; trio.ABBA = ABBA;
+    uint64_t size = recordSize(trio.nBlocks);
+    floats.assign((size - sizeof(trio)) / sizeof(float), 0);
+    for (int k = 0; k != 3; k++) {
+        for (uint32_t b = 0; b != trio.nBlocks; b++) floats[(size_t)k * trio.nBlocks + b] = (float)blockDs[k][b];
+    }
+    fwrite(&trio, sizeof(trio), 1, file);
+    if (!floats.empty()) fwrite(floats.data(), sizeof(float), floats.size(), file);
+    header.nTrios++; header.nBlocks += trio.nBlocks; header.fileSize += size;
+}
+
+void CombineBinaryWriter::addRecords(const unsigned char* records, size_t nBytes, uint64_t nTrios, uint64_t nBlocks) {
+    if (nBytes > 0) fwrite(records, 1, nBytes, file);
+    header.nTrios += nTrios; header.nBlocks += nBlocks; header.fileSize += nBytes;
+}
+
+void CombineBinaryWriter::close() {
+    bool ok = (fseeko(file, 0, SEEK_SET) == 0) && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = (fclose(file) == 0) && ok; file = NULL;
+    if (!ok) { std::cerr << "Error: could not write " << fileName << std::endl; exit(EXIT_FAILURE); }
+}
+
+CombineBinaryFile::CombineBinaryFile(const string& fileName) : data(NULL), dataSize(0) {
+    int fd = open(fileName.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) { std::cerr << "Error: could not open " << fileName << " for read" << std::endl; exit(EXIT_FAILURE); }
+    dataSize = (size_t)st.st_size;
+    if (dataSize < sizeof(CombineBinaryHeader)) { std::cerr << "Error: " << fileName << " is not a binary combine file made by " PROGRAM_BIN " Dtrios" << std::endl; exit(EXIT_FAILURE); }
+    void* mapped = mmap(NULL, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) { std::cerr << "Error: could not map " << fileName << " into memory" << std::endl; exit(EXIT_FAILURE); }
+    data = (const unsigned char*)mapped;
+    madvise(mapped, dataSize, MADV_SEQUENTIAL);
+
+    CombineBinaryHeader header; memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, "DSCB", 4) != 0 || header.version != COMBINE_BINARY_VERSION) {
+        std::cerr << "Error: " << fileName << " is not a binary combine file made by this version of " PROGRAM_BIN " Dtrios" << std::endl; exit(EXIT_FAILURE);
+    }
+    if (header.fileSize != dataSize || sizeof(header) + (uint64_t)header.speciesTableBytes > dataSize) {
+        std::cerr << "Error: the binary combine file " << fileName << " is truncated or damaged" << std::endl; exit(EXIT_FAILURE);
+    }
+    nTrios = header.nTrios; nBlocks = header.nBlocks;
+    const char* name = (const char*)data + sizeof(header); const char* namesEnd = name + header.speciesTableBytes;
+    for (uint32_t i = 0; i != header.nSpecies; i++) {
+        const char* nameEnd = (const char*)memchr(name, '\0', namesEnd - name);
+        if (nameEnd == NULL) { std::cerr << "Error: the binary combine file " << fileName << " is truncated or damaged" << std::endl; exit(EXIT_FAILURE); }
+        speciesNames.push_back(string(name, nameEnd)); name = nameEnd + 1;
+    }
+
+    // The records have different lengths, so find where each of them starts
+    recordOffsets.resize(nTrios + 1); uint64_t offset = sizeof(header) + header.speciesTableBytes;
+    for (uint64_t k = 0; k != nTrios && offset <= dataSize; k++) {
+        recordOffsets[k] = offset;
+        offset = (offset + sizeof(CombineBinaryTrio) > dataSize) ? dataSize + 1 : offset + recordSize(trio(k).nBlocks);
+    }
+    recordOffsets[nTrios] = offset;
+    if (offset != dataSize) { std::cerr << "Error: the binary combine file " << fileName << " is truncated or damaged" << std::endl; exit(EXIT_FAILURE); }
+    for (uint64_t k = 0; k != nTrios; k++) {
+        for (int j = 0; j != 3; j++) {
+            if (trio(k).species[j] >= speciesNames.size()) { std::cerr << "Error: the binary combine file " << fileName << " is damaged" << std::endl; exit(EXIT_FAILURE); }
+        }
+    }
+}
+
+CombineBinaryFile::~CombineBinaryFile() {
+    if (data != NULL) munmap((void*)data, dataSize);
+}
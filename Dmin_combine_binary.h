@@ -0,0 +1,80 @@
+//
+//  Dmin_combine_binary.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dmin_combine_binary_h
+#define Dmin_combine_binary_h
+
+#include "Dsuite_utils.h"
+#include <stdint.h>
+
+#define COMBINE_BINARY_EXT "_combine.dscb"
+
+// The binary alternative to _combine.txt + _combine_stderr.txt (Dtrios --binary-combine), for DtriosCombine and DtriosMerge
+// Layout (little-endian, as written by the machine that made it):
+//   a 48 byte header (see CombineBinaryHeader), the species names (each terminated by '\0', padded to a multiple of 8 bytes),
+//   then for each trio a CombineBinaryTrio followed by its jackknife block Ds as floats: nBlocks for each of the three
+//   arrangements in turn (as in the three columns of _combine_stderr.txt), padded to a multiple of 8 bytes
+struct CombineBinaryHeader {
+    char magic[4]; // "DSCB"
+    uint32_t version;
+    uint32_t nSpecies;
+    uint32_t speciesTableBytes; // Including the padding
+    uint64_t nTrios;
+    uint64_t nBlocks; // Summed over all the trios
+    uint64_t fileSize; // To notice truncated files
+    uint64_t reserved;
+};
+
+struct CombineBinaryTrio {
+    uint16_t species[3]; // Indices into the species names
+    uint16_t reserved;
+    uint32_t nBlocks;
+    uint32_t reserved2;
+    double BBAA; double BABA; double ABBA; // The totals, in the order of the columns of _combine.txt
+};
+
+// Writes a binary combine file one trio at a time; the header is filled in by close()
+class CombineBinaryWriter {
+public:
+    CombineBinaryWriter(const string& fileName, const std::vector<string>& speciesNames); // Exits with an error message if the file can't be opened
+    ~CombineBinaryWriter();
+
+    void addTrio(int s1, int s2, int s3, double BBAA, double BABA, double ABBA, const std::vector<double> blockDs[3]);
+    void addRecords(const unsigned char* records, size_t nBytes, uint64_t nTrios, uint64_t nBlocks); // As they are in another file
+    void close(); // Exits with an error message if the file could not be written
+
+private:
+    string fileName;
+    FILE* file;
+    CombineBinaryHeader header;
+    std::vector<float> floats; // Reused for every trio
+};
+
+// Read-only access to a binary combine file through mmap
+class CombineBinaryFile {
+public:
+    CombineBinaryFile(const string& fileName); // Exits with an error message if the file can't be used
+    ~CombineBinaryFile();
+
+    std::vector<string> speciesNames;
+    uint64_t nTrios;
+    uint64_t nBlocks;
+
+    const CombineBinaryTrio& trio(uint64_t k) const { return *(const CombineBinaryTrio*)(data + recordOffsets[k]); }
+    // The block Ds of trio k for one arrangement (0-2)
+    const float* blockDs(uint64_t k, int arrangement) const { return (const float*)(data + recordOffsets[k] + sizeof(CombineBinaryTrio)) + (size_t)arrangement * trio(k).nBlocks; }
+    // All the records, for copying them into another file
+    const unsigned char* records() const { return data + recordOffsets[0]; }
+    size_t recordBytes() const { return recordOffsets.back() - recordOffsets[0]; }
+
+private:
+    const unsigned char* data;
+    size_t dataSize;
+    std::vector<uint64_t> recordOffsets; // nTrios + 1, with the end of the last record at the back
+};
+
+#endif /* Dmin_combine_binary_h */
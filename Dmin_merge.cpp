@@ -0,0 +1,162 @@
+//
+//  Dmin_merge.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#include "Dmin_merge.h"
+#include "Dmin_combine_binary.h"
+
+#define SUBPROGRAM "DtriosMerge"
+
+static const char *DMINMERGE_USAGE_MESSAGE =
+"Usage: " PROGRAM_BIN " " SUBPROGRAM " [OPTIONS] DminFile1 DminFile2 DminFile3 ....\n"
+"Put back together the outputs of Dtrios runs that each calculated a part of the trios (Dtrios --trio-range)\n"
+"The DminFiles are the Dtrios output file names without the _BBAA.txt, _Dmin.txt, ... suffixes, e.g. sets_run_trios_1_1001\n"
+"When all the names end with _trios_start_end (as Dtrios names them), they are joined in the order of the trios; otherwise in the order given\n"
+"\n"
+"       -h, --help                              display this help and exit\n"
+"       -n, --run-name                          (default=merged) the output files are run-name_BBAA.txt, run-name_Dmin.txt, run-name_tree.txt,\n"
+"                                               and run-name_combine.txt and run-name_combine_stderr.txt for " PROGRAM_BIN " DtriosCombine\n"
+"                                               (or run-name" COMBINE_BINARY_EXT " if the runs were with --binary-combine)\n"
+"\n"
+"\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
+
+static const char* shortopts = "hn:";
+
+static const struct option longopts[] = {
+    { "run-name",   required_argument, NULL, 'n' },
+    { "help",   no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+namespace opt
+{
+    static std::vector<string> dminFiles;
+    static string runName = "merged";
+}
+
+// The output files of one Dtrios run, and whether they start with a header line
+static const int N_DMIN_OUTPUTS = 5;
+static const char* DMIN_OUTPUT_SUFFIXES[N_DMIN_OUTPUTS] = { "_BBAA.txt", "_Dmin.txt", "_tree.txt", "_combine.txt", "_combine_stderr.txt" };
+static const bool DMIN_OUTPUT_HEADERS[N_DMIN_OUTPUTS] = { true, true, true, false, false };
+
+// A shard name ending with _trios_start_end; false if it doesn't
+static bool parseTrioRange(const string& name, int64_t& start, int64_t& end) {
+    size_t p = name.rfind("_trios_");
+    if (p == string::npos) return false;
+    std::vector<string> range = split(name.substr(p + 7), '_');
+    if (range.size() != 2 || range[0].empty() || range[1].empty()) return false;
+    if (range[0].find_first_not_of("0123456789") != string::npos || range[1].find_first_not_of("0123456789") != string::npos) return false;
+    start = atoll(range[0].c_str()); end = atoll(range[1].c_str());
+    return true;
+}
+
+int DminMergeMain(int argc, char** argv) {
+    parseDminMergeOptions(argc, argv);
+    string line; // for reading the input files
+    
+    // Put the shards in the order of their trio ranges, if the names say what they are
+    std::vector<std::pair<int64_t, int64_t> > ranges(opt::dminFiles.size()); bool haveRanges = true;
+    for (int i = 0; i < opt::dminFiles.size(); i++) {
+        if (!parseTrioRange(opt::dminFiles[i], ranges[i].first, ranges[i].second)) haveRanges = false;
+    }
+    std::vector<int> order(opt::dminFiles.size());
+    for (int i = 0; i < order.size(); i++) order[i] = i;
+    if (haveRanges) {
+        std::stable_sort(order.begin(), order.end(), [&ranges](int a, int b) { return ranges[a].first < ranges[b].first; });
+        for (int j = 1; j < order.size(); j++) {
+            if (ranges[order[j-1]].second != ranges[order[j]].first)
+                std::cerr << "Warning: the trios of " << opt::dminFiles[order[j-1]] << " and " << opt::dminFiles[order[j]] << " do not follow on from each other" << std::endl;
+        }
+    } else {
+        std::cerr << "Joining the files in the order given" << std::endl;
+    }
+    
+    int nBinary = 0;
+    for (int j = 0; j < order.size(); j++) if (file_exists(opt::dminFiles[order[j]] + COMBINE_BINARY_EXT)) nBinary++;
+    if (nBinary != 0 && nBinary != order.size()) {
+        std::cerr << "Error: only some of the runs have a " << COMBINE_BINARY_EXT << " file; please run them all either with or without --binary-combine" << std::endl; exit(EXIT_FAILURE);
+    }
+    
+    for (int f = 0; f < N_DMIN_OUTPUTS; f++) {
+        std::vector<string> inFileNames;
+        for (int j = 0; j < order.size(); j++) {
+            string name = opt::dminFiles[order[j]] + DMIN_OUTPUT_SUFFIXES[f];
+            if (file_exists(name)) inFileNames.push_back(name);
+            else if (file_exists(name + GZIP_EXT)) inFileNames.push_back(name + GZIP_EXT);
+        }
+        if (inFileNames.empty() && string(DMIN_OUTPUT_SUFFIXES[f]) == "_tree.txt") continue; // The runs were without a tree
+        if (inFileNames.empty() && nBinary != 0 && !DMIN_OUTPUT_HEADERS[f]) continue; // The combine files are binary
+        if (inFileNames.size() != order.size()) {
+            std::cerr << "Error: not all of the runs have a " << DMIN_OUTPUT_SUFFIXES[f] << " file" << std::endl; exit(EXIT_FAILURE);
+        }
+        
+        string outFileName = opt::runName + DMIN_OUTPUT_SUFFIXES[f];
+        std::ofstream* outFile = new std::ofstream(outFileName.c_str());
+        if (!outFile->good()) { std::cerr << "Error: could not open " << outFileName << " for write" << std::endl; exit(EXIT_FAILURE); }
+        for (int j = 0; j < inFileNames.size(); j++) {
+            std::istream* inFile = createReader(inFileNames[j].c_str());
+            if (DMIN_OUTPUT_HEADERS[f] && j > 0) getline(*inFile, line); // Only the first header
+            while (getline(*inFile, line)) *outFile << line << '\n';
+            delete inFile;
+        }
+        outFile->close();
+        if (outFile->fail()) { std::cerr << "Error: could not write " << outFileName << std::endl; exit(EXIT_FAILURE); }
+        delete outFile;
+        std::cerr << "Merged " << inFileNames.size() << " files into " << outFileName << std::endl;
+    }
+    
+    if (nBinary != 0) {
+        string outFileName = opt::runName + COMBINE_BINARY_EXT;
+        CombineBinaryWriter* outFile = NULL; std::vector<string> speciesNames;
+        for (int j = 0; j < order.size(); j++) {
+            CombineBinaryFile* inFile = new CombineBinaryFile(opt::dminFiles[order[j]] + COMBINE_BINARY_EXT);
+            if (outFile == NULL) {
+                speciesNames = inFile->speciesNames;
+                outFile = new CombineBinaryWriter(outFileName, speciesNames);
+            } else if (inFile->speciesNames != speciesNames) {
+                std::cerr << "Error: the species in " << opt::dminFiles[order[j]] << COMBINE_BINARY_EXT << " are not the same as in the other runs" << std::endl; exit(EXIT_FAILURE);
+            }
+            if (inFile->nTrios != 0) outFile->addRecords(inFile->records(), inFile->recordBytes(), inFile->nTrios, inFile->nBlocks);
+            delete inFile;
+        }
+        outFile->close();
+        delete outFile;
+        std::cerr << "Merged " << order.size() << " files into " << outFileName << std::endl;
+    }
+    return 0;
+}
+
+void parseDminMergeOptions(int argc, char** argv) {
+    bool die = false;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;)
+    {
+        std::istringstream arg(optarg != NULL ? optarg : "");
+        switch (c)
+        {
+            case '?': die = true; break;
+            case 'n': arg >> opt::runName; break;
+            case 'h':
+                std::cout << DMINMERGE_USAGE_MESSAGE;
+                exit(EXIT_SUCCESS);
+        }
+    }
+    
+    int nFilenames = argc - optind;
+    if (nFilenames < 1) {
+        std::cerr << "missing arguments\n";
+        die = true;
+    }
+    
+    if (die) {
+        std::cout << "\n" << DMINMERGE_USAGE_MESSAGE;
+        exit(EXIT_FAILURE);
+    }
+    
+    // Parse the input filenames
+    while (optind < argc) {
+        opt::dminFiles.push_back(argv[optind++]);
+    }
+}
@@ -0,0 +1,16 @@
+//
+//  Dmin_merge.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dmin_merge_h
+#define Dmin_merge_h
+
+#include "Dsuite_utils.h"
+
+void parseDminMergeOptions(int argc, char** argv);
+int DminMergeMain(int argc, char** argv);
+
+#endif /* Dmin_merge_h */
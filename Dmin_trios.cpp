@@ -0,0 +1,402 @@
+//
+//  Dmin_trios.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#include "Dmin_trios.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(DSUITE_NO_SIMD)
+#define DSUITE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+uint64_t nChoosek(uint64_t n, uint64_t k) {
+    if (k > n) return 0;
+    if (k * 2 > n) k = n - k;
+    uint64_t result = 1;
+    for (uint64_t i = 1; i <= k; i++) result = result * (n - k + i) / i; // Exact at every step
+    return result;
+}
+
+// The largest x <= n with C(x,k) <= r
+static int largestWithChooseAtMost(uint64_t r, int n, int k) {
+    int lo = k - 1, hi = n; // C(k-1,k) = 0 <= r
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (nChoosek(mid, k) <= r) lo = mid; else hi = mid - 1;
+    }
+    return lo;
+}
+
+// The lexicographic number of (a,b,c) counts down from the end as the colexicographic number of (n-1-c, n-1-b, n-1-a),
+// which is C(n-1-a,3) + C(n-1-b,2) + C(n-1-c,1)
+void unrankTrio(int64_t rank, int n, int& a, int& b, int& c) {
+    uint64_t r = nChoosek(n, 3) - 1 - (uint64_t)rank;
+    int x = largestWithChooseAtMost(r, n, 3); r -= nChoosek(x, 3);
+    int y = largestWithChooseAtMost(r, x, 2); r -= nChoosek(y, 2);
+    a = n - 1 - x; b = n - 1 - y; c = n - 1 - (int)r;
+}
+
+TrioTable::TrioTable(int nSpecies, int64_t firstTrio, int nTrios, int jkWindowSize) : firstTrio(firstTrio), nTrios(nTrios), jkWindowSize(jkWindowSize), regionDs(nTrios) {
+    species1.assign(nTrios, 0); species2.assign(nTrios, 0); species3.assign(nTrios, 0);
+    if (nTrios > 0) {
+        int a, b, c; unrankTrio(firstTrio, nSpecies, a, b, c);
+        for (int i = 0; i != nTrios; i++) {
+            species1[i] = (SpeciesIndex)a; species2[i] = (SpeciesIndex)b; species3[i] = (SpeciesIndex)c;
+            nextTrio(nSpecies, a, b, c);
+        }
+    }
+    ABBAtotals.assign(nTrios, 0); BABAtotals.assign(nTrios, 0); BBAAtotals.assign(nTrios, 0);
+    localABBAtotals.assign(nTrios, 0); localBABAtotals.assign(nTrios, 0); localBBAAtotals.assign(nTrios, 0);
+    usedVars.assign(nTrios, 0); localUsedVars.assign(nTrios, 0);
+}
+
+JackknifeBlockStore::~JackknifeBlockStore() {
+    for (std::vector<Chunk*>::size_type i = 0; i != slabs.size(); i++) delete [] slabs[i];
+}
+
+JackknifeBlockStore::Chunk* JackknifeBlockStore::newChunk() {
+    std::lock_guard<std::mutex> lock(slabMutex);
+    if (chunksLeftInSlab == 0) {
+        slabs.push_back(new Chunk[CHUNKS_PER_SLAB]); nextChunk = slabs.back(); chunksLeftInSlab = CHUNKS_PER_SLAB;
+    }
+    Chunk* chunk = nextChunk++; chunksLeftInSlab--;
+    chunk->next = NULL; chunk->nBlocks = 0;
+    return chunk;
+}
+
+void JackknifeBlockStore::add(int i, double D0, double D1, double D2) {
+    Chunk* chunk = lastChunks[i];
+    if (chunk == NULL || chunk->nBlocks == BLOCKS_PER_CHUNK) {
+        Chunk* added = newChunk();
+        if (chunk == NULL) firstChunks[i] = added; else chunk->next = added;
+        lastChunks[i] = chunk = added;
+    }
+    BlockRecord& block = chunk->blocks[chunk->nBlocks++];
+    block.D[0] = (JackknifeBlockValue)D0; block.D[1] = (JackknifeBlockValue)D1; block.D[2] = (JackknifeBlockValue)D2;
+}
+
+void JackknifeBlockStore::get(int i, int arrangement, std::vector<double>& values) const {
+    values.clear();
+    for (const Chunk* chunk = firstChunks[i]; chunk != NULL; chunk = chunk->next) {
+        for (int b = 0; b != chunk->nBlocks; b++) values.push_back(chunk->blocks[b].D[arrangement]);
+    }
+}
+
+bool JackknifeBlockStore::save(FILE* file) const {
+    std::vector<BlockRecord> blocks;
+    for (std::vector<Chunk*>::size_type i = 0; i != firstChunks.size(); i++) {
+        blocks.clear();
+        for (const Chunk* chunk = firstChunks[i]; chunk != NULL; chunk = chunk->next) blocks.insert(blocks.end(), chunk->blocks, chunk->blocks + chunk->nBlocks);
+        uint32_t nBlocks = (uint32_t)blocks.size();
+        if (fwrite(&nBlocks, sizeof(nBlocks), 1, file) != 1) return false;
+        if (nBlocks > 0 && fwrite(blocks.data(), sizeof(BlockRecord), nBlocks, file) != nBlocks) return false;
+    }
+    return true;
+}
+
+bool JackknifeBlockStore::load(FILE* file) {
+    std::vector<BlockRecord> blocks;
+    for (std::vector<Chunk*>::size_type i = 0; i != firstChunks.size(); i++) {
+        uint32_t nBlocks;
+        if (fread(&nBlocks, sizeof(nBlocks), 1, file) != 1) return false;
+        blocks.resize(nBlocks);
+        if (nBlocks > 0 && fread(blocks.data(), sizeof(BlockRecord), nBlocks, file) != nBlocks) return false;
+        for (uint32_t b = 0; b != nBlocks; b++) add((int)i, blocks[b].D[0], blocks[b].D[1], blocks[b].D[2]);
+    }
+    return true;
+}
+
+template <class Vector> static bool writeArray(FILE* file, const Vector& v) {
+    return v.empty() || fwrite(v.data(), sizeof(v[0]), v.size(), file) == v.size();
+}
+template <class Vector> static bool readArray(FILE* file, Vector& v) {
+    return v.empty() || fread(&v[0], sizeof(v[0]), v.size(), file) == v.size();
+}
+
+bool TrioTable::save(FILE* file) const {
+    return writeArray(file, ABBAtotals) && writeArray(file, BABAtotals) && writeArray(file, BBAAtotals)
+        && writeArray(file, localABBAtotals) && writeArray(file, localBABAtotals) && writeArray(file, localBBAAtotals)
+        && writeArray(file, usedVars) && writeArray(file, localUsedVars) && regionDs.save(file);
+}
+
+bool TrioTable::load(FILE* file) {
+    return readArray(file, ABBAtotals) && readArray(file, BABAtotals) && readArray(file, BBAAtotals)
+        && readArray(file, localABBAtotals) && readArray(file, localBABAtotals) && readArray(file, localBBAAtotals)
+        && readArray(file, usedVars) && readArray(file, localUsedVars) && regionDs.load(file);
+}
+
+// The jackknife block for trio i is full: store its D values and start a new block
+void TrioTable::finishBlock(int i) {
+    double localDnums1 = localABBAtotals[i] - localBABAtotals[i]; double localDnums2 = localABBAtotals[i] - localBBAAtotals[i]; double localDnums3 = localBBAAtotals[i] - localBABAtotals[i];
+    double localDdenoms1 = localABBAtotals[i] + localBABAtotals[i]; double localDdenoms2 = localABBAtotals[i] + localBBAAtotals[i]; double localDdenoms3 = localBBAAtotals[i] + localBABAtotals[i];
+    double regionD0 = localDnums1/localDdenoms1; double regionD1 = localDnums2/localDdenoms2;
+    double regionD2 = localDnums3/localDdenoms3;
+    regionDs.add(i, regionD0, regionD1, regionD2);
+    localABBAtotals[i] = 0; localBABAtotals[i] = 0; localBBAAtotals[i] = 0; localUsedVars[i] = 0;
+}
+
+void TrioTable::accumulateScalar(int trioFrom, int trioTo, const double* allPs, double p_O) {
+    double p_S1; double p_S2; double p_S3; double ABBA; double BABA; double BBAA;
+    for (int i = trioFrom; i < trioTo; i++) {
+        p_S1 = allPs[species1[i]];
+        if (p_S1 == -1) continue;  // If any member of the trio has entirely missing data, just move on to the next trio
+        p_S2 = allPs[species2[i]];
+        if (p_S2 == -1) continue;
+        p_S3 = allPs[species3[i]];
+        if (p_S3 == -1) continue;
+        usedVars[i]++; localUsedVars[i]++;
+
+        ABBA = ((1-p_S1)*p_S2*p_S3*(1-p_O)); ABBAtotals[i] += ABBA; localABBAtotals[i] += (LocalCount)ABBA;
+        BABA = (p_S1*(1-p_S2)*p_S3*(1-p_O)); BABAtotals[i] += BABA; localBABAtotals[i] += (LocalCount)BABA;
+        BBAA = ((1-p_S3)*p_S2*p_S1*(1-p_O)); BBAAtotals[i] += BBAA; localBBAAtotals[i] += (LocalCount)BBAA;
+
+        if (localUsedVars[i] == jkWindowSize) finishBlock(i);
+    }
+}
+
+#ifdef DSUITE_X86_SIMD
+
+// Adding four sites to the block-local sums of four trios, only where used (used and usedInts are the 64 and 32 bit lane masks)
+__attribute__((target("avx2")))
+static inline void addLocalAVX2(double* local, __m256d values, __m256d used, __m128i) {
+    __m256d t = _mm256_loadu_pd(local); _mm256_storeu_pd(local, _mm256_blendv_pd(t, _mm256_add_pd(t, values), used));
+}
+__attribute__((target("avx2")))
+static inline void addLocalAVX2(float* local, __m256d values, __m256d, __m128i usedInts) {
+    __m128 t = _mm_loadu_ps(local); _mm_storeu_ps(local, _mm_blendv_ps(t, _mm_add_ps(t, _mm256_cvtpd_ps(values)), _mm_castsi128_ps(usedInts)));
+}
+
+// Four trios at a time; trios with a missing species are masked out rather than branched around
+// The products are evaluated in the same order as in the scalar loop, so the totals are bit-identical
+__attribute__((target("avx2")))
+void TrioTable::accumulateAVX2(int trioFrom, int trioTo, const double* allPs, double p_O) {
+    const __m256d one = _mm256_set1_pd(1.0); const __m256d minusOne = _mm256_set1_pd(-1.0);
+    const __m256d notPO = _mm256_set1_pd(1-p_O);
+    const __m256i jk = _mm256_set1_epi32(jkWindowSize);
+    const __m256i lowHalves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    int i = trioFrom;
+    for (; i + 4 <= trioTo; i += 4) {
+        __m256d p_S1 = _mm256_i32gather_pd(allPs, _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)&species1[i])), 8);
+        __m256d p_S2 = _mm256_i32gather_pd(allPs, _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)&species2[i])), 8);
+        __m256d p_S3 = _mm256_i32gather_pd(allPs, _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)&species3[i])), 8);
+        __m256d used = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(p_S1, minusOne, _CMP_NEQ_OQ), _mm256_cmp_pd(p_S2, minusOne, _CMP_NEQ_OQ)), _mm256_cmp_pd(p_S3, minusOne, _CMP_NEQ_OQ));
+        if (_mm256_movemask_pd(used) == 0) continue;
+
+        __m256d ABBA = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_sub_pd(one, p_S1), p_S2), p_S3), notPO);
+        __m256d BABA = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(p_S1, _mm256_sub_pd(one, p_S2)), p_S3), notPO);
+        __m256d BBAA = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_sub_pd(one, p_S3), p_S2), p_S1), notPO);
+
+        __m256d t;
+        t = _mm256_loadu_pd(&ABBAtotals[i]); _mm256_storeu_pd(&ABBAtotals[i], _mm256_blendv_pd(t, _mm256_add_pd(t, ABBA), used));
+        t = _mm256_loadu_pd(&BABAtotals[i]); _mm256_storeu_pd(&BABAtotals[i], _mm256_blendv_pd(t, _mm256_add_pd(t, BABA), used));
+        t = _mm256_loadu_pd(&BBAAtotals[i]); _mm256_storeu_pd(&BBAAtotals[i], _mm256_blendv_pd(t, _mm256_add_pd(t, BBAA), used));
+
+        // The 64 bit lane mask -> 32 bit lanes (-1 for used trios), then subtracting it adds one to the counters
+        __m128i usedInts = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(used), lowHalves));
+        addLocalAVX2(&localABBAtotals[i], ABBA, used, usedInts);
+        addLocalAVX2(&localBABAtotals[i], BABA, used, usedInts);
+        addLocalAVX2(&localBBAAtotals[i], BBAA, used, usedInts);
+        __m128i u = _mm_loadu_si128((const __m128i*)&usedVars[i]); _mm_storeu_si128((__m128i*)&usedVars[i], _mm_sub_epi32(u, usedInts));
+        __m128i lu = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)&localUsedVars[i]), usedInts);
+        _mm_storeu_si128((__m128i*)&localUsedVars[i], lu);
+
+        int blockEnds = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lu, _mm256_castsi256_si128(jk))));
+        for (int j = 0; blockEnds != 0; j++, blockEnds >>= 1) {
+            if (blockEnds & 1) finishBlock(i + j);
+        }
+    }
+    accumulateScalar(i, trioTo, allPs, p_O);
+}
+
+__attribute__((target("avx512f")))
+static inline void addLocalAVX512(double* local, __m512d values, __mmask8 used) {
+    __m512d t = _mm512_loadu_pd(local); _mm512_mask_storeu_pd(local, used, _mm512_add_pd(t, values));
+}
+__attribute__((target("avx512f")))
+static inline void addLocalAVX512(float* local, __m512d values, __mmask8 used) { // Only the low eight lanes are loaded and stored
+    __m512 t = _mm512_maskz_loadu_ps(0xFF, local);
+    _mm512_mask_storeu_ps(local, used, _mm512_add_ps(t, _mm512_castps256_ps512(_mm512_cvtpd_ps(values))));
+}
+
+// Eight trios at a time, with mask registers for the missing species
+__attribute__((target("avx512f")))
+void TrioTable::accumulateAVX512(int trioFrom, int trioTo, const double* allPs, double p_O) {
+    const __m512d one = _mm512_set1_pd(1.0); const __m512d minusOne = _mm512_set1_pd(-1.0);
+    const __m512d notPO = _mm512_set1_pd(1-p_O);
+    const __m512i jk = _mm512_set1_epi32(jkWindowSize); const __m512i ones = _mm512_set1_epi32(1);
+    int i = trioFrom;
+    for (; i + 8 <= trioTo; i += 8) {
+        __m512d p_S1 = _mm512_i32gather_pd(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&species1[i])), allPs, 8);
+        __m512d p_S2 = _mm512_i32gather_pd(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&species2[i])), allPs, 8);
+        __m512d p_S3 = _mm512_i32gather_pd(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&species3[i])), allPs, 8);
+        __mmask8 used = _mm512_cmp_pd_mask(p_S1, minusOne, _CMP_NEQ_OQ) & _mm512_cmp_pd_mask(p_S2, minusOne, _CMP_NEQ_OQ) & _mm512_cmp_pd_mask(p_S3, minusOne, _CMP_NEQ_OQ);
+        if (used == 0) continue;
+
+        __m512d ABBA = _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(_mm512_sub_pd(one, p_S1), p_S2), p_S3), notPO);
+        __m512d BABA = _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(p_S1, _mm512_sub_pd(one, p_S2)), p_S3), notPO);
+        __m512d BBAA = _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(_mm512_sub_pd(one, p_S3), p_S2), p_S1), notPO);
+
+        __m512d t;
+        t = _mm512_loadu_pd(&ABBAtotals[i]); _mm512_mask_storeu_pd(&ABBAtotals[i], used, _mm512_add_pd(t, ABBA));
+        t = _mm512_loadu_pd(&BABAtotals[i]); _mm512_mask_storeu_pd(&BABAtotals[i], used, _mm512_add_pd(t, BABA));
+        t = _mm512_loadu_pd(&BBAAtotals[i]); _mm512_mask_storeu_pd(&BBAAtotals[i], used, _mm512_add_pd(t, BBAA));
+        addLocalAVX512(&localABBAtotals[i], ABBA, used);
+        addLocalAVX512(&localBABAtotals[i], BABA, used);
+        addLocalAVX512(&localBBAAtotals[i], BBAA, used);
+
+        // Only the low eight 32 bit lanes are loaded and stored
+        __m512i u = _mm512_maskz_loadu_epi32(0xFF, &usedVars[i]);
+        _mm512_mask_storeu_epi32(&usedVars[i], used, _mm512_add_epi32(u, ones));
+        __m512i lu = _mm512_add_epi32(_mm512_maskz_loadu_epi32(0xFF, &localUsedVars[i]), ones);
+        _mm512_mask_storeu_epi32(&localUsedVars[i], used, lu);
+
+        int blockEnds = _mm512_mask_cmpeq_epi32_mask(used, lu, jk);
+        for (int j = 0; blockEnds != 0; j++, blockEnds >>= 1) {
+            if (blockEnds & 1) finishBlock(i + j);
+        }
+    }
+    accumulateScalar(i, trioTo, allPs, p_O);
+}
+
+enum SimdLevel { SIMD_NONE, SIMD_AVX2, SIMD_AVX512 };
+
+static SimdLevel detectSimdLevel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    return SIMD_NONE;
+}
+
+void TrioTable::accumulate(int trioFrom, int trioTo, const double* allPs, double p_O) {
+    static const SimdLevel simdLevel = detectSimdLevel();
+    switch (simdLevel) {
+        case SIMD_AVX512: accumulateAVX512(trioFrom, trioTo, allPs, p_O); break;
+        case SIMD_AVX2: accumulateAVX2(trioFrom, trioTo, allPs, p_O); break;
+        default: accumulateScalar(trioFrom, trioTo, allPs, p_O); break;
+    }
+}
+
+#else
+
+void TrioTable::accumulateAVX2(int trioFrom, int trioTo, const double* allPs, double p_O) { accumulateScalar(trioFrom, trioTo, allPs, p_O); }
+void TrioTable::accumulateAVX512(int trioFrom, int trioTo, const double* allPs, double p_O) { accumulateScalar(trioFrom, trioTo, allPs, p_O); }
+
+void TrioTable::accumulate(int trioFrom, int trioTo, const double* allPs, double p_O) {
+    accumulateScalar(trioFrom, trioTo, allPs, p_O);
+}
+
+#endif
+
+SparseTrioAccumulator::SparseTrioAccumulator(TrioTable* table, int nSpecies, int part, int nParts) : table(table), nSpecies(nSpecies), nSites(0) {
+    // The trios are in lexicographic order: those before (x,x+1,x+2) are the ones of the species before x, i.e. C(n,3) - C(n-x,3)
+    firstRanks.assign(nSpecies + 1, 0);
+    for (int x = 0; x <= nSpecies; x++) firstRanks[x] = (int64_t)(nChoosek(nSpecies, 3) - nChoosek(nSpecies - x, 3));
+    
+    splitSpecies(nSpecies, table->firstTrio, table->nTrios, part, nParts, firstFrom, firstTo);
+    int64_t tableFrom = table->firstTrio; int64_t tableTo = table->firstTrio + table->nTrios;
+    trioFrom = std::min(std::max(firstRanks[firstFrom], tableFrom), tableTo); trioTo = std::min(std::max(firstRanks[firstTo], tableFrom), tableTo);
+    
+    positiveBefore.assign(nSpecies + 1, 0); presentBefore.assign(nSpecies + 1, 0);
+    missing.assign(nSpecies, 0); lastMissing.assign(nSpecies, -1);
+    size_t nPairSpecies = (firstTo > firstFrom) ? nSpecies - firstFrom : 0; pairMissing.assign(nPairSpecies * (nPairSpecies - 1) / 2, 0);
+    TrioState empty = { 0, 0, 0 }; trioStates.assign(trioTo - trioFrom, empty);
+}
+
+// Split the trios of the table between the parts by their first member, as evenly as that allows
+// (the table may only hold a range of the trios, which can start and end part way through the trios of a first member)
+void SparseTrioAccumulator::splitSpecies(int nSpecies, int64_t firstTrio, int nTrios, int part, int nParts, int& firstFrom, int& firstTo) {
+    int64_t tableFrom = firstTrio; int64_t tableTo = firstTrio + nTrios;
+    auto clip = [&](int x) { return std::min(std::max((int64_t)(nChoosek(nSpecies, 3) - nChoosek(nSpecies - x, 3)), tableFrom), tableTo) - tableFrom; };
+    int firstLo = 0;
+    if (nTrios > 0) { int b, c; unrankTrio(tableFrom, nSpecies, firstLo, b, c); }
+    firstFrom = firstLo; while (firstFrom < nSpecies && clip(firstFrom) * nParts < (tableTo - tableFrom) * part) firstFrom++;
+    firstTo = firstFrom; while (firstTo < nSpecies && clip(firstTo) * nParts < (tableTo - tableFrom) * (part + 1)) firstTo++;
+}
+
+double SparseTrioAccumulator::bytesForPart(int nSpecies, int64_t firstTrio, int nTrios, int part, int nParts) {
+    int firstFrom, firstTo; splitSpecies(nSpecies, firstTrio, nTrios, part, nParts, firstFrom, firstTo);
+    double nPairSpecies = (firstTo > firstFrom) ? nSpecies - firstFrom : 0;
+    return nPairSpecies * (nPairSpecies - 1) / 2 * sizeof(int) + (double)(nSpecies + 1) * (sizeof(int64_t) + 7 * sizeof(int));
+}
+
+int SparseTrioAccumulator::missingAny(int64_t i, int x, int y, int z) const {
+    return missing[x] + missing[y] + missing[z] - pairMissing[pairIndex(x, y)] - pairMissing[pairIndex(x, z)] - pairMissing[pairIndex(y, z)] + trioStates[i - trioFrom].trioMissing;
+}
+
+void SparseTrioAccumulator::catchUp(int64_t trio, int x, int y, int z) {
+    TrioState& state = trioStates[trio - trioFrom];
+    int unchangedSites = nSites - state.syncedSites;
+    if (lastMissing[x] >= state.syncedSites || lastMissing[y] >= state.syncedSites || lastMissing[z] >= state.syncedSites) {
+        int missingNow = missingAny(trio, x, y, z); // Otherwise it is the same as at the last update
+        unchangedSites -= missingNow - state.syncedMissing; state.syncedMissing = missingNow;
+    }
+    table->addUnchangedSites((int)(trio - table->firstTrio), unchangedSites);
+    state.syncedSites = nSites;
+}
+
+// Trio (x,y,z) is usable at the current site; first account for the sites since it was last visited, then add this one
+void SparseTrioAccumulator::addTrio(int x, int y, int z, const double* allPs, double p_O) {
+    int64_t trio = trioIndex(x, y, z);
+    if (trio < trioFrom || trio >= trioTo) return; // Outside the range of the table
+    catchUp(trio, x, y, z); trioStates[trio - trioFrom].syncedSites = nSites + 1;
+    int i = (int)(trio - table->firstTrio);
+    
+    double p_S1 = allPs[x]; double p_S2 = allPs[y]; double p_S3 = allPs[z];
+    table->usedVars[i]++; table->localUsedVars[i]++;
+    double ABBA = ((1-p_S1)*p_S2*p_S3*(1-p_O)); table->ABBAtotals[i] += ABBA; table->localABBAtotals[i] += (LocalCount)ABBA;
+    double BABA = (p_S1*(1-p_S2)*p_S3*(1-p_O)); table->BABAtotals[i] += BABA; table->localBABAtotals[i] += (LocalCount)BABA;
+    double BBAA = ((1-p_S3)*p_S2*p_S1*(1-p_O)); table->BBAAtotals[i] += BBAA; table->localBBAAtotals[i] += (LocalCount)BBAA;
+    if (table->localUsedVars[i] == table->jkWindowSize) table->finishBlock(i);
+}
+
+void SparseTrioAccumulator::addSite(const double* allPs, double p_O) {
+    positiveSpecies.clear(); presentSpecies.clear(); missingSpecies.clear();
+    for (int s = 0; s < nSpecies; s++) {
+        positiveBefore[s] = (int)positiveSpecies.size(); presentBefore[s] = (int)presentSpecies.size();
+        if (allPs[s] == -1) { missingSpecies.push_back(s); continue; }
+        presentSpecies.push_back(s);
+        if (allPs[s] > 0) positiveSpecies.push_back(s);
+    }
+    positiveBefore[nSpecies] = (int)positiveSpecies.size(); presentBefore[nSpecies] = (int)presentSpecies.size();
+    
+    // Every trio with at least two positive members, in the order of the trios, so that the memory is gone through forwards
+    for (int x = firstFrom; x < firstTo; x++) {
+        if (allPs[x] == -1) continue;
+        if (allPs[x] > 0) { // Then any y, and any z if y is positive too
+            for (int j = presentBefore[x + 1]; j < presentSpecies.size(); j++) {
+                int y = presentSpecies[j];
+                const std::vector<int>& zs = (allPs[y] > 0) ? presentSpecies : positiveSpecies;
+                for (int k = (allPs[y] > 0) ? j + 1 : positiveBefore[y + 1]; k < zs.size(); k++) addTrio(x, y, zs[k], allPs, p_O);
+            }
+        } else { // Then both y and z are positive
+            for (int j = positiveBefore[x + 1]; j < positiveSpecies.size(); j++) {
+                for (int k = j + 1; k < positiveSpecies.size(); k++) addTrio(x, positiveSpecies[j], positiveSpecies[k], allPs, p_O);
+            }
+        }
+    }
+    
+    // Then record which species were missing at this site
+    for (int a = 0; a < missingSpecies.size(); a++) {
+        int ma = missingSpecies[a]; missing[ma]++; lastMissing[ma] = nSites;
+        for (int b = a + 1; b < missingSpecies.size(); b++) {
+            if (ma < firstFrom || firstTo == firstFrom) break; // None of the trios here have this pair
+            int mb = missingSpecies[b]; pairMissing[pairIndex(ma, mb)]++;
+            if (ma >= firstTo) continue;
+            for (int c = b + 1; c < missingSpecies.size(); c++) {
+                int64_t trio = trioIndex(ma, mb, missingSpecies[c]);
+                if (trio >= trioFrom && trio < trioTo) trioStates[trio - trioFrom].trioMissing++;
+            }
+        }
+    }
+    nSites++;
+}
+
+void SparseTrioAccumulator::finish() {
+    for (int64_t trio = trioFrom; trio < trioTo; trio++) {
+        int i = (int)(trio - table->firstTrio);
+        catchUp(trio, table->species1[i], table->species2[i], table->species3[i]);
+    }
+}
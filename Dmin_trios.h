@@ -0,0 +1,202 @@
+//
+//  Dmin_trios.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dmin_trios_h
+#define Dmin_trios_h
+
+#include "Dsuite_utils.h"
+#include <stdlib.h>
+#include <mutex>
+
+// The number of ways to choose k of n, in 64 bits (the number of trios overflows 32 bits at about 2,300 species)
+uint64_t nChoosek(uint64_t n, uint64_t k);
+
+// The trios a < b < c of n species are numbered from 0 in lexicographic order: (0,1,2), (0,1,3), ..., (n-3,n-2,n-1)
+// unrankTrio gives the trio with a given number without going through the ones before it (combinatorial number system)
+void unrankTrio(int64_t rank, int n, int& a, int& b, int& c);
+// and nextTrio steps to the following one
+inline void nextTrio(int n, int& a, int& b, int& c) {
+    if (++c < n) return;
+    if (++b < n - 1) { c = b + 1; return; }
+    a++; b = a + 1; c = b + 1;
+}
+
+// Allocator giving memory aligned for the widest vector loads (64 bytes, AVX-512)
+template <class T> class AlignedAllocator {
+public:
+    typedef T value_type;
+    static const size_t ALIGNMENT = 64;
+    AlignedAllocator() {};
+    template <class U> AlignedAllocator(const AlignedAllocator<U>&) {};
+    template <class U> struct rebind { typedef AlignedAllocator<U> other; };
+
+    T* allocate(size_t n) {
+        void* p = NULL;
+        if (posix_memalign(&p, ALIGNMENT, n * sizeof(T) + ALIGNMENT) != 0) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { free(p); }
+};
+template <class T, class U> bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return true; }
+template <class T, class U> bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return false; }
+
+typedef std::vector<double, AlignedAllocator<double> > AlignedDoubles;
+typedef std::vector<int, AlignedAllocator<int> > AlignedInts;
+
+// The species of the trios are stored in 16 bits
+typedef uint16_t SpeciesIndex;
+typedef std::vector<SpeciesIndex, AlignedAllocator<SpeciesIndex> > AlignedSpeciesIndices;
+static const int MAX_TRIO_SPECIES = 65535;
+
+// The ABBA, BABA and BBAA sums within the current jackknife block; build with -DDSUITE_FLOAT_LOCAL_COUNTS to keep them
+// as floats, which saves 12 bytes per trio; each site is then added to them rounded to a float
+#ifdef DSUITE_FLOAT_LOCAL_COUNTS
+typedef float LocalCount;
+#else
+typedef double LocalCount;
+#endif
+typedef std::vector<LocalCount, AlignedAllocator<LocalCount> > AlignedLocalCounts;
+
+// The precision of the stored jackknife block Ds: float halves the memory; build with -DDSUITE_DOUBLE_JACKKNIFE_BLOCKS
+// to keep them as doubles, which reproduces the standard errors of earlier versions to the last digit
+#ifdef DSUITE_DOUBLE_JACKKNIFE_BLOCKS
+typedef double JackknifeBlockValue;
+#else
+typedef float JackknifeBlockValue;
+#endif
+
+// The D values of the finished jackknife blocks of every trio, one for each of the three trio arrangements
+// The block records are kept in small chunks carved out of large slabs, rather than in three growing vectors per trio
+// Blocks can be added to different trios from several threads at the same time
+class JackknifeBlockStore {
+public:
+    JackknifeBlockStore(int nTrios) : firstChunks(nTrios, (Chunk*)NULL), lastChunks(nTrios, (Chunk*)NULL), chunksLeftInSlab(0) {};
+    ~JackknifeBlockStore();
+
+    void add(int i, double D0, double D1, double D2);
+    // The D values of trio i for one arrangement (0-2), in the order of the blocks
+    void get(int i, int arrangement, std::vector<double>& values) const;
+    static double bytesPerBlock() { return (double)sizeof(Chunk) / BLOCKS_PER_CHUNK; } // For each trio
+    static int bytesPerTrio() { return 2 * sizeof(Chunk*); } // Before it has any blocks
+
+    // For checkpoints: the blocks of each trio in turn; load() adds them to an empty store and returns false if the file is short
+    bool save(FILE* file) const;
+    bool load(FILE* file);
+
+private:
+    static const int BLOCKS_PER_CHUNK = 16;
+    static const size_t CHUNKS_PER_SLAB = 1 << 14;
+    struct BlockRecord { JackknifeBlockValue D[3]; };
+    struct Chunk { Chunk* next; int nBlocks; BlockRecord blocks[BLOCKS_PER_CHUNK]; };
+    std::vector<Chunk*> firstChunks; std::vector<Chunk*> lastChunks; // NULL for trios without any finished blocks
+    std::vector<Chunk*> slabs; Chunk* nextChunk; size_t chunksLeftInSlab;
+    std::mutex slabMutex;
+    Chunk* newChunk();
+};
+
+// The per-trio state of Dtrios, stored as a structure of arrays so that the trio loop can be vectorised
+class TrioTable {
+public:
+    // The trios numbered [firstTrio, firstTrio + nTrios) among all the trios of nSpecies species (see unrankTrio)
+    TrioTable(int nSpecies, int64_t firstTrio, int nTrios, int jkWindowSize);
+
+    int64_t firstTrio; // The trio number of table index 0
+    int nTrios;
+    int jkWindowSize;
+    AlignedSpeciesIndices species1; AlignedSpeciesIndices species2; AlignedSpeciesIndices species3; // Indices of the trio members in the species vector
+    AlignedDoubles ABBAtotals; AlignedDoubles BABAtotals; AlignedDoubles BBAAtotals;
+    AlignedLocalCounts localABBAtotals; AlignedLocalCounts localBABAtotals; AlignedLocalCounts localBBAAtotals; // For the current jackknife block
+    AlignedInts usedVars; // The number of used variants for each trio
+    AlignedInts localUsedVars; // The number of used variants in the current jackknife block
+    JackknifeBlockStore regionDs; // The D values in the jackknife blocks, for each of the three trio arrangements
+
+    // Add one site to the trios [trioFrom, trioTo); allPs holds the derived allele frequencies of all species (-1 if missing)
+    // Uses AVX-512 or AVX2 when the CPU has them; the results are identical to the scalar loop
+    void accumulate(int trioFrom, int trioTo, const double* allPs, double p_O);
+    // Add nSites usable sites that did not change the totals of trio i (closing jackknife blocks as needed)
+    void addUnchangedSites(int i, int nSites) {
+        while (nSites > 0) {
+            int toBlockEnd = jkWindowSize - localUsedVars[i];
+            if (nSites < toBlockEnd) { usedVars[i] += nSites; localUsedVars[i] += nSites; return; }
+            usedVars[i] += toBlockEnd; localUsedVars[i] += toBlockEnd; nSites -= toBlockEnd;
+            finishBlock(i);
+        }
+    }
+
+    // For checkpoints: everything accumulated so far (the trios themselves are not saved); load() returns false if the file is short
+    bool save(FILE* file) const;
+    bool load(FILE* file);
+
+    // The memory for each trio, not counting its finished jackknife blocks
+    static int bytesPerTrio() { return 3 * sizeof(SpeciesIndex) + 3 * sizeof(double) + 3 * sizeof(LocalCount) + 2 * sizeof(int) + JackknifeBlockStore::bytesPerTrio(); }
+
+private:
+    friend class SparseTrioAccumulator;
+    void accumulateScalar(int trioFrom, int trioTo, const double* allPs, double p_O);
+    void accumulateAVX2(int trioFrom, int trioTo, const double* allPs, double p_O);
+    void accumulateAVX512(int trioFrom, int trioTo, const double* allPs, double p_O);
+    void finishBlock(int i);
+};
+
+// Accumulates the trios whose smallest species index is in one range, visiting at each site only the trios
+// that have the derived allele in at least two species (the others get zero ABBA, BABA and BBAA)
+// The usedVars counts of the trios that are not visited are caught up lazily, from cumulative counts of the sites
+// at which each species, pair of species and trio of species is missing (inclusion-exclusion); those counts are only
+// looked up for a trio if one of its members has been missing since the trio was last brought up to date
+// The visits go through the trios in order, but each still costs several times as much as a trio in the vectorised dense loop,
+// so this is only faster when few trios are visited: when fewer than about 1 in 10 species have the derived allele at a typical site
+// Each instance only touches its own range of trios, so several of them can run in parallel on the same TrioTable
+class SparseTrioAccumulator {
+public:
+    SparseTrioAccumulator(TrioTable* table, int nSpecies, int part, int nParts);
+
+    void addSite(const double* allPs, double p_O);
+    void finish(); // Catch up all the trios to the last site
+
+    // The memory for each trio, on top of TrioTable::bytesPerTrio()
+    static int bytesPerTrio() { return sizeof(TrioState); }
+    // and for the tables of one part that don't depend on the number of trios (mostly the pairs of species it can touch)
+    static double bytesForPart(int nSpecies, int64_t firstTrio, int nTrios, int part, int nParts);
+
+private:
+    TrioTable* table;
+    int nSpecies;
+    int firstFrom; int firstTo; // The range of the smallest species index of the trios handled here
+    int64_t trioFrom; int64_t trioTo; // The trio numbers handled here (within the range of the table)
+    int nSites; // The number of sites added so far
+    std::vector<int64_t> firstRanks; // firstRanks[x] = number of the trio (x,x+1,x+2)
+    std::vector<int> missing; // For each species, the number of sites where it is missing
+    std::vector<int> lastMissing; // and the last site where it was missing (-1 if none)
+    std::vector<int> pairMissing; // For each pair firstFrom <= x < y (at pairIndex(x,y)), the number of sites where both are missing
+    // For each trio in [trioFrom,trioTo), together so that a visit touches one cache line
+    struct TrioState {
+        int trioMissing; // The number of sites where all three are missing
+        int syncedSites; // The number of sites the trio has been brought up to date with
+        int syncedMissing; // and the number of those sites at which any member was missing
+    };
+    std::vector<TrioState> trioStates;
+    // Reused for every site: the species with the derived allele, those that are not missing, and those that are, in order
+    std::vector<int> positiveSpecies; std::vector<int> presentSpecies; std::vector<int> missingSpecies;
+    std::vector<int> positiveBefore; std::vector<int> presentBefore; // For each species, how many of the above come before it
+
+    // The pairs of the species from firstFrom on, in a triangle; in size_t, as the number of pairs overflows an int above 65536 species
+    size_t pairIndex(int x, int y) const {
+        size_t u = x - firstFrom; size_t m = nSpecies - firstFrom;
+        return u * m - u * (u + 1) / 2 + (y - x - 1);
+    }
+    // Within the trios starting with x, those (x,y',z) with y' < y come before (x,y,y+1): C(n-x-1,2) - C(n-y,2) of them
+    int64_t trioIndex(int x, int y, int z) const {
+        return firstRanks[x] + (int64_t)(nSpecies - x - 1) * (nSpecies - x - 2) / 2 - (int64_t)(nSpecies - y) * (nSpecies - y - 1) / 2 + (z - y - 1);
+    }
+    int missingAny(int64_t i, int x, int y, int z) const;
+    // The range of the first members of the trios of one part of a table
+    static void splitSpecies(int nSpecies, int64_t firstTrio, int nTrios, int part, int nParts, int& firstFrom, int& firstTo);
+    void catchUp(int64_t trio, int x, int y, int z); // Add the sites since the trio was last brought up to date
+    void addTrio(int x, int y, int z, const double* allPs, double p_O);
+};
+
+#endif /* Dmin_trios_h */
@@ -11,6 +11,10 @@
 #include "Dmin.h"
 #include "D.h"
 #include "Dmin_combine.h"
+#include "Dmin_merge.h"
+#include "Dsuite_cache.h"
+#include "Dsuite_index.h"
+#include "Dsuite_simulate.h"
 
 #define AUTHOR "Milan Malinsky"
 #define PACKAGE_VERSION "0.1 r3"
@@ -29,8 +33,14 @@ static const char *USAGE_MESSAGE =
 "Commands:\n"
 "           Dtrios                  Calculate D statistics (ABBA-BABA) for all possible trios of populations/species\n"
 "           DtriosCombine           Combine results from Dtrios runs across genomic regions (e.g. per-chromosome)\n"
+"           DtriosMerge             Put back together the results of Dtrios runs over different ranges of trios (--trio-range)\n"
 "           Dinvestigate            Follow up analyses for trios with significantly elevated D:\n"
 "                                   calculates the f4 statistic, and also f_d and f_dM in windows along the genome\n"
+"           cache                   Convert a VCF into a binary genotype cache (" GENOTYPE_CACHE_EXT "), which is much faster to read\n"
+"                                   for repeated analyses of the same data\n"
+"           index                   Index the variant line numbers of a VCF (" ORDINAL_INDEX_EXT "), so that Dtrios --region=start,length\n"
+"                                   can start reading straight at the subset\n"
+"           simulate                Generate a synthetic VCF, SETS file and species tree, for testing and benchmarking\n"
 "\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
 
 int main(int argc, char **argv) {
@@ -60,6 +70,14 @@ int main(int argc, char **argv) {
             DminMain(argc - 1, argv + 1);
         else if (command == "DtriosCombine")
             DminCombineMain(argc - 1, argv + 1);
+        else if (command == "DtriosMerge")
+            DminMergeMain(argc - 1, argv + 1);
+        else if (command == "cache")
+            cacheMain(argc - 1, argv + 1);
+        else if (command == "index")
+            indexMain(argc - 1, argv + 1);
+        else if (command == "simulate")
+            simulateMain(argc - 1, argv + 1);
         else
         {
             std::cerr << "Unrecognized command: " << command << "\n";
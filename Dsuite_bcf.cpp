@@ -0,0 +1,184 @@
+//
+//  Dsuite_bcf.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#include "Dsuite_bcf.h"
+#include "Dsuite_bgzf.h"
+#include <string.h>
+#include <zlib.h>
+
+// The BCF2 types of the typed values
+static const int BCF_TYPE_INT8 = 1;
+static const int BCF_TYPE_INT16 = 2;
+static const int BCF_TYPE_INT32 = 3;
+static const int BCF_TYPE_FLOAT = 5;
+static const int BCF_TYPE_CHAR = 7;
+
+static const int BCF_SHARED_FIXED_LENGTH = 24; // CHROM, POS, rlen, QUAL, n_allele_info, n_fmt_sample
+
+bool isBcf(const std::string& filename) {
+    gzFile f = gzopen(filename.c_str(), "rb"); // Also reads uncompressed files
+    if (f == NULL) return false;
+    char magic[4]; bool bcf = (gzread(f, magic, 4) == 4 && memcmp(magic, "BCF\2", 4) == 0);
+    gzclose(f);
+    return bcf;
+}
+
+static void bcfFail(const std::string& message) {
+    std::cerr << "Error reading the BCF file: " << message << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+static uint32_t readUint32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static int typeSize(int type) {
+    switch (type) {
+        case BCF_TYPE_INT8: case BCF_TYPE_CHAR: return 1;
+        case BCF_TYPE_INT16: return 2;
+        case BCF_TYPE_INT32: case BCF_TYPE_FLOAT: return 4;
+        default: return 0;
+    }
+}
+
+// A single integer as a typed value (e.g. the key of a FORMAT field)
+static int readTypedInt(const unsigned char*& p, const unsigned char* end) {
+    if (p >= end) bcfFail("a record is damaged");
+    int type = *p & 0xF; int size = typeSize(type); p++;
+    if (p + size > end || type == BCF_TYPE_FLOAT || type == BCF_TYPE_CHAR) bcfFail("a record is damaged");
+    int value;
+    if (type == BCF_TYPE_INT8) value = (int8_t)*p;
+    else if (type == BCF_TYPE_INT16) { int16_t v; memcpy(&v, p, 2); value = v; }
+    else { int32_t v; memcpy(&v, p, 4); value = v; }
+    p += size;
+    return value;
+}
+
+// The type and the number of values that follow; counts of 15 and more are stored as a typed integer after the descriptor
+static void readTypeDescriptor(const unsigned char*& p, const unsigned char* end, int& type, int& count) {
+    if (p >= end) bcfFail("a record is damaged");
+    type = *p & 0xF; count = *p >> 4; p++;
+    if (count == 15) count = readTypedInt(p, end);
+    if (count < 0) bcfFail("a record is damaged");
+}
+
+BcfFile::BcfFile(const std::string& filename) : gtKey(-1), fileName(filename) {
+    if (isBgzf(filename)) bcfFile = new ibgzfstream(filename, std::max(1, std::min(BGZF_MAX_INFLATE_THREADS, (int)std::thread::hardware_concurrency())));
+    else bcfFile = new std::ifstream(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!bcfFile->good()) { std::cerr << "Error: could not open " << filename << std::endl; exit(EXIT_FAILURE); }
+    char magic[5]; unsigned char textLength[4];
+    bcfFile->read(magic, 5); bcfFile->read((char*)textLength, 4);
+    if (!bcfFile->good() || memcmp(magic, "BCF\2", 4) != 0) { std::cerr << "Error: " << filename << " is not a BCF2 file" << std::endl; exit(EXIT_FAILURE); }
+    string text(readUint32(textLength), '\0');
+    bcfFile->read(&text[0], text.length());
+    if (!bcfFile->good()) bcfFail("the header is truncated");
+    parseHeader(text);
+}
+
+BcfFile::~BcfFile() {
+    delete bcfFile;
+}
+
+// The value of KEY= inside the <...> of a header line; empty if it isn't there
+static string headerLineValue(const string& line, const string& key) {
+    size_t start = line.find("<" + key + "=");
+    if (start == string::npos) start = line.find("," + key + "=");
+    if (start == string::npos) return "";
+    start += key.length() + 2;
+    size_t end = line.find_first_of(",>", start);
+    return line.substr(start, end == string::npos ? string::npos : end - start);
+}
+
+// The dictionaries are numbered as in htslib: in the order of the header lines unless there are IDX= fields,
+// with the FILTER, INFO and FORMAT IDs all in one string dictionary that starts with PASS
+void BcfFile::parseHeader(const string& text) {
+    std::map<string, int> strings; strings["PASS"] = 0; int nextString = 1;
+    std::map<int, string> contigs; int nextContig = 0;
+    std::vector<string> lines = split(text.substr(0, text.find('\0')), '\n');
+    for (std::vector<string>::size_type i = 0; i != lines.size(); i++) {
+        const string& line = lines[i];
+        if (line.compare(0, 6, "#CHROM") == 0) {
+            std::vector<string> fields = split(line, '\t');
+            if (fields.size() > NUM_NON_GENOTYPE_COLUMNS) sampleNames.assign(fields.begin() + NUM_NON_GENOTYPE_COLUMNS, fields.end());
+            continue;
+        }
+        bool isContig = (line.compare(0, 10, "##contig=<") == 0);
+        bool isString = (line.compare(0, 10, "##FILTER=<") == 0 || line.compare(0, 8, "##INFO=<") == 0 || line.compare(0, 10, "##FORMAT=<") == 0);
+        if (!isContig && !isString) continue;
+        string ID = headerLineValue(line, "ID"); string IDX = headerLineValue(line, "IDX");
+        if (ID.empty()) continue;
+        if (isContig) {
+            int index = IDX.empty() ? nextContig : atoi(IDX.c_str());
+            contigs[index] = ID; nextContig = std::max(nextContig, index + 1);
+        } else if (!IDX.empty()) {
+            int index = atoi(IDX.c_str());
+            strings[ID] = index; nextString = std::max(nextString, index + 1);
+        } else if (strings.count(ID) == 0) {
+            strings[ID] = nextString++;
+        }
+        if (ID == "GT" && line.compare(0, 10, "##FORMAT=<") == 0) gtKey = strings[ID];
+    }
+    contigNames.resize(nextContig);
+    for (std::map<int, string>::iterator it = contigs.begin(); it != contigs.end(); it++) contigNames[it->first] = it->second;
+    if (sampleNames.empty()) { std::cerr << "Could not find any samples in the header of " << fileName << std::endl; exit(EXIT_FAILURE); }
+}
+
+const string& BcfFile::contigName(int chromID) const {
+    if (chromID < 0 || chromID >= (int)contigNames.size()) bcfFail("a record has a CHROM that is not among the contigs in the header");
+    return contigNames[chromID];
+}
+
+bool BcfFile::getNextRecord(string& record) {
+    unsigned char lengths[8];
+    bcfFile->read((char*)lengths, 8);
+    if (bcfFile->gcount() == 0) return false;
+    if (bcfFile->gcount() != 8) bcfFail("the file is truncated");
+    size_t recordLength = 8 + (size_t)readUint32(lengths) + (size_t)readUint32(lengths + 4);
+    record.resize(recordLength);
+    memcpy(&record[0], lengths, 8);
+    bcfFile->read(&record[8], recordLength - 8);
+    if ((size_t)bcfFile->gcount() != recordLength - 8) bcfFail("the file is truncated");
+    return true;
+}
+
+BcfRecord::BcfRecord(const string& record, const BcfFile& file) : gtKey(file.gtKey) {
+    const unsigned char* data = (const unsigned char*)record.data();
+    if (record.length() < 8 + BCF_SHARED_FIXED_LENGTH) bcfFail("a record is damaged");
+    size_t sharedLength = readUint32(data); size_t indivLength = readUint32(data + 4);
+    if (sharedLength < BCF_SHARED_FIXED_LENGTH || 8 + sharedLength + indivLength != record.length()) bcfFail("a record is damaged");
+    shared = data + 8; sharedEnd = shared + sharedLength; indiv = sharedEnd; indivEnd = indiv + indivLength;
+    chromID = (int)(int32_t)readUint32(shared); pos = (int)(int32_t)readUint32(shared + 4) + 1;
+    nAlleles = (int)(readUint32(shared + 16) >> 16);
+    uint32_t nFormatSample = readUint32(shared + 20);
+    nFormat = (int)(nFormatSample >> 24); nSamples = (int)(nFormatSample & 0xFFFFFF);
+}
+
+bool BcfRecord::isBiallelicSNP() const {
+    if (nAlleles > 2) return false;
+    const unsigned char* p = shared + BCF_SHARED_FIXED_LENGTH;
+    int type, length;
+    readTypeDescriptor(p, sharedEnd, type, length); p += length; // ID
+    for (int a = 0; a != nAlleles; a++) {
+        readTypeDescriptor(p, sharedEnd, type, length);
+        if (p + length > sharedEnd) bcfFail("a record is damaged");
+        if (length > 1) return false;
+        if (a == 1 && length == 1 && *p == '*') return false;
+        p += length;
+    }
+    return true;
+}
+
+BcfGenotypes BcfRecord::genotypes() const {
+    const unsigned char* p = indiv;
+    for (int f = 0; f != nFormat; f++) {
+        int key = readTypedInt(p, indivEnd);
+        int type, count; readTypeDescriptor(p, indivEnd, type, count);
+        size_t length = (size_t)typeSize(type) * count * nSamples;
+        if (p + length > indivEnd) bcfFail("a record is damaged");
+        if (key == gtKey && (type == BCF_TYPE_INT8 || type == BCF_TYPE_INT16 || type == BCF_TYPE_INT32)) return BcfGenotypes(p, type, count, nSamples);
+        p += length;
+    }
+    return BcfGenotypes();
+}
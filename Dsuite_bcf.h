@@ -0,0 +1,55 @@
+//
+//  Dsuite_bcf.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dsuite_bcf_h
+#define Dsuite_bcf_h
+
+#include "Dsuite_utils.h"
+#include <stdint.h>
+
+// Checks for the "BCF\2" magic at the start of the (possibly bgzipped) file
+bool isBcf(const std::string& filename);
+
+// A BCF2 file (bgzipped as written by bcftools, or uncompressed): the header is read when it is opened,
+// then the records are handed out as they are in the file, to be decoded by BcfRecord (which can be done on other threads)
+class BcfFile {
+public:
+    BcfFile(const std::string& filename); // Exits with an error message if the file can't be read
+    ~BcfFile();
+
+    std::vector<string> sampleNames;
+    std::vector<string> contigNames; // The contig dictionary: the CHROM of a record is an index into this
+    int gtKey; // The GT key in the string dictionary; -1 if the header has no FORMAT/GT
+    const string& contigName(int chromID) const; // Exits with an error message if the contig is not in the header
+
+    bool getNextRecord(string& record); // The whole record, including its two length fields; false at the end of the file
+    std::istream* stream() { return bcfFile; } // For seeking with a CSI index
+
+private:
+    string fileName;
+    std::istream* bcfFile;
+    void parseHeader(const string& text);
+};
+
+// Decodes a record from BcfFile::getNextRecord, without copying it
+class BcfRecord {
+public:
+    BcfRecord(const string& record, const BcfFile& file);
+
+    int chromID; // Index into BcfFile::contigNames
+    int pos; // 1-based, as in a VCF
+
+    bool isBiallelicSNP() const; // As isBiallelicSNP() for a VCF line: one base REF and ALT, and the ALT is not *
+    BcfGenotypes genotypes() const; // Empty if the record has no GT
+
+private:
+    const unsigned char* shared; const unsigned char* sharedEnd;
+    const unsigned char* indiv; const unsigned char* indivEnd;
+    int nAlleles; int nFormat; int nSamples; int gtKey;
+};
+
+#endif /* Dsuite_bcf_h */
@@ -0,0 +1,378 @@
+//
+//  Dsuite_bench.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+// Microbenchmarks of the parts of Dsuite that take the time, on synthetic data, so that changes to them can be measured
+// without real data sets: built as a separate program by make bench (Build/Dsuite_bench)
+
+#include "Dsuite_utils.h"
+#include "Dmin_trios.h"
+#include "Dmin_combine.h"
+#include "Dsuite_output.h"
+#include <chrono>
+#include <functional>
+#include <unistd.h>
+#include <limits.h>
+
+#define BENCH_BIN "Dsuite_bench"
+
+static const char *BENCH_USAGE_MESSAGE =
+"Usage: " BENCH_BIN " [OPTIONS]\n"
+"Time the main components of " PROGRAM_BIN " on synthetic data: splitting and tokenizing VCF lines, the allele counts of the sets,\n"
+"the accumulation of the trios (dense and --sparse), the jackknife, reading a gzipped VCF, and parsing the DtriosCombine inputs\n"
+"The results are written to standard output as a table with a header line, one benchmark per line;\n"
+"throughputs that do not apply to a benchmark are NA\n"
+"\n"
+"       -h, --help                              display this help and exit\n"
+"       --samples=N                             (default=100) the number of samples in the synthetic VCF\n"
+"       --species=N                             (default=20) the number of species the samples are split between (plus an Outgroup)\n"
+"       --sites=N                               (default=100000) the number of sites\n"
+"       --blocks=N                              (default=100) the number of jackknife blocks of each trio\n"
+"       --derived=F                             (default=0.3) the probability that a species has the derived allele at a site\n"
+"                                               (--sparse is faster than the dense accumulation only when this is low; see Dtrios --help)\n"
+"       --repeat=N                              (default=3) time each benchmark N times and report the fastest\n"
+"       --only=NAME1,NAME2,...                  (optional) run only these benchmarks\n"
+"       --tmp-dir=DIR                           (default=/tmp) where the synthetic files are written (they are removed at the end)\n"
+"\n"
+"Benchmarks: split, tokenize, set_counts, set_counts_packed, trio_accumulate, trio_accumulate_sparse, jackknife,\n"
+"            gzstream_read, combine_parse, combine_parse_binary\n"
+"\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
+
+enum { OPT_SAMPLES = 1, OPT_SPECIES, OPT_SITES, OPT_BLOCKS, OPT_DERIVED, OPT_REPEAT, OPT_ONLY, OPT_TMP_DIR };
+
+static const char* shortopts = "h";
+
+static const struct option longopts[] = {
+    { "samples",   required_argument, NULL, OPT_SAMPLES },
+    { "species",   required_argument, NULL, OPT_SPECIES },
+    { "sites",   required_argument, NULL, OPT_SITES },
+    { "blocks",   required_argument, NULL, OPT_BLOCKS },
+    { "derived",   required_argument, NULL, OPT_DERIVED },
+    { "repeat",   required_argument, NULL, OPT_REPEAT },
+    { "only",   required_argument, NULL, OPT_ONLY },
+    { "tmp-dir",   required_argument, NULL, OPT_TMP_DIR },
+    { "help",   no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+namespace opt
+{
+    static int nSamples = 100;
+    static int nSpecies = 20;
+    static int nSites = 100000;
+    static int nBlocks = 100;
+    static double derived = 0.3;
+    static int repeat = 3;
+    static std::vector<string> only;
+    static string tmpDir = "/tmp";
+}
+
+// The distinct synthetic sites; longer runs go through them again, so that the inputs stay small enough to generate quickly
+static const int SITE_POOL_SIZE = 10000;
+// Each timing runs the benchmark (at least once) until this much time has passed and takes the time per round
+static const double MIN_BENCH_SECONDS = 0.2;
+
+// Results of the benchmarks are added to this, so that the compiler can't leave out the work
+static volatile double benchSink = 0;
+
+// The synthetic data: samples are assigned to the species in turn, the last set being the Outgroup
+// At each site the derived allele is in each species with probability --derived, at a random frequency; the Outgroup is ancestral
+// 2% of the genotypes are missing
+class SyntheticData {
+public:
+    SyntheticData(int nSamples, int nSpecies, int nSites);
+
+    std::vector<string> speciesNames; // Without the Outgroup, in the order of the SetIndex
+    std::map<string, std::vector<size_t>> setsToPosMap;
+    std::vector<string> vcfLines; // SITE_POOL_SIZE at most
+    std::vector<unsigned char> packedGenotypes; // The same genotypes, packedBytes for each line
+    size_t packedBytes;
+    std::vector<double> Ps; std::vector<double> POs; // The derived allele frequencies of the species and of the Outgroup at each line
+};
+
+SyntheticData::SyntheticData(int nSamples, int nSpecies, int nSites) {
+    int nSets = nSpecies + 1;
+    for (int s = 0; s != nSpecies; s++) { char name[16]; snprintf(name, sizeof(name), "Sp%05d", s); speciesNames.push_back(name); }
+    for (int i = 0; i != nSamples; i++) setsToPosMap[(i % nSets == nSpecies) ? "Outgroup" : speciesNames[i % nSets]].push_back(i);
+    SetIndex sets(setsToPosMap, nSamples);
+    GeneralSetCounts c(sets, nSamples);
+    LineTokenizer fields;
+
+    int nLines = std::min(nSites, SITE_POOL_SIZE);
+    packedBytes = PackedGenotypes::bytesNeeded(nSamples);
+    packedGenotypes.assign((size_t)nLines * packedBytes, 0);
+    Ps.assign((size_t)nLines * nSpecies, -1); POs.assign(nLines, -1);
+    uint64_t state = 1; std::vector<double> freqs(nSets);
+    for (int l = 0; l != nLines; l++) {
+        for (int s = 0; s != nSets; s++) freqs[s] = (s == nSpecies || mix64Uniform(state) >= opt::derived) ? 0 : mix64Uniform(state);
+        string line = "chr1\t" + numToString(l + 1) + "\t.\tA\tT\t.\tPASS\t.\tGT";
+        for (int i = 0; i != nSamples; i++) {
+            double p = freqs[i % nSets];
+            if (mix64Uniform(state) < 0.02) { line += "\t./."; continue; }
+            line += (mix64Uniform(state) < p) ? "\t1" : "\t0";
+            line += (mix64Uniform(state) < p) ? "|1" : "|0";
+        }
+        vcfLines.push_back(line);
+        fields.tokenize(line);
+        PackedGenotypes::pack(fields, nSamples, &packedGenotypes[(size_t)l * packedBytes]);
+        c.reset(); c.getSetVariantCounts(fields);
+        POs[l] = c.setDAFs[sets.outgroupID];
+        for (int s = 0; s != nSpecies; s++) Ps[(size_t)l * nSpecies + s] = c.setDAFs[sets.getID(speciesNames[s])];
+    }
+}
+
+static bool selected(const string& name) {
+    return opt::only.empty() || std::find(opt::only.begin(), opt::only.end(), name) != opt::only.end();
+}
+
+// Runs work() until at least MIN_BENCH_SECONDS have passed, --repeat times, and returns the fastest time for one round
+static double timeRounds(const std::function<void()>& work) {
+    double best = 0;
+    for (int r = 0; r != opt::repeat; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int nRounds = 0; double elapsed;
+        do {
+            work(); nRounds++;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } while (elapsed < MIN_BENCH_SECONDS);
+        if (r == 0 || elapsed / nRounds < best) best = elapsed / nRounds;
+    }
+    return best;
+}
+
+// One line of the results; the counts are for one round of the benchmark, 0 for the throughputs that don't apply
+static void report(ResultBuffer& out, const string& name, double seconds, double nSites, double nTrios, double nBytes) {
+    out << name << "\t" << opt::nSamples << "\t" << opt::nSpecies << "\t" << opt::nSites << "\t" << (long long)nChoosek(opt::nSpecies, 3) << "\t" << opt::nBlocks << "\t" << seconds;
+    if (nSites > 0) out << "\t" << nSites / seconds; else out << "\tNA";
+    if (nTrios > 0) out << "\t" << nTrios / seconds; else out << "\tNA";
+    if (nBytes > 0) out << "\t" << nBytes / seconds / 1e6; else out << "\tNA";
+    out << "\n";
+    std::cout << out.str() << std::flush; out.clear();
+}
+
+void parseBenchOptions(int argc, char** argv);
+
+int main(int argc, char** argv) {
+    parseBenchOptions(argc, argv);
+    std::cerr << "Generating " << std::min(opt::nSites, SITE_POOL_SIZE) << " distinct sites for " << opt::nSamples << " samples in " << opt::nSpecies << " species" << std::endl;
+    SyntheticData data(opt::nSamples, opt::nSpecies, opt::nSites);
+    SetIndex sets(data.setsToPosMap, opt::nSamples);
+    int nLines = (int)data.vcfLines.size();
+    int nTrios = (int)nChoosek(opt::nSpecies, 3);
+    string tmpPrefix = opt::tmpDir + "/" BENCH_BIN "_" + numToString(getpid());
+
+    ResultBuffer out;
+    out << "benchmark\tsamples\tspecies\tsites\ttrios\tblocks\tseconds\tsites_per_s\ttrios_per_s\tMB_per_s\n";
+    std::cout << out.str(); out.clear();
+
+    if (selected("split")) {
+        double seconds = timeRounds([&]() {
+            size_t nFields = 0;
+            for (int l = 0; l != opt::nSites; l++) nFields += split(data.vcfLines[l % nLines], '\t').size();
+            benchSink += nFields;
+        });
+        report(out, "split", seconds, opt::nSites, 0, 0);
+    }
+
+    if (selected("tokenize")) {
+        LineTokenizer fields;
+        double seconds = timeRounds([&]() {
+            size_t nFields = 0;
+            for (int l = 0; l != opt::nSites; l++) { fields.tokenize(data.vcfLines[l % nLines]); nFields += fields.size(); }
+            benchSink += nFields;
+        });
+        report(out, "tokenize", seconds, opt::nSites, 0, 0);
+    }
+
+    if (selected("set_counts")) {
+        LineTokenizer fields; GeneralSetCounts c(sets, opt::nSamples);
+        double seconds = timeRounds([&]() {
+            for (int l = 0; l != opt::nSites; l++) {
+                fields.tokenize(data.vcfLines[l % nLines]);
+                c.reset(); c.getSetVariantCounts(fields);
+                benchSink += c.setDAFs[0];
+            }
+        });
+        report(out, "set_counts", seconds, opt::nSites, 0, 0);
+    }
+
+    if (selected("set_counts_packed")) {
+        GeneralSetCounts c(sets, opt::nSamples);
+        double seconds = timeRounds([&]() {
+            for (int l = 0; l != opt::nSites; l++) {
+                c.reset(); c.getSetVariantCounts(&data.packedGenotypes[(size_t)(l % nLines) * data.packedBytes]);
+                benchSink += c.setDAFs[0];
+            }
+        });
+        report(out, "set_counts_packed", seconds, opt::nSites, 0, 0);
+    }
+
+    int jkWindowSize = std::max(1, opt::nSites / opt::nBlocks);
+    if (selected("trio_accumulate")) {
+        double seconds = timeRounds([&]() {
+            TrioTable trioTable(opt::nSpecies, 0, nTrios, jkWindowSize);
+            for (int l = 0; l != opt::nSites; l++) {
+                int k = l % nLines;
+                if (data.POs[k] == -1) continue;
+                trioTable.accumulate(0, nTrios, &data.Ps[(size_t)k * opt::nSpecies], data.POs[k]);
+            }
+            benchSink += trioTable.ABBAtotals[0];
+        });
+        report(out, "trio_accumulate", seconds, opt::nSites, (double)opt::nSites * nTrios, 0);
+    }
+
+    if (selected("trio_accumulate_sparse")) {
+        double seconds = timeRounds([&]() {
+            TrioTable trioTable(opt::nSpecies, 0, nTrios, jkWindowSize);
+            SparseTrioAccumulator accumulator(&trioTable, opt::nSpecies, 0, 1);
+            for (int l = 0; l != opt::nSites; l++) {
+                int k = l % nLines;
+                if (data.POs[k] == -1) continue;
+                accumulator.addSite(&data.Ps[(size_t)k * opt::nSpecies], data.POs[k]);
+            }
+            accumulator.finish();
+            benchSink += trioTable.ABBAtotals[0];
+        });
+        report(out, "trio_accumulate_sparse", seconds, opt::nSites, (double)opt::nSites * nTrios, 0);
+    }
+
+    if (selected("jackknife")) {
+        uint64_t state = 2; std::vector<std::vector<double> > blockDs(std::min(nTrios, SITE_POOL_SIZE));
+        for (size_t i = 0; i != blockDs.size(); i++) for (int b = 0; b != opt::nBlocks; b++) blockDs[i].push_back(0.2 * mix64Uniform(state) - 0.1);
+        double seconds = timeRounds([&]() {
+            double sum = 0;
+            for (int i = 0; i != nTrios; i++) sum += jackknive_std_err(blockDs[i % blockDs.size()]);
+            benchSink += sum;
+        });
+        report(out, "jackknife", seconds, 0, nTrios, 0);
+    }
+
+    if (selected("gzstream_read")) {
+        string vcfFileName = tmpPrefix + ".vcf.gz";
+        std::ostream* vcfOut = createWriter(vcfFileName);
+        double nBytes = 0;
+        for (int l = 0; l != opt::nSites; l++) { *vcfOut << data.vcfLines[l % nLines] << "\n"; nBytes += data.vcfLines[l % nLines].length() + 1; }
+        delete vcfOut;
+        double seconds = timeRounds([&]() {
+            std::istream* vcfIn = createReader(vcfFileName); string line; size_t nRead = 0;
+            while (getline(*vcfIn, line)) nRead += line.length();
+            delete vcfIn;
+            benchSink += nRead;
+        });
+        remove(vcfFileName.c_str());
+        report(out, "gzstream_read", seconds, opt::nSites, 0, nBytes);
+    }
+
+    if (selected("combine_parse") || selected("combine_parse_binary")) {
+        // The combine output of a Dtrios run: the totals and the jackknife block Ds of every trio
+        ResultWriter* countsOut = new ResultWriter(tmpPrefix + "_combine.txt");
+        ResultWriter* blocksOut = new ResultWriter(tmpPrefix + "_combine_stderr.txt");
+        uint64_t state = 3; std::vector<double> blockDs[3];
+        int a = 0, b = 1, c = 2;
+        CombineBinaryWriter* binaryOut = NULL;
+        if (selected("combine_parse_binary")) binaryOut = new CombineBinaryWriter(tmpPrefix + "_bin" COMBINE_BINARY_EXT, data.speciesNames);
+        for (int i = 0; i != nTrios; i++) {
+            double BBAA = 1000 * mix64Uniform(state), BABA = 1000 * mix64Uniform(state), ABBA = 1000 * mix64Uniform(state);
+            *countsOut << data.speciesNames[a] << "\t" << data.speciesNames[b] << "\t" << data.speciesNames[c] << "\t" << BBAA << "\t" << BABA << "\t" << ABBA << "\n";
+            for (int k = 0; k != 3; k++) {
+                blockDs[k].clear();
+                for (int j = 0; j != opt::nBlocks; j++) blockDs[k].push_back(0.2 * mix64Uniform(state) - 0.1);
+                print_vector(blockDs[k], *blocksOut, ',', false);
+                *blocksOut << ((k == 2) ? "\n" : "\t");
+            }
+            if (binaryOut != NULL) binaryOut->addTrio(a, b, c, BBAA, BABA, ABBA, blockDs);
+            nextTrio(opt::nSpecies, a, b, c);
+        }
+        delete countsOut; delete blocksOut;
+        if (binaryOut != NULL) { binaryOut->close(); delete binaryOut; }
+
+        // Read and parse all the trios, as DtriosCombine does for each run
+        auto parseAll = [&](const string& prefix) {
+            CombineInput input(prefix); CombineTrioRecord record; CombineParseScratch scratch;
+            string s1, s2, s3; double BBAA, BABA, ABBA; std::vector<double> Ds[3];
+            while (input.readTrio(record)) {
+                input.parseCounts(record, scratch, s1, s2, s3, BBAA, BABA, ABBA);
+                for (int k = 0; k != 3; k++) Ds[k].clear();
+                input.parseBlockDs(record, scratch, Ds[0], Ds[1], Ds[2]);
+                benchSink += BBAA + Ds[0].size();
+            }
+        };
+        if (selected("combine_parse")) {
+            std::ifstream countsIn((tmpPrefix + "_combine.txt").c_str(), std::ios::ate | std::ios::binary);
+            std::ifstream blocksIn((tmpPrefix + "_combine_stderr.txt").c_str(), std::ios::ate | std::ios::binary);
+            double nBytes = (double)countsIn.tellg() + (double)blocksIn.tellg();
+            double seconds = timeRounds([&]() { parseAll(tmpPrefix); });
+            report(out, "combine_parse", seconds, 0, nTrios, nBytes);
+        }
+        if (selected("combine_parse_binary")) {
+            double seconds = timeRounds([&]() { parseAll(tmpPrefix + "_bin"); });
+            report(out, "combine_parse_binary", seconds, 0, nTrios, 0);
+        }
+        remove((tmpPrefix + "_combine.txt").c_str()); remove((tmpPrefix + "_combine_stderr.txt").c_str());
+        remove((tmpPrefix + "_bin" COMBINE_BINARY_EXT).c_str());
+    }
+    return 0;
+}
+
+void parseBenchOptions(int argc, char** argv) {
+    bool die = false;
+    static const char* allBenchmarks[] = { "split", "tokenize", "set_counts", "set_counts_packed", "trio_accumulate", "trio_accumulate_sparse", "jackknife", "gzstream_read", "combine_parse", "combine_parse_binary" };
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;)
+    {
+        std::istringstream arg(optarg != NULL ? optarg : "");
+        switch (c)
+        {
+            case '?': die = true; break;
+            case OPT_SAMPLES: arg >> opt::nSamples; break;
+            case OPT_SPECIES: arg >> opt::nSpecies; break;
+            case OPT_SITES: arg >> opt::nSites; break;
+            case OPT_BLOCKS: arg >> opt::nBlocks; break;
+            case OPT_DERIVED: arg >> opt::derived; break;
+            case OPT_REPEAT: arg >> opt::repeat; break;
+            case OPT_ONLY: opt::only = split(arg.str(), ','); break;
+            case OPT_TMP_DIR: arg >> opt::tmpDir; break;
+            case 'h':
+                std::cout << BENCH_USAGE_MESSAGE;
+                exit(EXIT_SUCCESS);
+        }
+    }
+
+    if (argc - optind > 0) {
+        std::cerr << "too many arguments\n";
+        die = true;
+    }
+    if (opt::nSpecies < 3 || opt::nSpecies > MAX_TRIO_SPECIES) {
+        std::cerr << "The number of species should be between 3 and " << MAX_TRIO_SPECIES << "\n";
+        die = true;
+    }
+    else if (nChoosek(opt::nSpecies, 3) > INT_MAX) {
+        std::cerr << "There are too many trios of " << opt::nSpecies << " species for one table\n";
+        die = true;
+    }
+    if (opt::nSamples < opt::nSpecies + 1) {
+        std::cerr << "There should be at least one sample for each species and for the Outgroup\n";
+        die = true;
+    }
+    if (opt::nSites < 1 || opt::nBlocks < 3 || opt::repeat < 1) {
+        std::cerr << "The number of sites and of repeats should be at least 1, and the number of blocks at least 3\n";
+        die = true;
+    }
+    if (opt::derived < 0 || opt::derived > 1) {
+        std::cerr << "--derived should be between 0 and 1\n";
+        die = true;
+    }
+    for (size_t i = 0; i != opt::only.size(); i++) {
+        if (std::find(allBenchmarks, allBenchmarks + sizeof(allBenchmarks) / sizeof(allBenchmarks[0]), opt::only[i]) == allBenchmarks + sizeof(allBenchmarks) / sizeof(allBenchmarks[0])) {
+            std::cerr << "Unknown benchmark: " << opt::only[i] << "\n";
+            die = true;
+        }
+    }
+
+    if (die) {
+        std::cout << "\n" << BENCH_USAGE_MESSAGE;
+        exit(EXIT_FAILURE);
+    }
+}
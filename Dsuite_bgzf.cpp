@@ -0,0 +1,198 @@
+//
+//  Dsuite_bgzf.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#include "Dsuite_bgzf.h"
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+static const int BGZF_HEADER_LENGTH = 12; // The fixed part of the gzip header, up to and including XLEN
+static const int BGZF_FOOTER_LENGTH = 8; // CRC32 and ISIZE
+
+static uint16_t readUint16(const unsigned char* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t readUint32(const unsigned char* p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+// Returns the total size of the block (BSIZE + 1) from the "BC" extra subfield; -1 if the header is not BGZF
+static int bgzfBlockSize(const unsigned char* header, const unsigned char* extra, int extraLength) {
+    if (header[0] != 31 || header[1] != 139 || header[2] != 8 || !(header[3] & 4)) return -1;
+    for (int i = 0; i + 4 <= extraLength; ) {
+        int subfieldLength = readUint16(extra + i + 2);
+        if (extra[i] == 'B' && extra[i+1] == 'C' && subfieldLength == 2 && i + 6 <= extraLength) return readUint16(extra + i + 4) + 1;
+        i += 4 + subfieldLength;
+    }
+    return -1;
+}
+
+bool isBgzf(const std::string& filename) {
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (f == NULL) return false;
+    unsigned char header[BGZF_HEADER_LENGTH]; unsigned char extra[65536]; bool bgzf = false;
+    if (fread(header, 1, BGZF_HEADER_LENGTH, f) == BGZF_HEADER_LENGTH) {
+        int extraLength = readUint16(header + 10);
+        if (fread(extra, 1, extraLength, f) == (size_t)extraLength) bgzf = (bgzfBlockSize(header, extra, extraLength) != -1);
+    }
+    fclose(f);
+    return bgzf;
+}
+
+static void bgzfFail(const std::string& filename, const std::string& message) {
+    std::cerr << "Error reading " << filename << ": " << message << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+bool readWholeBgzf(const std::string& filename, std::vector<char>& contents) {
+    gzFile f = gzopen(filename.c_str(), "rb"); // zlib reads the concatenated BGZF blocks as one gzip stream
+    if (f == NULL) return false;
+    contents.clear(); char buffer[1 << 16]; int n;
+    while ((n = gzread(f, buffer, sizeof(buffer))) > 0) contents.insert(contents.end(), buffer, buffer + n);
+    gzclose(f);
+    return n == 0;
+}
+
+BgzfReadAhead::BgzfReadAhead(FILE* file, const std::string& filename, int nThreads) : file(file), filename(filename),
+    jobs(2 * nThreads + 2), freeJobs(jobs.size()), jobsToInflate(jobs.size()), jobsInOrder(jobs.size()), current(NULL), stopping(false) {
+    for (std::vector<BgzfJob>::size_type i = 0; i != jobs.size(); i++) freeJobs.push(&jobs[i]);
+    reader = std::thread(&BgzfReadAhead::readBlocks, this);
+    for (int i = 0; i != nThreads; i++) inflaters.push_back(std::thread(&BgzfReadAhead::inflateBlocks, this));
+}
+
+BgzfReadAhead::~BgzfReadAhead() {
+    stopping = true; freeJobs.close(); // Stops the reader, which then stops the inflaters
+    reader.join();
+    for (std::vector<std::thread>::size_type i = 0; i != inflaters.size(); i++) inflaters[i].join();
+}
+
+// Appends the next block of the file to the job
+bool BgzfReadAhead::readBlock(BgzfJob* job) {
+    size_t blockStart = job->compressed.size();
+    job->compressed.resize(blockStart + BGZF_HEADER_LENGTH);
+    size_t n = fread(&job->compressed[blockStart], 1, BGZF_HEADER_LENGTH, file);
+    if (n == 0) { job->compressed.resize(blockStart); return false; }
+    if (n != BGZF_HEADER_LENGTH) bgzfFail(filename, "the file is truncated");
+    int extraLength = readUint16(&job->compressed[blockStart + 10]);
+    job->compressed.resize(blockStart + BGZF_HEADER_LENGTH + extraLength);
+    if (fread(&job->compressed[blockStart + BGZF_HEADER_LENGTH], 1, extraLength, file) != (size_t)extraLength) bgzfFail(filename, "the file is truncated");
+    int blockSize = bgzfBlockSize(&job->compressed[blockStart], &job->compressed[blockStart + BGZF_HEADER_LENGTH], extraLength);
+    if (blockSize == -1) bgzfFail(filename, "not a BGZF block (was the file compressed with bgzip?)");
+    if (blockSize < BGZF_HEADER_LENGTH + extraLength + BGZF_FOOTER_LENGTH) bgzfFail(filename, "a damaged BGZF block");
+    size_t rest = blockSize - BGZF_HEADER_LENGTH - extraLength;
+    job->compressed.resize(blockStart + blockSize);
+    if (fread(&job->compressed[blockStart + BGZF_HEADER_LENGTH + extraLength], 1, rest, file) != rest) bgzfFail(filename, "the file is truncated");
+    job->blockStarts.push_back(job->compressed.size());
+    return true;
+}
+
+void BgzfReadAhead::readBlocks() {
+    BgzfJob* job;
+    while (!stopping && freeJobs.pop(job)) {
+        job->compressed.clear(); job->blockStarts.assign(1, 0); job->done = false; job->failed = false;
+        job->fileOffset = (uint64_t)ftello(file);
+        for (int b = 0; b != BGZF_BLOCKS_PER_JOB && !stopping; b++) {
+            if (!readBlock(job)) break;
+        }
+        if (job->blockStarts.size() == 1) break; // The end of the file
+        jobsToInflate.push(job); jobsInOrder.push(job);
+    }
+    jobsToInflate.close(); jobsInOrder.close();
+}
+
+void BgzfReadAhead::inflateBlocks() {
+    z_stream zs; memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -15) != Z_OK) bgzfFail(filename, "could not initialise zlib"); // Raw deflate; the gzip headers are parsed above
+    BgzfJob* job;
+    while (jobsToInflate.pop(job)) {
+        size_t nBlocks = stopping ? 0 : job->blockStarts.size() - 1; size_t inflatedSize = 0; bool ok = true;
+        for (size_t b = 0; b != nBlocks && ok; b++) {
+            ok = (inflatedBlockSize(job, b) <= BGZF_MAX_BLOCK_SIZE); // A larger ISIZE can only come from a damaged block
+            inflatedSize += inflatedBlockSize(job, b);
+        }
+        job->inflated.resize(ok ? inflatedSize : 0);
+        size_t outOffset = 0; unsigned char emptyOut; // zlib refuses a NULL output, which is what inflated holds when all the blocks are empty
+        for (size_t b = 0; b != nBlocks && ok; b++) {
+            const unsigned char* block = &job->compressed[job->blockStarts[b]];
+            size_t blockSize = job->blockStarts[b+1] - job->blockStarts[b];
+            int dataStart = BGZF_HEADER_LENGTH + readUint16(block + 10);
+            uint32_t expectedCRC = readUint32(block + blockSize - 8); uint32_t expectedSize = readUint32(block + blockSize - 4);
+            inflateReset(&zs);
+            zs.next_in = (Bytef*)(block + dataStart); zs.avail_in = (uInt)(blockSize - dataStart - BGZF_FOOTER_LENGTH);
+            zs.next_out = (expectedSize == 0) ? (Bytef*)&emptyOut : (Bytef*)(job->inflated.data() + outOffset); zs.avail_out = expectedSize;
+            int ret = inflate(&zs, Z_FINISH);
+            ok = (ret == Z_STREAM_END && zs.avail_out == 0 && crc32(crc32(0L, Z_NULL, 0), (const Bytef*)(job->inflated.data() + outOffset), expectedSize) == expectedCRC);
+            outOffset += expectedSize;
+        }
+        std::lock_guard<std::mutex> lock(job->m);
+        job->failed = !ok; job->done = true;
+        job->inflatedCondition.notify_one();
+    }
+    inflateEnd(&zs);
+}
+
+size_t BgzfReadAhead::inflatedBlockSize(const BgzfJob* job, size_t b) {
+    return readUint32(&job->compressed[job->blockStarts[b+1] - 4]); // ISIZE at the end of the block
+}
+
+BgzfJob* BgzfReadAhead::next() {
+    if (current != NULL) { freeJobs.push(current); current = NULL; }
+    if (!jobsInOrder.pop(current)) return NULL;
+    std::unique_lock<std::mutex> lock(current->m);
+    current->inflatedCondition.wait(lock, [this]{ return current->done; });
+    if (current->failed) bgzfFail(filename, "a damaged BGZF block");
+    return current;
+}
+
+BgzfStreambuf::BgzfStreambuf(const std::string& filename, int nThreads) : filename(filename), nThreads(std::max(nThreads, 1)), readAhead(NULL), currentJob(NULL), skipInFirstBlock(0) {
+    setg(NULL, NULL, NULL);
+    file = fopen(filename.c_str(), "rb");
+    if (file == NULL) return;
+    readAhead = new BgzfReadAhead(file, this->filename, this->nThreads);
+}
+
+BgzfStreambuf::~BgzfStreambuf() {
+    if (file == NULL) return;
+    delete readAhead;
+    fclose(file);
+}
+
+bool BgzfStreambuf::seekVirtual(uint64_t virtualOffset) {
+    if (file == NULL) return false;
+    delete readAhead; readAhead = NULL; currentJob = NULL;
+    setg(NULL, NULL, NULL);
+    if (fseeko(file, (off_t)(virtualOffset >> 16), SEEK_SET) != 0) return false;
+    skipInFirstBlock = (size_t)(virtualOffset & 0xFFFF);
+    readAhead = new BgzfReadAhead(file, filename, nThreads);
+    return true;
+}
+
+BgzfStreambuf::int_type BgzfStreambuf::underflow() {
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    if (readAhead == NULL) return traits_type::eof();
+    BgzfJob* job;
+    while ((job = readAhead->next()) != NULL) {
+        size_t skip = std::min(skipInFirstBlock, job->inflated.size()); skipInFirstBlock = 0;
+        if (job->inflated.size() == skip) continue; // e.g. the empty block at the end of a BGZF file
+        char* begin = job->inflated.data();
+        setg(begin, begin + skip, begin + job->inflated.size()); currentJob = job;
+        return traits_type::to_int_type(*gptr());
+    }
+    setg(NULL, NULL, NULL); currentJob = NULL;
+    return traits_type::eof();
+}
+
+bool BgzfStreambuf::tellVirtual(uint64_t& virtualOffset) const {
+    if (currentJob == NULL || gptr() == NULL) return false;
+    size_t offset = gptr() - eback();
+    for (size_t b = 0; b + 1 < currentJob->blockStarts.size(); b++) {
+        size_t blockSize = BgzfReadAhead::inflatedBlockSize(currentJob, b);
+        if (offset < blockSize) {
+            virtualOffset = ((currentJob->fileOffset + currentJob->blockStarts[b]) << 16) | (uint64_t)offset;
+            return true;
+        }
+        offset -= blockSize;
+    }
+    virtualOffset = (currentJob->fileOffset + currentJob->blockStarts.back()) << 16; // All read: the start of the next block
+    return true;
+}
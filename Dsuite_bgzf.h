@@ -0,0 +1,105 @@
+//
+//  Dsuite_bgzf.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dsuite_bgzf_h
+#define Dsuite_bgzf_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "Dsuite_pipeline.h"
+
+// How many BGZF blocks (each at most 64kb once inflated) are inflated together by one thread
+static const int BGZF_BLOCKS_PER_JOB = 64;
+// The most data a BGZF block can hold once inflated
+static const size_t BGZF_MAX_BLOCK_SIZE = 65536;
+// The most threads used to inflate one file
+static const int BGZF_MAX_INFLATE_THREADS = 4;
+
+// A group of consecutive BGZF blocks: read by one thread, inflated by another, then handed to the stream
+struct BgzfJob {
+    std::vector<unsigned char> compressed; // The blocks back to back, exactly as in the file
+    std::vector<size_t> blockStarts; // Where each block starts in compressed; with the end of the last one at the back
+    uint64_t fileOffset; // Where the first block starts in the file
+    std::vector<char> inflated;
+    bool done; bool failed;
+    std::mutex m; std::condition_variable inflatedCondition;
+};
+
+// The threads reading and inflating a BGZF file from a given block onwards
+class BgzfReadAhead {
+public:
+    BgzfReadAhead(FILE* file, const std::string& filename, int nThreads);
+    ~BgzfReadAhead();
+    
+    BgzfJob* next(); // The next inflated job in the order of the file (NULL at the end); it is recycled at the following call
+    static size_t inflatedBlockSize(const BgzfJob* job, size_t b); // The inflated size of the b-th block in the job
+
+private:
+    FILE* file;
+    const std::string& filename;
+    std::vector<BgzfJob> jobs;
+    BoundedQueue<BgzfJob*> freeJobs; // Ready to be filled by the reading thread
+    BoundedQueue<BgzfJob*> jobsToInflate;
+    BoundedQueue<BgzfJob*> jobsInOrder; // The jobs in the order of the file, for next()
+    BgzfJob* current;
+    std::atomic<bool> stopping; // Set when the stream seeks elsewhere or is closed
+    std::thread reader;
+    std::vector<std::thread> inflaters;
+    
+    void readBlocks();
+    void inflateBlocks();
+    bool readBlock(BgzfJob* job); // false at the end of the file
+};
+
+// Reads a BGZF file (as made by bgzip), with the blocks inflated in parallel on several threads ahead of the reader
+class BgzfStreambuf : public std::streambuf {
+public:
+    BgzfStreambuf(const std::string& filename, int nThreads);
+    ~BgzfStreambuf();
+    bool is_open() const { return file != NULL; }
+    
+    // Continue reading from a virtual file offset, as used in tabix and CSI indexes:
+    // the offset of a block in the file << 16 | the offset within the inflated block
+    bool seekVirtual(uint64_t virtualOffset);
+    // The virtual offset of the next character to be read; false if it isn't known (e.g. nothing has been read yet)
+    bool tellVirtual(uint64_t& virtualOffset) const;
+
+protected:
+    virtual int_type underflow();
+
+private:
+    std::string filename;
+    FILE* file;
+    int nThreads;
+    BgzfReadAhead* readAhead;
+    BgzfJob* currentJob; // The blocks in the get area
+    size_t skipInFirstBlock; // After a seek, how many inflated bytes to skip
+};
+
+class ibgzfstream : public std::istream {
+public:
+    ibgzfstream(const std::string& filename, int nThreads) : std::istream(&buf), buf(filename, nThreads) {
+        if (!buf.is_open()) setstate(std::ios::badbit);
+    }
+    bool seekVirtual(uint64_t virtualOffset) { clear(); return buf.seekVirtual(virtualOffset); }
+    bool tellVirtual(uint64_t& virtualOffset) const { return buf.tellVirtual(virtualOffset); }
+private:
+    BgzfStreambuf buf;
+};
+
+// Checks the header of the first block; plain gzip files are not BGZF
+bool isBgzf(const std::string& filename);
+
+// Inflates a whole (small) BGZF file into memory, e.g. a tabix index; false if it can't be read
+bool readWholeBgzf(const std::string& filename, std::vector<char>& contents);
+
+#endif /* Dsuite_bgzf_h */
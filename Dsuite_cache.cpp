@@ -0,0 +1,301 @@
+//
+//  Dsuite_cache.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#include "Dsuite_cache.h"
+#include "Dsuite_pipeline.h"
+#include "Dsuite_bcf.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#define SUBPROGRAM "cache"
+
+static const uint32_t GENOTYPE_CACHE_VERSION = 1;
+
+static const char *CACHE_USAGE_MESSAGE =
+"Usage: " PROGRAM_BIN " " SUBPROGRAM " [OPTIONS] INPUT_FILE.vcf OUTPUT_FILE" GENOTYPE_CACHE_EXT "\n"
+"Convert a VCF (or BCF) file into a compact binary genotype cache, which Dtrios and Dinvestigate can then read in place of the VCF\n"
+"Only biallelic SNPs are kept; the genotypes are packed into two bits per allele, with the chromosomes and positions stored alongside\n"
+"Useful when the same VCF is going to be analysed many times (e.g. with different SETS files or jackknife block sizes)\n"
+"\n"
+"       -h, --help                              display this help and exit\n"
+"\n"
+"\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
+
+static const char* shortopts = "h";
+
+static const struct option longopts[] = {
+    { "help",   no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+namespace opt
+{
+    static string vcfFile;
+    static string cacheFile;
+}
+
+static uint64_t roundUpTo8(uint64_t n) { return (n + 7) & ~(uint64_t)7; }
+
+bool isGenotypeCache(const std::string& filename) {
+    size_t extLength = sizeof(GENOTYPE_CACHE_EXT) - 1;
+    return filename.length() >= extLength && filename.compare(filename.length() - extLength, extLength, GENOTYPE_CACHE_EXT) == 0;
+}
+
+GenotypeCache::GenotypeCache(const std::string& filename) : data(NULL), dataSize(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) { std::cerr << "Error: could not open " << filename << " for read" << std::endl; exit(EXIT_FAILURE); }
+    dataSize = (size_t)st.st_size;
+    if (dataSize < sizeof(GenotypeCacheHeader)) { std::cerr << "Error: " << filename << " is not a genotype cache made by " PROGRAM_BIN " " SUBPROGRAM << std::endl; exit(EXIT_FAILURE); }
+    void* mapped = mmap(NULL, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) { std::cerr << "Error: could not map " << filename << " into memory" << std::endl; exit(EXIT_FAILURE); }
+    data = (const unsigned char*)mapped;
+    madvise(mapped, dataSize, MADV_SEQUENTIAL);
+
+    GenotypeCacheHeader header; memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, "DSGT", 4) != 0 || header.version != GENOTYPE_CACHE_VERSION) {
+        std::cerr << "Error: " << filename << " is not a genotype cache made by this version of " PROGRAM_BIN " " SUBPROGRAM << std::endl; exit(EXIT_FAILURE);
+    }
+    nSites = header.nSites; nVariantLines = header.nVariantLines;
+    recordSize = header.recordSize; firstRecordOffset = header.firstRecordOffset; flags = header.flags;
+    if (recordSize != roundUpTo8(16 + header.genotypeBytes) || header.genotypeBytes != PackedGenotypes::bytesNeeded(header.nSamples)
+        || header.chromTableOffset != firstRecordOffset + nSites * recordSize || header.chromTableOffset + 4 > dataSize) {
+        std::cerr << "Error: the genotype cache " << filename << " is truncated or damaged" << std::endl; exit(EXIT_FAILURE);
+    }
+
+    const char* name = (const char*)data + sizeof(GenotypeCacheHeader);
+    for (uint32_t i = 0; i != header.nSamples; i++) { sampleNames.push_back(string(name)); name += sampleNames.back().length() + 1; }
+    uint32_t nChroms; memcpy(&nChroms, data + header.chromTableOffset, 4);
+    name = (const char*)data + header.chromTableOffset + 4;
+    for (uint32_t i = 0; i != nChroms; i++) { chromNames.push_back(string(name)); name += chromNames.back().length() + 1; }
+}
+
+GenotypeCache::~GenotypeCache() {
+    if (data != NULL) munmap((void*)data, dataSize);
+}
+
+uint64_t GenotypeCache::firstSiteFromVariant(int64_t variantNumber) const {
+    uint64_t from = 0; uint64_t to = nSites;
+    while (from < to) { // The variant numbers increase from site to site
+        uint64_t mid = from + (to - from) / 2;
+        if (this->variantNumber(mid) < variantNumber) from = mid + 1; else to = mid;
+    }
+    return from;
+}
+
+std::vector<std::pair<uint64_t, uint64_t> > GenotypeCache::sitesInRegions(const std::vector<GenomicRegion>& regions) const {
+    std::vector<GenomicRegion> normalised = normaliseRegions(regions);
+    sortRegionsByContigs(normalised, chromNames); // The ranges are read in turn, so they need to be in the order of the sites
+    std::vector<std::pair<uint64_t, uint64_t> > ranges;
+    std::map<string, int> chromIDs;
+    for (std::vector<string>::size_type i = 0; i != chromNames.size(); i++) chromIDs[chromNames[i]] = (int)i;
+    if (flags & GENOTYPE_CACHE_SORTED) { // Binary searches for (chromosome, position)
+        for (std::vector<GenomicRegion>::size_type r = 0; r != normalised.size(); r++) {
+            std::map<string, int>::iterator it = chromIDs.find(normalised[r].chrom);
+            if (it == chromIDs.end()) continue;
+            uint64_t range[2];
+            for (int k = 0; k != 2; k++) {
+                std::pair<int, int64_t> target(it->second, (k == 0) ? (int64_t)normalised[r].start : (int64_t)normalised[r].end + 1);
+                uint64_t from = 0; uint64_t to = nSites;
+                while (from < to) {
+                    uint64_t mid = from + (to - from) / 2;
+                    if (std::make_pair(chrom(mid), (int64_t)pos(mid)) < target) from = mid + 1; else to = mid;
+                }
+                range[k] = from;
+            }
+            if (range[1] > range[0]) ranges.push_back(std::make_pair(range[0], range[1]));
+        }
+    } else { // Check every site
+        std::vector<std::vector<std::pair<int, int> > > regionsByChrom(chromNames.size());
+        for (std::vector<GenomicRegion>::size_type r = 0; r != normalised.size(); r++) {
+            std::map<string, int>::iterator it = chromIDs.find(normalised[r].chrom);
+            if (it != chromIDs.end()) regionsByChrom[it->second].push_back(std::make_pair(normalised[r].start, normalised[r].end));
+        }
+        for (uint64_t site = 0; site != nSites; site++) {
+            const std::vector<std::pair<int, int> >& intervals = regionsByChrom[chrom(site)];
+            std::vector<std::pair<int, int> >::const_iterator interval = std::upper_bound(intervals.begin(), intervals.end(), std::make_pair(pos(site), INT_MAX));
+            if (interval == intervals.begin() || pos(site) > (--interval)->second) continue;
+            if (!ranges.empty() && ranges.back().second == site) ranges.back().second++;
+            else ranges.push_back(std::make_pair(site, site + 1));
+        }
+    }
+    return ranges;
+}
+
+// A batch of VCF lines on their way to the cache
+struct CacheLineBatch {
+    std::vector<string> lines; int nLines;
+    std::vector<int64_t> variantNumbers;
+    LineTokenizer fields; // Reused for every line in the batch
+    std::vector<unsigned char> records; // One record for each line; the chromosome ID is filled in when writing
+    std::vector<bool> isSNP;
+    std::vector<string> chrs;
+};
+
+int cacheMain(int argc, char** argv) {
+    parseCacheOptions(argc, argv);
+    string line; // for reading the input files
+
+    std::istream* vcfFile = NULL; BcfFile* bcfFile = NULL;
+    std::vector<std::string> sampleNames;
+    if (isBcf(opt::vcfFile)) { bcfFile = new BcfFile(opt::vcfFile); sampleNames = bcfFile->sampleNames; }
+    else vcfFile = createReader(opt::vcfFile.c_str());
+    while (vcfFile != NULL && getline(*vcfFile, line)) {
+        line.erase(std::remove(line.begin(), line.end(), '\r'), line.end()); // Deal with any left over \r from files prepared on Windows
+        if (line[0] == '#' && line[1] == '#')
+            continue;
+        else if (line[0] == '#' && line[1] == 'C') {
+            std::vector<std::string> fields = split(line, '\t');
+            sampleNames.assign(fields.begin()+NUM_NON_GENOTYPE_COLUMNS,fields.end());
+            break;
+        }
+    }
+    if (sampleNames.empty()) { std::cerr << "Could not find any samples in the header of " << opt::vcfFile << std::endl; exit(EXIT_FAILURE); }
+
+    std::ofstream* outFile = new std::ofstream(opt::cacheFile.c_str(), std::ios_base::out | std::ios_base::binary);
+    if (!outFile->good()) { std::cerr << "Error: could not open " << opt::cacheFile << " for write" << std::endl; exit(EXIT_FAILURE); }
+
+    GenotypeCacheHeader header; memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "DSGT", 4); header.version = GENOTYPE_CACHE_VERSION;
+    header.nSamples = (uint32_t)sampleNames.size(); header.genotypeBytes = (uint32_t)PackedGenotypes::bytesNeeded(sampleNames.size());
+    header.recordSize = roundUpTo8(16 + header.genotypeBytes);
+    outFile->write((const char*)&header, sizeof(header)); // Written again with the counts at the end
+    uint64_t offset = sizeof(header);
+    for (std::vector<std::string>::size_type i = 0; i != sampleNames.size(); i++) {
+        outFile->write(sampleNames[i].c_str(), sampleNames[i].length() + 1); offset += sampleNames[i].length() + 1;
+    }
+    static const char padding[8] = {0};
+    outFile->write(padding, roundUpTo8(offset) - offset); header.firstRecordOffset = roundUpTo8(offset);
+
+    // Pipeline stage 1: read the variant lines in batches
+    bool doneReading = false; int64_t nVariantLines = 0;
+    clock_t start = clock();
+    std::function<bool(CacheLineBatch&)> readLines = [&](CacheLineBatch& b) -> bool {
+        b.nLines = 0; size_t nBytes = 0;
+        while (!doneReading && b.nLines < VCF_LINES_PER_BATCH && nBytes < VCF_BYTES_PER_BATCH) {
+            if (b.nLines == (int)b.lines.size()) { b.lines.resize(b.nLines + 1); b.variantNumbers.resize(b.nLines + 1); }
+            string& thisLine = b.lines[b.nLines];
+            bool gotLine = (bcfFile != NULL) ? bcfFile->getNextRecord(thisLine) : (bool)getline(*vcfFile, thisLine);
+            if (!gotLine) { doneReading = true; break; }
+            if (bcfFile == NULL && (thisLine.empty() || thisLine[0] == '#')) continue;
+            nVariantLines++;
+            if (nVariantLines % 100000 == 0) {
+                double durationOverall = ( clock() - start ) / (double) CLOCKS_PER_SEC;
+                std::cerr << "Processed " << nVariantLines << " variants in " << durationOverall << "secs" << std::endl;
+            }
+            b.variantNumbers[b.nLines] = nVariantLines;
+            nBytes += thisLine.length(); b.nLines++;
+        }
+        return b.nLines > 0;
+    };
+
+    // Pipeline stage 2: pack the genotypes of the biallelic SNPs
+    std::function<void(CacheLineBatch&)> packLines = [&](CacheLineBatch& b) {
+        b.records.resize((size_t)b.nLines * header.recordSize); b.isSNP.assign(b.nLines, false); b.chrs.resize(b.nLines);
+        for (int l = 0; l != b.nLines; l++) {
+            unsigned char* record = &b.records[(size_t)l * header.recordSize];
+            uint32_t pos; uint64_t variantNumber = (uint64_t)b.variantNumbers[l];
+            if (bcfFile != NULL) {
+                BcfRecord bcfRecord(b.lines[l], *bcfFile);
+                if (!bcfRecord.isBiallelicSNP()) continue; // Only biallelic SNPs are used in the calculations
+                memset(record, 0, header.recordSize);
+                pos = (uint32_t)bcfRecord.pos;
+                PackedGenotypes::pack(bcfRecord.genotypes(), sampleNames.size(), record + 16);
+                b.chrs[l] = bcfFile->contigName(bcfRecord.chromID);
+            } else {
+                b.fields.tokenize(b.lines[l]);
+                if (!isBiallelicSNP(b.fields)) continue; // Only biallelic SNPs are used in the calculations
+                memset(record, 0, header.recordSize);
+                pos = (uint32_t)strtoul(b.fields.field(1), NULL, 10);
+                PackedGenotypes::pack(b.fields, sampleNames.size(), record + 16);
+                b.fields.assignField(0, b.chrs[l]);
+            }
+            memcpy(record + 4, &pos, 4); memcpy(record + 8, &variantNumber, 8);
+            b.isSNP[l] = true;
+        }
+    };
+
+    // Pipeline stage 3: number the chromosomes and write the records, in the order of the VCF
+    std::map<string, uint32_t> chromIDs; std::vector<string> chromNames;
+    string lastChrom = ""; uint32_t lastChromID = 0; uint32_t lastPos = 0; bool sorted = true;
+    std::function<void(CacheLineBatch&)> writeRecords = [&](CacheLineBatch& b) {
+        for (int l = 0; l != b.nLines; l++) {
+            if (!b.isSNP[l]) continue;
+            if (chromNames.empty() || b.chrs[l] != lastChrom) {
+                std::map<string, uint32_t>::iterator it = chromIDs.find(b.chrs[l]);
+                if (it == chromIDs.end()) {
+                    it = chromIDs.insert(std::make_pair(b.chrs[l], (uint32_t)chromNames.size())).first;
+                    chromNames.push_back(b.chrs[l]);
+                } else {
+                    sorted = false; // This chromosome came up before
+                }
+                lastChrom = b.chrs[l]; lastChromID = it->second; lastPos = 0;
+            }
+            unsigned char* record = &b.records[(size_t)l * header.recordSize];
+            memcpy(record, &lastChromID, 4);
+            uint32_t pos; memcpy(&pos, record + 4, 4);
+            if (pos < lastPos) sorted = false;
+            lastPos = pos;
+            outFile->write((const char*)record, header.recordSize);
+            header.nSites++;
+        }
+    };
+
+    runBatchPipeline<CacheLineBatch>(1, readLines, packLines, writeRecords);
+
+    header.chromTableOffset = header.firstRecordOffset + header.nSites * header.recordSize;
+    header.nVariantLines = (uint64_t)nVariantLines;
+    if (sorted) header.flags |= GENOTYPE_CACHE_SORTED;
+    uint32_t nChroms = (uint32_t)chromNames.size(); outFile->write((const char*)&nChroms, 4);
+    for (std::vector<std::string>::size_type i = 0; i != chromNames.size(); i++) outFile->write(chromNames[i].c_str(), chromNames[i].length() + 1);
+    outFile->seekp(0); outFile->write((const char*)&header, sizeof(header));
+    outFile->close();
+    if (outFile->fail()) { std::cerr << "Error: could not write " << opt::cacheFile << std::endl; exit(EXIT_FAILURE); }
+    std::cerr << "Stored " << header.nSites << " biallelic SNPs out of " << nVariantLines << " variants for " << sampleNames.size() << " samples in " << opt::cacheFile << std::endl;
+    return 0;
+}
+
+void parseCacheOptions(int argc, char** argv) {
+    bool die = false;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;)
+    {
+        switch (c)
+        {
+            case '?': die = true; break;
+            case 'h':
+                std::cout << CACHE_USAGE_MESSAGE;
+                exit(EXIT_SUCCESS);
+        }
+    }
+
+    if (argc - optind < 2) {
+        std::cerr << "missing arguments\n";
+        die = true;
+    }
+    else if (argc - optind > 2)
+    {
+        std::cerr << "too many arguments\n";
+        die = true;
+    }
+
+    if (die) {
+        std::cout << "\n" << CACHE_USAGE_MESSAGE;
+        exit(EXIT_FAILURE);
+    }
+
+    // Parse the input filenames
+    opt::vcfFile = argv[optind++];
+    opt::cacheFile = argv[optind++];
+    if (!isGenotypeCache(opt::cacheFile)) {
+        std::cerr << "The output file name should end with " GENOTYPE_CACHE_EXT "\n";
+        exit(EXIT_FAILURE);
+    }
+}
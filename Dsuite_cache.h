@@ -0,0 +1,71 @@
+//
+//  Dsuite_cache.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dsuite_cache_h
+#define Dsuite_cache_h
+
+#include "Dsuite_utils.h"
+#include "Dsuite_regions.h"
+#include <stdint.h>
+
+#define GENOTYPE_CACHE_EXT ".dsgt"
+
+// A genotype cache (.dsgt) made by "Dsuite cache": the biallelic SNPs of a VCF with the genotypes packed into two bits per allele
+// Layout (little-endian, as written by the machine that made it):
+//   a 64 byte header (see GenotypeCacheHeader), the sample names (each terminated by '\0', padded to a multiple of 8 bytes),
+//   nSites records of recordSize bytes: uint32 chromosome ID, uint32 position, uint64 variant number in the VCF (counting from 1,
+//   all variant lines included), then the packed genotypes (see PackedGenotypes), padded to a multiple of 8 bytes,
+//   and at the end the chromosome names: uint32 count, then the names, each terminated by '\0'
+struct GenotypeCacheHeader {
+    char magic[4]; // "DSGT"
+    uint32_t version;
+    uint32_t nSamples;
+    uint32_t genotypeBytes; // Bytes of packed genotypes in each record
+    uint64_t nSites;
+    uint64_t recordSize;
+    uint64_t firstRecordOffset;
+    uint64_t chromTableOffset;
+    uint64_t nVariantLines; // All the variant lines in the VCF, not only the biallelic SNPs
+    uint64_t flags; // GENOTYPE_CACHE_SORTED
+};
+static const uint64_t GENOTYPE_CACHE_SORTED = 1; // Each chromosome in one run of sites, with the positions in order
+
+// Read-only access to a genotype cache through mmap
+class GenotypeCache {
+public:
+    GenotypeCache(const std::string& filename); // Exits with an error message if the file can't be used
+    ~GenotypeCache();
+
+    std::vector<string> sampleNames;
+    std::vector<string> chromNames;
+    uint64_t nSites;
+    uint64_t nVariantLines;
+
+    int chrom(uint64_t site) const { return (int)*(const uint32_t*)(record(site)); }
+    int pos(uint64_t site) const { return (int)*(const uint32_t*)(record(site) + 4); }
+    int64_t variantNumber(uint64_t site) const { return (int64_t)*(const uint64_t*)(record(site) + 8); }
+    const unsigned char* genotypes(uint64_t site) const { return record(site) + 16; }
+
+    uint64_t firstSiteFromVariant(int64_t variantNumber) const; // The first site with at least this variant number
+    // The [first, last) ranges of sites in the regions; in the order of the regions if the cache is sorted, otherwise in the order of the file
+    std::vector<std::pair<uint64_t, uint64_t> > sitesInRegions(const std::vector<GenomicRegion>& regions) const;
+
+private:
+    const unsigned char* data;
+    size_t dataSize;
+    uint64_t recordSize;
+    uint64_t firstRecordOffset;
+    uint64_t flags;
+    const unsigned char* record(uint64_t site) const { return data + firstRecordOffset + site * recordSize; }
+};
+
+bool isGenotypeCache(const std::string& filename);
+
+int cacheMain(int argc, char** argv);
+void parseCacheOptions(int argc, char** argv);
+
+#endif /* Dsuite_cache_h */
@@ -0,0 +1,198 @@
+//
+//  Dsuite_index.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#include "Dsuite_index.h"
+#include "Dsuite_bgzf.h"
+#include "Dsuite_bcf.h"
+#include <sys/stat.h>
+#include <string.h>
+
+#define SUBPROGRAM "index"
+
+static const uint32_t ORDINAL_INDEX_VERSION = 1;
+
+static const char *INDEX_USAGE_MESSAGE =
+"Usage: " PROGRAM_BIN " " SUBPROGRAM " [OPTIONS] INPUT_FILE.vcf\n"
+"Make an index of the variant line numbers in a VCF file (INPUT_FILE.vcf" ORDINAL_INDEX_EXT "), which lets Dtrios --region=start,length\n"
+"start reading straight at the subset instead of going through all the variants before it\n"
+"The VCF should be uncompressed or compressed with bgzip (a plain gzip file can't be read from the middle)\n"
+"\n"
+"       -h, --help                              display this help and exit\n"
+"       -i, --interval=N                        (default=10000) index every N-th variant line\n"
+"\n"
+"\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
+
+static const char* shortopts = "hi:";
+
+static const struct option longopts[] = {
+    { "interval",   required_argument, NULL, 'i' },
+    { "help",   no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+namespace opt
+{
+    static string vcfFile;
+    static int interval = 10000;
+}
+
+// Finds the starts of the variant lines (not empty and not starting with #) as the file goes by
+class VariantLineScanner {
+public:
+    VariantLineScanner(uint32_t interval) : interval(interval), atLineStart(true), nVariantLines(0) {};
+    uint32_t interval; bool atLineStart;
+    uint64_t nVariantLines;
+    std::vector<uint64_t> entries;
+
+    // Offset(j) gives the offset to store for the j-th byte of the data
+    template <typename Offset> void scan(const char* data, size_t n, Offset offset) {
+        for (size_t j = 0; j < n;) {
+            if (atLineStart) {
+                if (data[j] != '\n' && data[j] != '#') {
+                    if (nVariantLines % interval == 0) entries.push_back(offset(j));
+                    nVariantLines++;
+                }
+                atLineStart = false;
+            }
+            const char* lineEnd = (const char*)memchr(data + j, '\n', n - j);
+            if (lineEnd == NULL) break;
+            j = lineEnd - data + 1; atLineStart = true;
+        }
+    }
+};
+
+static bool getFileStats(const string& filename, uint64_t& size, uint64_t& modified) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) return false;
+    size = (uint64_t)st.st_size; modified = (uint64_t)st.st_mtime;
+    return true;
+}
+
+int64_t seekToVariant(std::istream* vcfFile, const string& vcfFileName, int64_t variantNumber) {
+    string indexFileName = vcfFileName + ORDINAL_INDEX_EXT;
+    FILE* f = fopen(indexFileName.c_str(), "rb");
+    if (f == NULL) return 0;
+    OrdinalIndexHeader header; uint64_t vcfSize, vcfModified;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, "DSIX", 4) != 0 || header.version != ORDINAL_INDEX_VERSION || header.interval == 0) {
+        std::cerr << "Warning: " << indexFileName << " is not an index made by this version of " PROGRAM_BIN " " SUBPROGRAM "; reading from the start" << std::endl;
+        fclose(f); return 0;
+    }
+    if (!getFileStats(vcfFileName, vcfSize, vcfModified) || vcfSize != header.vcfSize || vcfModified != header.vcfModified) {
+        std::cerr << "Warning: " << vcfFileName << " has changed since " << indexFileName << " was made; reading from the start" << std::endl;
+        fclose(f); return 0;
+    }
+    if (variantNumber <= 1 || header.nEntries == 0) { fclose(f); return 0; }
+    uint64_t entry = std::min((uint64_t)(variantNumber - 1) / header.interval, header.nEntries - 1);
+    if (entry == 0) { fclose(f); return 0; }
+    uint64_t offset; bool ok = (fseeko(f, (off_t)(sizeof(header) + entry * sizeof(uint64_t)), SEEK_SET) == 0 && fread(&offset, sizeof(offset), 1, f) == 1);
+    fclose(f);
+    if (!ok) { std::cerr << "Warning: " << indexFileName << " is truncated; reading from the start" << std::endl; return 0; }
+
+    if (header.flags & ORDINAL_INDEX_BGZF) {
+        ibgzfstream* bgzfFile = dynamic_cast<ibgzfstream*>(vcfFile);
+        if (bgzfFile == NULL || !bgzfFile->seekVirtual(offset)) return 0;
+    } else {
+        std::ifstream* plainFile = dynamic_cast<std::ifstream*>(vcfFile);
+        if (plainFile == NULL || !plainFile->seekg((std::streamoff)offset)) return 0;
+    }
+    int64_t skipped = (int64_t)(entry * header.interval);
+    std::cerr << "Using the index " << indexFileName << " to skip the first " << skipped << " variants" << std::endl;
+    return skipped;
+}
+
+int indexMain(int argc, char** argv) {
+    parseIndexOptions(argc, argv);
+    OrdinalIndexHeader header; memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "DSIX", 4); header.version = ORDINAL_INDEX_VERSION; header.interval = (uint32_t)opt::interval;
+    if (!getFileStats(opt::vcfFile, header.vcfSize, header.vcfModified)) {
+        std::cerr << "Error: could not open " << opt::vcfFile << std::endl; exit(EXIT_FAILURE);
+    }
+    VariantLineScanner scanner(header.interval);
+    if (isBcf(opt::vcfFile)) {
+        std::cerr << "Error: " << opt::vcfFile << " is a BCF file; only VCF files can be indexed" << std::endl;
+        exit(EXIT_FAILURE);
+    } else if (isBgzf(opt::vcfFile)) {
+        header.flags |= ORDINAL_INDEX_BGZF;
+        FILE* file = fopen(opt::vcfFile.c_str(), "rb");
+        if (file == NULL) { std::cerr << "Error: could not open " << opt::vcfFile << std::endl; exit(EXIT_FAILURE); }
+        int nThreads = std::max(1, std::min(BGZF_MAX_INFLATE_THREADS, (int)std::thread::hardware_concurrency()));
+        BgzfReadAhead* readAhead = new BgzfReadAhead(file, opt::vcfFile, nThreads);
+        BgzfJob* job;
+        while ((job = readAhead->next()) != NULL) {
+            size_t inflatedOffset = 0;
+            for (size_t b = 0; b + 1 < job->blockStarts.size(); b++) {
+                uint64_t blockOffset = job->fileOffset + job->blockStarts[b];
+                size_t blockSize = BgzfReadAhead::inflatedBlockSize(job, b);
+                scanner.scan(job->inflated.data() + inflatedOffset, blockSize, [blockOffset](size_t j) { return (blockOffset << 16) | (uint64_t)j; });
+                inflatedOffset += blockSize;
+            }
+        }
+        delete readAhead;
+        fclose(file);
+    } else if (isGzip(opt::vcfFile)) {
+        std::cerr << "Error: " << opt::vcfFile << " is compressed with gzip, which can't be read from the middle; please compress it with bgzip instead" << std::endl;
+        exit(EXIT_FAILURE);
+    } else {
+        FILE* file = fopen(opt::vcfFile.c_str(), "rb");
+        if (file == NULL) { std::cerr << "Error: could not open " << opt::vcfFile << std::endl; exit(EXIT_FAILURE); }
+        std::vector<char> buffer(1 << 20); uint64_t bufferOffset = 0; size_t n;
+        while ((n = fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+            scanner.scan(buffer.data(), n, [bufferOffset](size_t j) { return bufferOffset + j; });
+            bufferOffset += n;
+        }
+        fclose(file);
+    }
+    header.nVariantLines = scanner.nVariantLines; header.nEntries = scanner.entries.size();
+
+    string indexFileName = opt::vcfFile + ORDINAL_INDEX_EXT;
+    std::ofstream* outFile = new std::ofstream(indexFileName.c_str(), std::ios_base::out | std::ios_base::binary);
+    if (!outFile->good()) { std::cerr << "Error: could not open " << indexFileName << " for write" << std::endl; exit(EXIT_FAILURE); }
+    outFile->write((const char*)&header, sizeof(header));
+    outFile->write((const char*)scanner.entries.data(), scanner.entries.size() * sizeof(uint64_t));
+    outFile->close();
+    if (outFile->fail()) { std::cerr << "Error: could not write " << indexFileName << std::endl; exit(EXIT_FAILURE); }
+    std::cerr << "Indexed every " << opt::interval << "th of " << header.nVariantLines << " variants in " << indexFileName << std::endl;
+    return 0;
+}
+
+void parseIndexOptions(int argc, char** argv) {
+    bool die = false;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;)
+    {
+        std::istringstream arg(optarg != NULL ? optarg : "");
+        switch (c)
+        {
+            case '?': die = true; break;
+            case 'i': arg >> opt::interval; break;
+            case 'h':
+                std::cout << INDEX_USAGE_MESSAGE;
+                exit(EXIT_SUCCESS);
+        }
+    }
+
+    if (argc - optind < 1) {
+        std::cerr << "missing arguments\n";
+        die = true;
+    }
+    else if (argc - optind > 1)
+    {
+        std::cerr << "too many arguments\n";
+        die = true;
+    }
+    if (opt::interval < 1) {
+        std::cerr << "The interval should be at least 1\n";
+        die = true;
+    }
+
+    if (die) {
+        std::cout << "\n" << INDEX_USAGE_MESSAGE;
+        exit(EXIT_FAILURE);
+    }
+
+    // Parse the input filename
+    opt::vcfFile = argv[optind++];
+}
@@ -0,0 +1,39 @@
+//
+//  Dsuite_index.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dsuite_index_h
+#define Dsuite_index_h
+
+#include "Dsuite_utils.h"
+#include <stdint.h>
+
+#define ORDINAL_INDEX_EXT ".dsidx"
+
+// A variant ordinal index (VCF.dsidx) made by "Dsuite index", so that --region=start,length can start reading at the subset
+// Layout (little-endian): a 48 byte header (see OrdinalIndexHeader), then nEntries uint64 offsets,
+// where entry k is the offset of variant line number k * interval + 1 (counting from 1, as in --region=start,length);
+// the offsets are in bytes for an uncompressed VCF and BGZF virtual offsets for a bgzipped VCF
+struct OrdinalIndexHeader {
+    char magic[4]; // "DSIX"
+    uint32_t version;
+    uint32_t interval; // Variant lines between the entries
+    uint32_t flags; // ORDINAL_INDEX_BGZF
+    uint64_t vcfSize; // The size and modification time of the VCF, to notice if it has changed since
+    uint64_t vcfModified;
+    uint64_t nVariantLines;
+    uint64_t nEntries;
+};
+static const uint32_t ORDINAL_INDEX_BGZF = 1;
+
+// Moves the VCF stream (already past the header) to the last indexed variant line at or before the one numbered variantNumber
+// Returns the number of variant lines skipped over; 0 if there is no usable index, in which case the stream is left as it was
+int64_t seekToVariant(std::istream* vcfFile, const string& vcfFileName, int64_t variantNumber);
+
+int indexMain(int argc, char** argv);
+void parseIndexOptions(int argc, char** argv);
+
+#endif /* Dsuite_index_h */
@@ -0,0 +1,118 @@
+//
+//  Dsuite_output.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#include "Dsuite_output.h"
+#include <math.h>
+#include <string.h>
+
+static const double POWERS_OF_10[23] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// The 6 significant digits are found by scaling x to [100000, 1000000) with an exactly representable power of 10, which leaves
+// an error far below the rounding to an integer. Only when the scaled value is (nearly) half way between two integers
+// could the rounding differ from printf, which rounds the exact binary value; those numbers and the extremes go to snprintf
+int formatDouble(double x, char* out) {
+    double a = fabs(x);
+    if (!(a >= 1e-300 && a < 1e300)) return snprintf(out, 32, "%g", x); // Also 0, inf, and nan
+    int e = (int)floor(log10(a)); int k = 5 - e;
+    if (k > 22 || k < -22) return snprintf(out, 32, "%g", x);
+    double scaled = (k >= 0) ? a * POWERS_OF_10[k] : a / POWERS_OF_10[-k];
+    double fraction = scaled - floor(scaled);
+    if (fabs(fraction - 0.5) < 1e-6) return snprintf(out, 32, "%g", x);
+    double rounded = floor(scaled + 0.5);
+    if (rounded == 1e6) { rounded = 1e5; e++; } // e.g. 999999.7
+    else if (rounded < 1e5 || rounded > 1e6) return snprintf(out, 32, "%g", x); // log10 was out by one
+
+    char digits[6]; int d = (int)rounded;
+    for (int i = 5; i >= 0; i--) { digits[i] = '0' + d % 10; d /= 10; }
+    int nDigits = 6; while (digits[nDigits - 1] == '0') nDigits--; // %g drops the trailing zeros
+
+    char* p = out;
+    if (x < 0) *p++ = '-';
+    if (e >= -4 && e < 6) {
+        if (e >= 0) {
+            for (int i = 0; i <= e; i++) *p++ = digits[i];
+            if (nDigits > e + 1) { *p++ = '.'; for (int i = e + 1; i < nDigits; i++) *p++ = digits[i]; }
+        } else {
+            *p++ = '0'; *p++ = '.';
+            for (int i = 0; i < -e - 1; i++) *p++ = '0';
+            for (int i = 0; i < nDigits; i++) *p++ = digits[i];
+        }
+    } else {
+        *p++ = digits[0];
+        if (nDigits > 1) { *p++ = '.'; for (int i = 1; i < nDigits; i++) *p++ = digits[i]; }
+        *p++ = 'e'; *p++ = (e < 0) ? '-' : '+';
+        int absE = abs(e);
+        if (absE >= 100) *p++ = '0' + absE / 100;
+        *p++ = '0' + (absE / 10) % 10; *p++ = '0' + absE % 10;
+    }
+    *p = '\0';
+    return (int)(p - out);
+}
+
+ResultBuffer& ResultBuffer::operator<<(std::ostream& (*manipulator)(std::ostream&)) {
+    if (manipulator == static_cast<std::ostream& (*)(std::ostream&)>(std::endl)) data.push_back('\n');
+    return checkFull();
+}
+
+ResultBuffer& ResultBuffer::appendInteger(unsigned long long i) {
+    char number[24]; char* p = number + sizeof(number);
+    do { *--p = '0' + i % 10; i /= 10; } while (i != 0);
+    data.append(p, number + sizeof(number) - p);
+    return checkFull();
+}
+
+ResultBuffer& ResultBuffer::appendInteger(long long i) {
+    if (i >= 0) return appendInteger((unsigned long long)i);
+    data.push_back('-');
+    return appendInteger(0ULL - (unsigned long long)i);
+}
+
+ResultWriter::ResultWriter(const string& fileName, bool backgroundThread, size_t bufferSize) : fileName(fileName), file(NULL), gzipFile(NULL), writeFailed(false), writerThread(NULL), fullBuffers(2), freeBuffers(2) {
+    if (isGzip(fileName)) gzipFile = gzopen(fileName.c_str(), "wb");
+    else file = fopen(fileName.c_str(), "w");
+    if (file == NULL && gzipFile == NULL) { std::cerr << "Error: could not open " << fileName << " for write" << std::endl; exit(EXIT_FAILURE); }
+    if (file != NULL) setvbuf(file, NULL, _IONBF, 0); // The writes are already large
+    flushSize = bufferSize;
+    if (backgroundThread) {
+        buffers.resize(2);
+        for (int i = 0; i != 2; i++) freeBuffers.push(&buffers[i]);
+        writerThread = new std::thread([this]() {
+            string* buffer;
+            while (fullBuffers.pop(buffer)) {
+                writeBuffer(*buffer);
+                buffer->clear(); freeBuffers.push(buffer);
+            }
+        });
+    }
+}
+
+void ResultWriter::writeBuffer(const string& buffer) {
+    if (buffer.empty()) return;
+    if (gzipFile != NULL) { if (gzwrite(gzipFile, buffer.data(), (unsigned)buffer.size()) != (int)buffer.size()) writeFailed = true; }
+    else if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) writeFailed = true;
+}
+
+void ResultWriter::flushFull() {
+    if (writerThread == NULL) { writeBuffer(data); data.clear(); return; }
+    string* buffer = NULL;
+    if (!freeBuffers.pop(buffer)) { writeBuffer(data); data.clear(); return; } // Only if the queue has been closed: write it here
+    buffer->swap(data);
+    fullBuffers.push(buffer);
+}
+
+void ResultWriter::close() {
+    if (file == NULL && gzipFile == NULL) return;
+    if (writerThread != NULL) {
+        fullBuffers.close(); writerThread->join();
+        delete writerThread; writerThread = NULL;
+    }
+    writeBuffer(data); data.clear();
+    if (gzipFile != NULL && gzclose(gzipFile) != Z_OK) writeFailed = true;
+    if (file != NULL && fclose(file) != 0) writeFailed = true;
+    file = NULL; gzipFile = NULL;
+    if (writeFailed) { std::cerr << "Error: could not write " << fileName << std::endl; exit(EXIT_FAILURE); }
+}
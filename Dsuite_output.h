@@ -0,0 +1,85 @@
+//
+//  Dsuite_output.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dsuite_output_h
+#define Dsuite_output_h
+
+#include "Dsuite_utils.h"
+#include "Dsuite_pipeline.h"
+#include <stdio.h>
+#include <zlib.h>
+#include <limits>
+
+// How much output is collected before it is written to the file (by default)
+static const size_t RESULT_WRITER_BUFFER_SIZE = 1 << 20;
+
+// Writes x exactly as printf("%g") does, which is also how the streams write a double by default; returns the length
+// out needs room for 32 characters
+int formatDouble(double x, char* out);
+
+// Output text built up in memory, written with << like a stream and with the same formatting as a stream with the default settings,
+// but the numbers are formatted without going through the iostream machinery
+// std::endl only adds a newline; the other stream manipulators are ignored
+class ResultBuffer {
+public:
+    ResultBuffer() : flushSize(std::numeric_limits<size_t>::max()) {};
+    virtual ~ResultBuffer() {};
+
+    ResultBuffer& operator<<(const string& s) { data.append(s); return checkFull(); }
+    ResultBuffer& operator<<(const char* s) { data.append(s); return checkFull(); }
+    ResultBuffer& operator<<(char c) { data.push_back(c); return checkFull(); }
+    ResultBuffer& operator<<(double d) { char number[32]; data.append(number, formatDouble(d, number)); return checkFull(); }
+    ResultBuffer& operator<<(float f) { return *this << (double)f; }
+    ResultBuffer& operator<<(int i) { return appendInteger((long long)i); }
+    ResultBuffer& operator<<(long i) { return appendInteger((long long)i); }
+    ResultBuffer& operator<<(long long i) { return appendInteger(i); }
+    ResultBuffer& operator<<(unsigned int i) { return appendInteger((unsigned long long)i); }
+    ResultBuffer& operator<<(unsigned long i) { return appendInteger((unsigned long long)i); }
+    ResultBuffer& operator<<(unsigned long long i) { return appendInteger(i); }
+    ResultBuffer& operator<<(std::ostream& (*manipulator)(std::ostream&));
+    ResultBuffer& operator<<(const ResultBuffer& other) { data.append(other.data); return checkFull(); }
+    ResultBuffer& write(const char* s, size_t n) { data.append(s, n); return checkFull(); }
+
+    const string& str() const { return data; }
+    void clear() { data.clear(); }
+
+protected:
+    string data;
+    size_t flushSize; // flushFull() is called when there is this much in data
+    virtual void flushFull() {};
+
+private:
+    ResultBuffer& checkFull() { if (data.size() >= flushSize) flushFull(); return *this; }
+    ResultBuffer& appendInteger(long long i);
+    ResultBuffer& appendInteger(unsigned long long i);
+};
+
+// A ResultBuffer that goes to a file in large writes instead of line by line, optionally from a background thread
+// so that the thread producing the output does not wait for the file system (or for the compression)
+// If the file name ends with .gz, the file is compressed with gzip
+class ResultWriter : public ResultBuffer {
+public:
+    // Exits with an error message if the file can't be opened
+    ResultWriter(const string& fileName, bool backgroundThread = false, size_t bufferSize = RESULT_WRITER_BUFFER_SIZE);
+    ~ResultWriter() { close(); }
+
+    void close(); // Writes out the rest; exits with an error message if the file could not be written
+
+protected:
+    virtual void flushFull();
+
+private:
+    string fileName;
+    FILE* file; gzFile gzipFile; // One of them is used
+    bool writeFailed;
+    std::thread* writerThread;
+    BoundedQueue<string*> fullBuffers; BoundedQueue<string*> freeBuffers;
+    std::vector<string> buffers;
+    void writeBuffer(const string& buffer);
+};
+
+#endif /* Dsuite_output_h */
@@ -0,0 +1,113 @@
+//
+//  Dsuite_pipeline.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dsuite_pipeline_h
+#define Dsuite_pipeline_h
+
+#include <deque>
+#include <map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// How many VCF lines (or at most how many bytes of them) go into one batch passed between pipeline stages
+static const int VCF_LINES_PER_BATCH = 1000;
+static const size_t VCF_BYTES_PER_BATCH = 1 << 24;
+
+// A FIFO queue with a fixed capacity: push() blocks while the queue is full and pop() blocks while it is empty
+// pop() returns false once the queue has been closed and everything in it has been taken out
+template <class T> class BoundedQueue {
+public:
+    BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {};
+
+    void push(const T& item) {
+        std::unique_lock<std::mutex> lock(m);
+        notFull.wait(lock, [this]{ return items.size() < capacity; });
+        items.push_back(item);
+        notEmpty.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(m);
+        notEmpty.wait(lock, [this]{ return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = items.front(); items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::unique_lock<std::mutex> lock(m);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+    std::mutex m;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+// Runs a three stage pipeline over batches of input:
+// 1) read: a single thread fills a batch from the input; returns false when the input is finished
+// 2) process: nWorkers threads work on different batches at the same time
+// 3) consume: the calling thread gets the processed batches back in the order in which they were read
+// The batches are allocated once and recycled, so the amount of memory in flight is bounded
+template <class Batch> void runBatchPipeline(int nWorkers, std::function<bool(Batch&)> read,
+                                             std::function<void(Batch&)> process, std::function<void(Batch&)> consume) {
+    typedef std::pair<long long, Batch*> SeqBatch;
+    int nBatches = 2 * nWorkers + 2;
+    std::vector<Batch> batches(nBatches);
+    BoundedQueue<Batch*> freeBatches(nBatches);
+    BoundedQueue<SeqBatch> readBatches(nBatches);
+    BoundedQueue<SeqBatch> processedBatches(nBatches);
+    for (int i = 0; i != nBatches; i++) freeBatches.push(&batches[i]);
+
+    std::thread reader([&]() {
+        long long seq = 0; Batch* b;
+        while (freeBatches.pop(b)) {
+            if (!read(*b)) break;
+            readBatches.push(SeqBatch(seq++, b));
+        }
+        readBatches.close();
+    });
+
+    int activeWorkers = nWorkers; std::mutex activeWorkersMutex;
+    std::vector<std::thread> workers;
+    for (int w = 0; w != nWorkers; w++) {
+        workers.push_back(std::thread([&]() {
+            SeqBatch sb;
+            while (readBatches.pop(sb)) {
+                process(*sb.second);
+                processedBatches.push(sb);
+            }
+            std::lock_guard<std::mutex> lock(activeWorkersMutex);
+            if (--activeWorkers == 0) processedBatches.close();
+        }));
+    }
+
+    // Batches can finish out of order; hold on to them until it is their turn
+    std::map<long long, Batch*> waiting; long long nextSeq = 0; SeqBatch sb;
+    while (processedBatches.pop(sb)) {
+        waiting[sb.first] = sb.second;
+        for (typename std::map<long long, Batch*>::iterator it = waiting.begin(); it != waiting.end() && it->first == nextSeq; it = waiting.erase(it)) {
+            consume(*(it->second));
+            freeBatches.push(it->second); nextSeq++;
+        }
+    }
+
+    freeBatches.close();
+    reader.join();
+    for (int w = 0; w != nWorkers; w++) workers[w].join();
+}
+
+#endif /* Dsuite_pipeline_h */
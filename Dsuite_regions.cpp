@@ -0,0 +1,289 @@
+//
+//  Dsuite_regions.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#include "Dsuite_regions.h"
+#include "Dsuite_bgzf.h"
+#include <string.h>
+
+GenomicRegion parseRegion(const string& region) {
+    GenomicRegion r;
+    size_t colon = region.rfind(':');
+    if (colon == string::npos) { r.chrom = region; return r; }
+    r.chrom = region.substr(0, colon);
+    string range = region.substr(colon + 1); range.erase(std::remove(range.begin(), range.end(), ','), range.end()); // Allow 1,000,000
+    size_t dash = range.find('-');
+    char* endPtr;
+    long start = strtol(range.c_str(), &endPtr, 10);
+    bool ok = !r.chrom.empty() && endPtr != range.c_str() && start >= 1;
+    if (ok && dash != string::npos && dash + 1 < range.length()) {
+        const char* endString = range.c_str() + dash + 1;
+        long end = strtol(endString, &endPtr, 10);
+        ok = (*endPtr == '\0' && end >= start && end <= INT_MAX); r.end = (int)end;
+    } else if (ok) {
+        ok = (*endPtr == '\0' || (*endPtr == '-' && endPtr[1] == '\0'));
+    }
+    if (!ok) { std::cerr << "Could not understand the region \"" << region << "\"; it should look like chr:start-end" << std::endl; exit(EXIT_FAILURE); }
+    r.start = (int)start;
+    return r;
+}
+
+std::vector<GenomicRegion> readBedRegions(const string& filename) {
+    std::ifstream* bedFile = new std::ifstream(filename.c_str());
+    if (!bedFile->good()) { std::cerr << "The file " << filename << " could not be opened. Exiting..." << std::endl; exit(1); }
+    std::vector<GenomicRegion> regions; string line; int l = 0;
+    while (getline(*bedFile, line)) {
+        line.erase(std::remove(line.begin(), line.end(), '\r'), line.end()); // Deal with any left over \r from files prepared on Windows
+        l++;
+        if (line.empty() || line[0] == '#' || line.compare(0, 5, "track") == 0 || line.compare(0, 7, "browser") == 0) continue;
+        std::vector<string> fields = split(line, '\t');
+        if (fields.size() < 3) { std::cerr << "Please fix the format of the " << filename << " file.\nLine " << l << " does not have the three columns chrom, start, end" << std::endl; exit(EXIT_FAILURE); }
+        int start = atoi(fields[1].c_str()); int end = atoi(fields[2].c_str());
+        if (end <= start || start < 0) { std::cerr << "Please fix the format of the " << filename << " file.\nLine " << l << " has an empty region" << std::endl; exit(EXIT_FAILURE); }
+        regions.push_back(GenomicRegion(fields[0], start + 1, end));
+    }
+    delete bedFile;
+    return regions;
+}
+
+std::vector<GenomicRegion> normaliseRegions(const std::vector<GenomicRegion>& regions) {
+    std::vector<string> chromOrder; std::map<string, std::vector<std::pair<int, int> > > byChrom;
+    for (std::vector<GenomicRegion>::size_type i = 0; i != regions.size(); i++) {
+        if (byChrom.count(regions[i].chrom) == 0) chromOrder.push_back(regions[i].chrom);
+        byChrom[regions[i].chrom].push_back(std::make_pair(regions[i].start, regions[i].end));
+    }
+    std::vector<GenomicRegion> normalised;
+    for (std::vector<string>::size_type c = 0; c != chromOrder.size(); c++) {
+        std::vector<std::pair<int, int> >& intervals = byChrom[chromOrder[c]];
+        std::sort(intervals.begin(), intervals.end());
+        size_t first = normalised.size();
+        for (std::vector<std::pair<int, int> >::size_type i = 0; i != intervals.size(); i++) {
+            if (normalised.size() > first && intervals[i].first <= normalised.back().end) {
+                normalised.back().end = std::max(normalised.back().end, intervals[i].second);
+            } else {
+                normalised.push_back(GenomicRegion(chromOrder[c], intervals[i].first, intervals[i].second));
+            }
+        }
+    }
+    return normalised;
+}
+
+void sortRegionsByContigs(std::vector<GenomicRegion>& regions, const std::vector<string>& contigOrder) {
+    std::map<string, size_t> rank;
+    for (std::vector<string>::size_type i = 0; i != contigOrder.size(); i++) rank.insert(std::make_pair(contigOrder[i], i));
+    std::stable_sort(regions.begin(), regions.end(), [&rank](const GenomicRegion& a, const GenomicRegion& b) {
+        std::map<string, size_t>::const_iterator ia = rank.find(a.chrom); std::map<string, size_t>::const_iterator ib = rank.find(b.chrom);
+        size_t ra = (ia == rank.end()) ? rank.size() : ia->second; size_t rb = (ib == rank.end()) ? rank.size() : ib->second;
+        return ra < rb;
+    });
+}
+
+// Little-endian reading from the inflated index
+struct IndexCursor {
+    IndexCursor(const std::vector<char>& data) : data(data), pos(0), ok(true) {};
+    const std::vector<char>& data; size_t pos; bool ok;
+    bool has(size_t n) { if (pos + n > data.size()) ok = false; return ok; }
+    int32_t int32() { if (!has(4)) return 0; int32_t v; memcpy(&v, &data[pos], 4); pos += 4; return v; }
+    uint32_t uint32() { return (uint32_t)int32(); }
+    uint64_t uint64() { if (!has(8)) return 0; uint64_t v; memcpy(&v, &data[pos], 8); pos += 8; return v; }
+};
+
+bool TabixIndex::load(const string& vcfFileName, const std::vector<string>& sequenceNames) {
+    std::vector<char> data;
+    if (file_exists(vcfFileName + ".tbi") && readWholeBgzf(vcfFileName + ".tbi", data)) fileName = vcfFileName + ".tbi";
+    else if (file_exists(vcfFileName + ".csi") && readWholeBgzf(vcfFileName + ".csi", data)) fileName = vcfFileName + ".csi";
+    else return false;
+    if (!parse(data)) { std::cerr << "Error: could not read the index " << fileName << std::endl; exit(EXIT_FAILURE); }
+    if (refIDs.empty()) { // The index has no names of its own
+        for (std::vector<string>::size_type i = 0; i != sequenceNames.size(); i++) refIDs[sequenceNames[i]] = (int)i;
+    }
+    return true;
+}
+
+std::vector<string> TabixIndex::sequenceNames() const {
+    std::vector<string> names(refIDs.size());
+    for (std::map<string, int>::const_iterator it = refIDs.begin(); it != refIDs.end(); it++) {
+        if (it->second >= 0 && it->second < (int)names.size()) names[it->second] = it->first;
+    }
+    return names;
+}
+
+bool TabixIndex::parse(const std::vector<char>& data) {
+    if (data.size() < 4) return false;
+    IndexCursor c(data); c.pos = 4;
+    std::vector<char> names; int nRefs;
+    if (memcmp(&data[0], "TBI\1", 4) == 0) {
+        isCSI = false; minShift = 14; depth = 5;
+        nRefs = c.int32();
+        for (int i = 0; i != 6; i++) c.int32(); // format, col_seq, col_beg, col_end, meta, skip
+        int32_t namesLength = c.int32();
+        if (namesLength < 0 || !c.has(namesLength)) return false;
+        names.assign(data.begin() + c.pos, data.begin() + c.pos + namesLength); c.pos += namesLength;
+    } else if (memcmp(&data[0], "CSI\1", 4) == 0) {
+        isCSI = true;
+        minShift = c.int32(); depth = c.int32();
+        int32_t auxLength = c.int32();
+        if (auxLength < 0 || !c.has(auxLength)) return false;
+        if (auxLength >= 28) { // The tabix-style header with the sequence names
+            IndexCursor aux(data); aux.pos = c.pos + 24;
+            int32_t namesLength = aux.int32();
+            if (namesLength < 0 || 28 + namesLength > auxLength) return false;
+            names.assign(data.begin() + aux.pos, data.begin() + aux.pos + namesLength);
+        }
+        c.pos += auxLength;
+        nRefs = c.int32();
+    } else {
+        return false;
+    }
+    for (size_t start = 0, i = 0; i < names.size(); i++) {
+        if (names[i] == '\0') { int ID = (int)refIDs.size(); refIDs[string(&names[start], i - start)] = ID; start = i + 1; }
+    }
+    if (nRefs < 0) return false;
+    refs.resize(nRefs);
+    for (int r = 0; r != nRefs && c.ok; r++) {
+        int32_t nBins = c.int32();
+        for (int b = 0; b < nBins && c.ok; b++) {
+            uint32_t binID = c.uint32();
+            Bin& bin = refs[r].bins[binID];
+            bin.loffset = isCSI ? c.uint64() : 0;
+            int32_t nChunks = c.int32();
+            for (int k = 0; k < nChunks && c.ok; k++) {
+                uint64_t begin = c.uint64(); uint64_t end = c.uint64();
+                bin.chunks.push_back(std::make_pair(begin, end));
+            }
+        }
+        if (!isCSI) {
+            int32_t nIntervals = c.int32();
+            for (int k = 0; k < nIntervals && c.ok; k++) refs[r].linearIndex.push_back(c.uint64());
+        }
+    }
+    return c.ok;
+}
+
+bool TabixIndex::regionStart(const GenomicRegion& region, uint64_t& virtualOffset) const {
+    std::map<string, int>::const_iterator it = refIDs.find(region.chrom);
+    if (it == refIDs.end() || it->second >= (int)refs.size()) return false;
+    const Reference& ref = refs[it->second];
+
+    // 0-based, half-open; clamped to the largest coordinate the index can hold
+    int64_t maxCoordinate = (int64_t)1 << (minShift + 3 * depth);
+    int64_t begin = std::min((int64_t)region.start - 1, maxCoordinate - 1); int64_t end = std::min((int64_t)region.end, maxCoordinate);
+
+    // Records before this offset can't overlap the region
+    uint64_t minOffset = 0;
+    if (!isCSI && !ref.linearIndex.empty()) {
+        size_t window = (size_t)(begin >> minShift);
+        minOffset = (window >= ref.linearIndex.size()) ? ref.linearIndex.back() : ref.linearIndex[window];
+    } else if (isCSI) {
+        uint32_t bin = (uint32_t)((((int64_t)1 << (3 * depth)) - 1) / 7 + (begin >> minShift)); // The smallest bin containing begin
+        while (true) {
+            std::map<uint32_t, Bin>::const_iterator b = ref.bins.find(bin);
+            if (b != ref.bins.end()) { minOffset = b->second.loffset; break; }
+            if (bin == 0) break;
+            bin = (bin - 1) >> 3; // The parent bin
+        }
+    }
+
+    // Go through all the bins overlapping the region, on every level of the binning scheme
+    bool found = false;
+    int64_t levelStart = 0;
+    for (int level = 0, shift = minShift + 3 * depth; level <= depth; level++, shift -= 3) {
+        int64_t firstBin = levelStart + (begin >> shift); int64_t lastBin = levelStart + ((end - 1) >> shift);
+        for (int64_t bin = firstBin; bin <= lastBin; bin++) {
+            std::map<uint32_t, Bin>::const_iterator b = ref.bins.find((uint32_t)bin);
+            if (b == ref.bins.end()) continue;
+            for (std::vector<std::pair<uint64_t, uint64_t> >::size_type k = 0; k != b->second.chunks.size(); k++) {
+                const std::pair<uint64_t, uint64_t>& chunk = b->second.chunks[k];
+                if (chunk.second <= minOffset) continue;
+                if (!found || chunk.first < virtualOffset) virtualOffset = chunk.first;
+                found = true;
+            }
+        }
+        levelStart += (int64_t)1 << (3 * level);
+    }
+    return found;
+}
+
+RegionLineReader::RegionLineReader(std::istream* vcfFile, const string& vcfFileName, const std::vector<GenomicRegion>& regions) : vcfFile(vcfFile), bcfFile(NULL), regions(normaliseRegions(regions)), useIndex(false), currentRegion(-1), inRegion(false), seenChrom(false) {
+    init(vcfFileName);
+}
+
+RegionLineReader::RegionLineReader(BcfFile* bcfFile, const string& bcfFileName, const std::vector<GenomicRegion>& regions) : vcfFile(bcfFile->stream()), bcfFile(bcfFile), regions(normaliseRegions(regions)), useIndex(false), currentRegion(-1), inRegion(false), seenChrom(false) {
+    init(bcfFileName);
+}
+
+void RegionLineReader::init(const string& vcfFileName) {
+    if (dynamic_cast<ibgzfstream*>(vcfFile) != NULL && index.load(vcfFileName, (bcfFile != NULL) ? bcfFile->contigNames : std::vector<string>())) {
+        useIndex = true;
+        sortRegionsByContigs(regions, index.sequenceNames());
+        std::cerr << "Using the index " << index.fileName << " to read " << this->regions.size() << " region(s)" << std::endl;
+    } else {
+        std::cerr << "There is no tabix or CSI index for " << vcfFileName << " (it needs to be compressed with bgzip and indexed); reading through the whole file to find the regions" << std::endl;
+        for (std::vector<GenomicRegion>::size_type i = 0; i != this->regions.size(); i++) {
+            regionsByChrom[this->regions[i].chrom].push_back(std::make_pair(this->regions[i].start, this->regions[i].end));
+        }
+    }
+}
+
+bool RegionLineReader::startRegion() {
+    ibgzfstream* bgzfFile = dynamic_cast<ibgzfstream*>(vcfFile);
+    while (++currentRegion < (int)regions.size()) {
+        uint64_t virtualOffset;
+        if (!index.regionStart(regions[currentRegion], virtualOffset)) continue; // Nothing in this region
+        if (!bgzfFile->seekVirtual(virtualOffset)) { std::cerr << "Error: could not seek in the VCF file" << std::endl; exit(EXIT_FAILURE); }
+        inRegion = true; seenChrom = false;
+        return true;
+    }
+    return false;
+}
+
+bool RegionLineReader::readRecord(string& line, const char*& chrom, size_t& chromLength, int& pos) {
+    if (bcfFile != NULL) {
+        if (!bcfFile->getNextRecord(line)) return false;
+        BcfRecord record(line, *bcfFile);
+        const string& name = bcfFile->contigName(record.chromID);
+        chrom = name.c_str(); chromLength = name.length(); pos = record.pos;
+        return true;
+    }
+    while (getline(*vcfFile, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        size_t chromEnd = line.find('\t');
+        if (chromEnd == string::npos) continue;
+        chrom = line.c_str(); chromLength = chromEnd; pos = atoi(line.c_str() + chromEnd + 1);
+        return true;
+    }
+    return false;
+}
+
+bool RegionLineReader::getNextLine(string& line) {
+    const char* chrom; size_t chromLength; int pos;
+    while (true) {
+        if (useIndex && !inRegion && !startRegion()) return false;
+        if (!readRecord(line, chrom, chromLength, pos)) {
+            if (!useIndex) return false;
+            inRegion = false; continue;
+        }
+        if (useIndex) {
+            const GenomicRegion& r = regions[currentRegion];
+            if (r.chrom.compare(0, string::npos, chrom, chromLength) != 0) {
+                if (seenChrom) inRegion = false; // The VCF is sorted, so the region is finished
+                continue;
+            }
+            seenChrom = true;
+            if (pos < r.start) continue;
+            if (pos > r.end) { inRegion = false; continue; }
+            return true;
+        } else {
+            std::map<string, std::vector<std::pair<int, int> > >::const_iterator it = regionsByChrom.find(string(chrom, chromLength));
+            if (it == regionsByChrom.end()) continue;
+            // The intervals are sorted and do not overlap: find the last one starting at or before pos
+            std::vector<std::pair<int, int> >::const_iterator interval = std::upper_bound(it->second.begin(), it->second.end(), std::make_pair(pos, INT_MAX));
+            if (interval == it->second.begin()) continue;
+            --interval;
+            if (pos <= interval->second) return true;
+        }
+    }
+}
@@ -0,0 +1,88 @@
+//
+//  Dsuite_regions.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dsuite_regions_h
+#define Dsuite_regions_h
+
+#include "Dsuite_utils.h"
+#include "Dsuite_bcf.h"
+#include <stdint.h>
+#include <limits.h>
+
+// A genomic region, 1-based and inclusive at both ends as in chr:start-end
+struct GenomicRegion {
+    GenomicRegion() : start(1), end(INT_MAX) {};
+    GenomicRegion(const string& chrom, int start, int end) : chrom(chrom), start(start), end(end) {};
+    string chrom; int start; int end;
+};
+
+// Parses chr, chr:start-end or chr:start- ; exits with an error message if that fails
+GenomicRegion parseRegion(const string& region);
+// Reads the regions from a BED file (0-based, half-open coordinates)
+std::vector<GenomicRegion> readBedRegions(const string& filename);
+// Sorts the regions within each chromosome and merges those that overlap, so that no site is read twice
+// The chromosomes stay in the order in which they first appear
+std::vector<GenomicRegion> normaliseRegions(const std::vector<GenomicRegion>& regions);
+// Puts the chromosomes of the (normalised) regions in the order in which they are in the input (contigOrder), so that the regions
+// are visited in the same order, and the jackknife blocks come out the same, however the input is read;
+// chromosomes that are not in contigOrder go at the end
+void sortRegionsByContigs(std::vector<GenomicRegion>& regions, const std::vector<string>& contigOrder);
+
+// A tabix (.tbi) or CSI (.csi) index of a bgzipped VCF
+class TabixIndex {
+public:
+    TabixIndex() : minShift(14), depth(5) {};
+    // Looks for VCF.tbi and then VCF.csi; false if there is neither
+    // The sequence names are needed for a CSI index of a BCF file, which numbers the sequences as in the contig dictionary
+    bool load(const string& vcfFileName, const std::vector<string>& sequenceNames = std::vector<string>());
+    string fileName;
+    std::vector<string> sequenceNames() const; // In the order of the index, which is the order of the file
+
+    // The virtual offset from which to read to find all the records in the region; false if there are none
+    bool regionStart(const GenomicRegion& region, uint64_t& virtualOffset) const;
+
+private:
+    struct Bin {
+        uint64_t loffset; // CSI only: the first record overlapping this bin
+        std::vector<std::pair<uint64_t, uint64_t> > chunks; // [begin, end) virtual offsets
+    };
+    struct Reference {
+        std::map<uint32_t, Bin> bins;
+        std::vector<uint64_t> linearIndex; // Tabix only
+    };
+    int minShift; int depth; bool isCSI;
+    std::map<string, int> refIDs;
+    std::vector<Reference> refs;
+
+    bool parse(const std::vector<char>& data);
+};
+
+// Reads the variant lines of a VCF (or the records of a BCF file) that are in the regions
+// With a bgzipped VCF with a tabix or CSI index this seeks straight to each region, reading them in the order given;
+// otherwise it goes through the whole file and keeps the lines inside the regions
+// The VCF stream should be past the header
+class RegionLineReader {
+public:
+    RegionLineReader(std::istream* vcfFile, const string& vcfFileName, const std::vector<GenomicRegion>& regions);
+    RegionLineReader(BcfFile* bcfFile, const string& bcfFileName, const std::vector<GenomicRegion>& regions);
+
+    bool getNextLine(string& line); // false when there are no more lines in the regions
+
+private:
+    std::istream* vcfFile;
+    BcfFile* bcfFile; // NULL for a VCF
+    std::vector<GenomicRegion> regions;
+    TabixIndex index; bool useIndex;
+    int currentRegion; bool inRegion; bool seenChrom;
+    std::map<string, std::vector<std::pair<int, int> > > regionsByChrom; // Without an index: for looking up each line
+
+    void init(const string& fileName);
+    bool startRegion(); // Seeks to the next region that has any records; false if there are none left
+    bool readRecord(string& line, const char*& chrom, size_t& chromLength, int& pos); // The next variant line or BCF record; false at the end
+};
+
+#endif /* Dsuite_regions_h */
@@ -0,0 +1,349 @@
+//
+//  Dsuite_simulate.cpp
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#include "Dsuite_simulate.h"
+#include "Dsuite_pipeline.h"
+#include "Dsuite_output.h"
+
+#define SUBPROGRAM "simulate"
+
+static const char *SIMULATE_USAGE_MESSAGE =
+"Usage: " PROGRAM_BIN " " SUBPROGRAM " [OPTIONS] OUTPUT_PREFIX\n"
+"Generate a synthetic data set for testing and benchmarking: a VCF (OUTPUT_PREFIX.vcf.gz), a SETS file (OUTPUT_PREFIX_sets.txt),\n"
+"the species tree (OUTPUT_PREFIX_tree.nwk), and the trios with gene flow for Dinvestigate (OUTPUT_PREFIX_trios.txt)\n"
+"The species tree is random, with coalescent branch lengths; the derived allele frequencies start from a 1/p frequency spectrum at the root\n"
+"and drift along the branches (Balding-Nichols), and then some species receive gene flow from others (P3 -> P2 in the trios file)\n"
+"The output is the same for the same options and seed, whatever the number of threads\n"
+"\n"
+"       -h, --help                              display this help and exit\n"
+"       -n, --species=N                         (default=10) the number of species\n"
+"       -i, --individuals=N                     (default=5) the number of (diploid) individuals in each species\n"
+"       --outgroup=N                            (default=2) the number of individuals in the Outgroup\n"
+"       -l, --sites=N                           (default=100000) the number of biallelic SNPs (all polymorphic among the individuals)\n"
+"       -c, --chromosomes=N                     (default=1) split the sites evenly between N chromosomes\n"
+"       -m, --missing=F                         (default=0.02) the proportion of missing genotypes\n"
+"       -d, --divergence=D                      (default=0.5) the drift from the root to the species: F = 1 - exp(-D) over the whole depth of the tree\n"
+"       -a, --admixture=N                       (default=1) the number of gene flow events\n"
+"       --seed=N                                (default=1) the seed for the random numbers\n"
+"       --threads=N                             (default=1) use N threads to generate the sites\n"
+"       --no-gzip                               write an uncompressed VCF (OUTPUT_PREFIX.vcf)\n"
+"\n"
+"\nReport bugs to " PACKAGE_BUGREPORT "\n\n";
+
+enum { OPT_OUTGROUP = 1, OPT_SEED, OPT_THREADS, OPT_NO_GZIP };
+
+static const char* shortopts = "hn:i:l:c:m:d:a:";
+
+static const struct option longopts[] = {
+    { "species",   required_argument, NULL, 'n' },
+    { "individuals",   required_argument, NULL, 'i' },
+    { "outgroup",   required_argument, NULL, OPT_OUTGROUP },
+    { "sites",   required_argument, NULL, 'l' },
+    { "chromosomes",   required_argument, NULL, 'c' },
+    { "missing",   required_argument, NULL, 'm' },
+    { "divergence",   required_argument, NULL, 'd' },
+    { "admixture",   required_argument, NULL, 'a' },
+    { "seed",   required_argument, NULL, OPT_SEED },
+    { "threads",   required_argument, NULL, OPT_THREADS },
+    { "no-gzip",   no_argument, NULL, OPT_NO_GZIP },
+    { "help",   no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+namespace opt
+{
+    static string outPrefix;
+    static int nSpecies = 10;
+    static int nIndividuals = 5;
+    static int nOutgroup = 2;
+    static int64_t nSites = 100000;
+    static int nChromosomes = 1;
+    static double missing = 0.02;
+    static double divergence = 0.5;
+    static int nAdmixture = 1;
+    static uint64_t seed = 1;
+    static int numThreads = 1;
+    static bool gzip = true;
+}
+
+// How many sites go into one batch passed between the pipeline stages
+static const int SIMULATE_SITES_PER_BATCH = 1000;
+// The positions of the sites on a chromosome: one in each stretch of this many bases
+static const int SIMULATE_SITE_SPACING = 100;
+// A site where all the individuals came out with the same allele is drawn again, up to this many times
+static const int SIMULATE_MAX_TRIES = 100;
+
+static double normalSample(uint64_t& state) { // Box-Muller
+    double u1 = 1 - mix64Uniform(state); double u2 = mix64Uniform(state);
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+// Marsaglia and Tsang (2000); shapes below 1 are boosted to shape + 1
+static double gammaSample(double shape, uint64_t& state) {
+    if (shape < 1) return gammaSample(shape + 1, state) * pow(1 - mix64Uniform(state), 1 / shape);
+    double d = shape - 1.0 / 3; double c = 1 / sqrt(9 * d);
+    for (;;) {
+        double x, v;
+        do { x = normalSample(state); v = 1 + c * x; } while (v <= 0);
+        v = v * v * v; double u = 1 - mix64Uniform(state);
+        if (log(u) < 0.5 * x * x + d - d * v + d * log(v)) return d * v;
+    }
+}
+
+// The allele frequency after drift F from frequency p (Balding and Nichols 1995): Beta(p(1-F)/F, (1-p)(1-F)/F)
+static double driftedFrequency(double p, double F, uint64_t& state) {
+    if (p <= 0 || p >= 1 || F <= 0) return p;
+    double x = gammaSample(p * (1 - F) / F, state); double y = gammaSample((1 - p) * (1 - F) / F, state);
+    if (x + y == 0) return p;
+    return x / (x + y);
+}
+
+// A rooted binary tree of the species: the leaves are 0 to nSpecies-1 and every internal node comes after its children,
+// so that the root is the last node
+class SimulatedTree {
+public:
+    SimulatedTree(int nSpecies, double divergence, uint64_t& state);
+
+    std::vector<int> parent; std::vector<int> child1; std::vector<int> child2; // -1 if there is none
+    std::vector<double> height; // 0 at the leaves
+    std::vector<double> drift; // The F of the branch above each node (0 for the root)
+
+    int root() const { return (int)parent.size() - 1; }
+    void getLeaves(int node, std::vector<int>& leaves) const;
+    string newick(int node, const std::vector<string>& names) const;
+};
+
+// The lineages are joined two at a time in random order, with exponential waiting times as in the coalescent
+SimulatedTree::SimulatedTree(int nSpecies, double divergence, uint64_t& state) {
+    int nNodes = 2 * nSpecies - 1;
+    parent.assign(nNodes, -1); child1.assign(nNodes, -1); child2.assign(nNodes, -1); height.assign(nNodes, 0); drift.assign(nNodes, 0);
+    std::vector<int> lineages; for (int i = 0; i != nSpecies; i++) lineages.push_back(i);
+    double t = 0;
+    for (int node = nSpecies; node != nNodes; node++) {
+        double k = (double)lineages.size();
+        t += -log(1 - mix64Uniform(state)) / (k * (k - 1) / 2);
+        int a = (int)(mix64Uniform(state) * lineages.size()); int first = lineages[a]; lineages.erase(lineages.begin() + a);
+        int b = (int)(mix64Uniform(state) * lineages.size()); int second = lineages[b]; lineages.erase(lineages.begin() + b);
+        child1[node] = first; child2[node] = second; parent[first] = parent[second] = node;
+        height[node] = t; lineages.push_back(node);
+    }
+    for (int node = 0; node != root(); node++) drift[node] = 1 - exp(-divergence * (height[parent[node]] - height[node]) / height[root()]);
+}
+
+void SimulatedTree::getLeaves(int node, std::vector<int>& leaves) const {
+    if (child1[node] == -1) { leaves.push_back(node); return; }
+    getLeaves(child1[node], leaves); getLeaves(child2[node], leaves);
+}
+
+string SimulatedTree::newick(int node, const std::vector<string>& names) const {
+    string s = (child1[node] == -1) ? names[node] : "(" + newick(child1[node], names) + "," + newick(child2[node], names) + ")";
+    if (node != root()) s += ":" + numToString(height[parent[node]] - height[node]);
+    return s;
+}
+
+// A gene flow event: a proportion of the alleles of the recipient (P2) come from the donor (P3); P1 is in the sister clade of P2
+struct Admixture {
+    int P1; int P2; int P3; double proportion;
+};
+
+// A batch of sites on their way through the generating -> writing pipeline
+struct SimulateBatch {
+    int64_t firstSite; int nSites;
+    ResultBuffer text; // The VCF lines
+    std::vector<double> freqs; // The allele frequencies at the nodes of the tree, reused for every site
+};
+
+int simulateMain(int argc, char** argv) {
+    parseSimulateOptions(argc, argv);
+    uint64_t treeState = mix64(opt::seed);
+    SimulatedTree tree(opt::nSpecies, opt::divergence, treeState);
+    int digits = (int)numToString(opt::nSpecies - 1).length();
+    std::vector<string> speciesNames;
+    for (int s = 0; s != opt::nSpecies; s++) { string n = numToString(s); speciesNames.push_back("Sp" + string(std::max(2, digits) - n.length(), '0') + n); }
+
+    // The gene flow events go from a random species outside the sister clade of the recipient
+    std::vector<Admixture> admixture;
+    for (int e = 0; e != opt::nAdmixture; e++) {
+        Admixture event; int p;
+        do { event.P2 = (int)(mix64Uniform(treeState) * opt::nSpecies); p = tree.parent[event.P2]; } while (p == tree.root());
+        std::vector<int> clade; tree.getLeaves(p, clade);
+        std::vector<int> sisters; tree.getLeaves((tree.child1[p] == event.P2) ? tree.child2[p] : tree.child1[p], sisters);
+        std::vector<int> outside;
+        for (int s = 0; s != opt::nSpecies; s++) if (std::find(clade.begin(), clade.end(), s) == clade.end()) outside.push_back(s);
+        event.P1 = sisters[(int)(mix64Uniform(treeState) * sisters.size())];
+        event.P3 = outside[(int)(mix64Uniform(treeState) * outside.size())];
+        event.proportion = 0.05 + 0.2 * mix64Uniform(treeState);
+        admixture.push_back(event);
+    }
+    double outgroupDrift = 1 - exp(-2 * opt::divergence); // The Outgroup branches off above the root, as far again as the depth of the tree
+
+    std::ostream* treeFile = createWriter(opt::outPrefix + "_tree.nwk");
+    *treeFile << tree.newick(tree.root(), speciesNames) << ";" << std::endl;
+    delete treeFile;
+
+    std::vector<string> sampleNames; std::vector<int> sampleSpecies; // The Outgroup is species nSpecies
+    std::ostream* setsFile = createWriter(opt::outPrefix + "_sets.txt");
+    for (int s = 0; s <= opt::nSpecies; s++) {
+        int n = (s == opt::nSpecies) ? opt::nOutgroup : opt::nIndividuals;
+        for (int i = 0; i != n; i++) {
+            string name = ((s == opt::nSpecies) ? "Out" : speciesNames[s]) + "_i" + numToString(i);
+            sampleNames.push_back(name); sampleSpecies.push_back(s);
+            *setsFile << name << "\t" << ((s == opt::nSpecies) ? "Outgroup" : speciesNames[s]) << std::endl;
+        }
+    }
+    delete setsFile;
+
+    std::ostream* triosFile = createWriter(opt::outPrefix + "_trios.txt");
+    if (admixture.empty()) *triosFile << speciesNames[0] << "\t" << speciesNames[1] << "\t" << speciesNames[2] << std::endl;
+    for (size_t e = 0; e != admixture.size(); e++) {
+        *triosFile << speciesNames[admixture[e].P1] << "\t" << speciesNames[admixture[e].P2] << "\t" << speciesNames[admixture[e].P3] << std::endl;
+        std::cerr << "Gene flow from " << speciesNames[admixture[e].P3] << " into " << speciesNames[admixture[e].P2] << " (P1 " << speciesNames[admixture[e].P1] << "): " << admixture[e].proportion << std::endl;
+    }
+    delete triosFile;
+
+    string vcfFileName = opt::outPrefix + (opt::gzip ? ".vcf.gz" : ".vcf");
+    std::ostream* vcfFile = createWriter(vcfFileName);
+    int64_t sitesPerChromosome = (opt::nSites + opt::nChromosomes - 1) / opt::nChromosomes;
+    *vcfFile << "##fileformat=VCFv4.2\n";
+    *vcfFile << "##source=" PROGRAM_BIN " " SUBPROGRAM " --species=" << opt::nSpecies << " --individuals=" << opt::nIndividuals << " --outgroup=" << opt::nOutgroup << " --sites=" << opt::nSites << " --chromosomes=" << opt::nChromosomes << " --missing=" << opt::missing << " --divergence=" << opt::divergence << " --admixture=" << opt::nAdmixture << " --seed=" << opt::seed << "\n";
+    for (int c = 0; c != opt::nChromosomes; c++) *vcfFile << "##contig=<ID=chr" << c + 1 << ",length=" << sitesPerChromosome * SIMULATE_SITE_SPACING << ">\n";
+    *vcfFile << "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n";
+    *vcfFile << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+    for (size_t i = 0; i != sampleNames.size(); i++) *vcfFile << "\t" << sampleNames[i];
+    *vcfFile << "\n";
+
+    // Pipeline stage 1: hand out the ranges of sites
+    int64_t nextSite = 0;
+    std::function<bool(SimulateBatch&)> nextBatch = [&](SimulateBatch& b) {
+        if (nextSite == opt::nSites) return false;
+        b.firstSite = nextSite; b.nSites = (int)std::min((int64_t)SIMULATE_SITES_PER_BATCH, opt::nSites - nextSite);
+        nextSite += b.nSites;
+        return true;
+    };
+
+    // Pipeline stage 2: generate the VCF lines; each site has its own random numbers, so it comes out the same on any thread
+    std::function<void(SimulateBatch&)> generateSites = [&](SimulateBatch& b) {
+        b.text.clear(); b.freqs.resize(tree.parent.size() + 1);
+        ResultBuffer line;
+        for (int64_t site = b.firstSite; site != b.firstSite + b.nSites; site++) {
+            uint64_t state = mix64(opt::seed ^ mix64((uint64_t)site + 1));
+            int64_t chromosome = site / sitesPerChromosome; int64_t onChromosome = site % sitesPerChromosome;
+            int64_t pos = onChromosome * SIMULATE_SITE_SPACING + 1 + (int64_t)(mix64Uniform(state) * SIMULATE_SITE_SPACING);
+            int ref = (int)(mix64Uniform(state) * 4); int alt = (ref + 1 + (int)(mix64Uniform(state) * 3)) % 4;
+            double minFrequency = 1.0 / (2 * sampleNames.size());
+            for (int tries = 0; tries != SIMULATE_MAX_TRIES; tries++) {
+                // The frequencies from the root down, then the gene flow into the species
+                double* freqs = b.freqs.data(); int root = tree.root();
+                freqs[root] = pow(minFrequency, 1 - mix64Uniform(state));
+                for (int node = root - 1; node >= 0; node--) freqs[node] = driftedFrequency(freqs[tree.parent[node]], tree.drift[node], state);
+                for (size_t e = 0; e != admixture.size(); e++) {
+                    freqs[admixture[e].P2] = (1 - admixture[e].proportion) * freqs[admixture[e].P2] + admixture[e].proportion * freqs[admixture[e].P3];
+                }
+                freqs[root + 1] = driftedFrequency(freqs[root], outgroupDrift, state);
+
+                line.clear();
+                line << "chr" << chromosome + 1 << '\t' << pos << "\t.\t" << "ACGT"[ref] << '\t' << "ACGT"[alt] << "\t.\tPASS\t.\tGT";
+                int nAlt = 0, nRef = 0;
+                for (size_t i = 0; i != sampleNames.size(); i++) {
+                    int s = sampleSpecies[i]; double p = freqs[(s == opt::nSpecies) ? root + 1 : s];
+                    if (mix64Uniform(state) < opt::missing) { line << "\t./."; continue; }
+                    int a1 = mix64Uniform(state) < p; int a2 = mix64Uniform(state) < p;
+                    nAlt += a1 + a2; nRef += 2 - a1 - a2;
+                    line << '\t' << (char)('0' + a1) << '/' << (char)('0' + a2);
+                }
+                if (nAlt > 0 && nRef > 0) break;
+            }
+            b.text << line << '\n';
+        }
+    };
+
+    // Pipeline stage 3: write the lines in order
+    clock_t start = clock();
+    std::function<void(SimulateBatch&)> writeSites = [&](SimulateBatch& b) {
+        vcfFile->write(b.text.str().data(), b.text.str().size());
+        int64_t done = b.firstSite + b.nSites;
+        if (done % (SIMULATE_SITES_PER_BATCH * 1000) == 0) {
+            std::cerr << "Generated " << done << " sites in " << ( clock() - start ) / (double) CLOCKS_PER_SEC << "secs" << std::endl;
+        }
+    };
+    runBatchPipeline<SimulateBatch>(opt::numThreads, nextBatch, generateSites, writeSites);
+    delete vcfFile;
+    std::cerr << "Wrote " << opt::nSites << " sites for " << sampleNames.size() << " individuals in " << opt::nSpecies << " species and the Outgroup to " << vcfFileName << std::endl;
+    return 0;
+}
+
+void parseSimulateOptions(int argc, char** argv) {
+    bool die = false;
+    for (char c; (c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1;)
+    {
+        std::istringstream arg(optarg != NULL ? optarg : "");
+        switch (c)
+        {
+            case '?': die = true; break;
+            case 'n': arg >> opt::nSpecies; break;
+            case 'i': arg >> opt::nIndividuals; break;
+            case OPT_OUTGROUP: arg >> opt::nOutgroup; break;
+            case 'l': arg >> opt::nSites; break;
+            case 'c': arg >> opt::nChromosomes; break;
+            case 'm': arg >> opt::missing; break;
+            case 'd': arg >> opt::divergence; break;
+            case 'a': arg >> opt::nAdmixture; break;
+            case OPT_SEED: arg >> opt::seed; break;
+            case OPT_THREADS: arg >> opt::numThreads; break;
+            case OPT_NO_GZIP: opt::gzip = false; break;
+            case 'h':
+                std::cout << SIMULATE_USAGE_MESSAGE;
+                exit(EXIT_SUCCESS);
+        }
+    }
+
+    if (argc - optind < 1) {
+        std::cerr << "missing arguments\n";
+        die = true;
+    }
+    else if (argc - optind > 1)
+    {
+        std::cerr << "too many arguments\n";
+        die = true;
+    }
+    if (opt::nSpecies < 3) {
+        std::cerr << "There should be at least 3 species\n";
+        die = true;
+    }
+    if (opt::nIndividuals < 1 || opt::nOutgroup < 1) {
+        std::cerr << "Each species and the Outgroup need at least one individual\n";
+        die = true;
+    }
+    if (opt::nSites < 1 || opt::nChromosomes < 1 || opt::nChromosomes > opt::nSites) {
+        std::cerr << "There should be at least one site, and at least as many sites as chromosomes\n";
+        die = true;
+    }
+    if (opt::missing < 0 || opt::missing >= 1) {
+        std::cerr << "The proportion of missing genotypes should be at least 0 and less than 1\n";
+        die = true;
+    }
+    if (opt::divergence <= 0) {
+        std::cerr << "The divergence should be greater than 0\n";
+        die = true;
+    }
+    if (opt::nAdmixture < 0) {
+        std::cerr << "The number of gene flow events can't be negative\n";
+        die = true;
+    }
+    if (opt::numThreads < 1) {
+        std::cerr << "The number of threads should be at least 1\n";
+        die = true;
+    }
+
+    if (die) {
+        std::cout << "\n" << SIMULATE_USAGE_MESSAGE;
+        exit(EXIT_FAILURE);
+    }
+
+    // Parse the output prefix
+    opt::outPrefix = argv[optind++];
+}
@@ -0,0 +1,16 @@
+//
+//  Dsuite_simulate.h
+//  Dsuite
+//
+//  Created by Milan Malinsky on 17/10/2026.
+//
+
+#ifndef Dsuite_simulate_h
+#define Dsuite_simulate_h
+
+#include "Dsuite_utils.h"
+
+void parseSimulateOptions(int argc, char** argv);
+int simulateMain(int argc, char** argv);
+
+#endif /* Dsuite_simulate_h */
@@ -7,152 +7,197 @@
 //
 
 #include "Dsuite_utils.h"
+#include "Dsuite_bgzf.h"
 
 double normalCDF(double x) // Phi(-∞, x) aka N(x)
 {
     return erfc(-x/sqrt(2))/2;
 }
 
-// Works only on biallelic markers
-void GeneralSetCounts::getSetVariantCounts(const std::vector<std::string>& genotypes, const std::map<size_t, string>& posToSpeciesMap) {
-    
-    getBasicCounts(genotypes, posToSpeciesMap);
-    
-    // If at least one of the outgroup individuals has non-missing data
-    // Find out what is the "ancestral allele" - i.e. the one more common in the outgroup
-    int AAint;
-    try {
-        if (setAlleleCounts.at("Outgroup") > 0) {
-            if ((double)setAltCounts.at("Outgroup")/setAlleleCounts.at("Outgroup") < 0.5) { AAint = 0; }
-            else { AAint = 1; }
+SetIndex::SetIndex(const std::map<string, std::vector<size_t>>& setsToPosMap, const int nSamples) : outgroupID(-1) {
+    sampleToSet.assign(nSamples, -1);
+    for(std::map<string, std::vector<size_t>>::const_iterator it = setsToPosMap.begin(); it != setsToPosMap.end(); ++it) {
+        int ID = (int)setNames.size();
+        if (it->first == "Outgroup") outgroupID = ID;
+        setNames.push_back(it->first); setSizes.push_back(it->second.size());
+        for (std::vector<size_t>::size_type i = 0; i != it->second.size(); i++) {
+            sampleToSet[it->second[i]] = ID;
         }
-    } catch (std::out_of_range& e) { AAint = -1; }
+    }
+}
+
+int SetIndex::getID(const string& setName) const {
+    std::vector<string>::const_iterator it = std::lower_bound(setNames.begin(), setNames.end(), setName);
+    if (it == setNames.end() || *it != setName) return -1;
+    return (int)(it - setNames.begin());
+}
+
+void GeneralSetCounts::reset() {
+    overall = 0;
+    std::fill(setAltCounts.begin(), setAltCounts.end(), 0); std::fill(setAlleleCounts.begin(), setAlleleCounts.end(), 0);
+    std::fill(setAAFs.begin(), setAAFs.end(), -1.0); std::fill(setDAFs.begin(), setDAFs.end(), -1.0);
+    std::fill(individualsWithVariant.begin(), individualsWithVariant.end(), 0);
+}
+
+void GeneralSetCountsWithSplits::reset() {
+    GeneralSetCounts::reset();
+    std::fill(setAltCountsSplit1.begin(), setAltCountsSplit1.end(), 0); std::fill(setAltCountsSplit2.begin(), setAltCountsSplit2.end(), 0);
+    std::fill(setAlleleCountsSplit1.begin(), setAlleleCountsSplit1.end(), 0); std::fill(setAlleleCountsSplit2.begin(), setAlleleCountsSplit2.end(), 0);
+    std::fill(setAAFsplit1.begin(), setAAFsplit1.end(), -1.0); std::fill(setAAFsplit2.begin(), setAAFsplit2.end(), -1.0);
+    std::fill(setDAFsplit1.begin(), setDAFsplit1.end(), -1.0); std::fill(setDAFsplit2.begin(), setDAFsplit2.end(), -1.0);
+}
+
+// If at least one of the outgroup individuals has non-missing data
+// Find out what is the "ancestral allele" - i.e. the one more common in the outgroup
+// Returns 0 for ref, 1 for alt, and -1 if it can't be determined
+int GeneralSetCounts::getAncestralAllele() const {
+    int AAint = -1;
+    if (sets.outgroupID != -1 && setAlleleCounts[sets.outgroupID] > 0) {
+        if ((double)setAltCounts[sets.outgroupID]/setAlleleCounts[sets.outgroupID] < 0.5) { AAint = 0; }
+        else { AAint = 1; }
+    }
+    return AAint;
+}
+
+// Works only on biallelic markers
+void GeneralSetCounts::getSetVariantCounts(const LineTokenizer& fields) {
+    getBasicCounts(VCFLineGenotypes(fields));
+    fillFrequencies();
+}
+
+void GeneralSetCounts::getSetVariantCounts(const unsigned char* packedGenotypes) {
+    getBasicCounts(PackedGenotypes(packedGenotypes, individualsWithVariant.size()));
+    fillFrequencies();
+}
+
+void GeneralSetCounts::getSetVariantCounts(const BcfGenotypes& genotypes) {
+    getBasicCounts(genotypes);
+    fillFrequencies();
+}
+
+void GeneralSetCounts::fillFrequencies() {
+    int AAint = getAncestralAllele();
     
     // Now fill in the allele frequencies
-    for(std::map<string,int>::iterator it = setAltCounts.begin(); it != setAltCounts.end(); ++it) {
-        if (setAlleleCounts.at(it->first) > 0) {
-            setAAFs[it->first] = (double)setAltCounts.at(it->first)/setAlleleCounts.at(it->first);
+    for (std::vector<int>::size_type s = 0; s != setAltCounts.size(); s++) {
+        if (setAlleleCounts[s] > 0) {
+            setAAFs[s] = (double)setAltCounts[s]/setAlleleCounts[s];
             if (AAint == 0) { // Ancestral allele seems to be the ref, so derived is alt
-                setDAFs[it->first] = (double)setAltCounts.at(it->first)/setAlleleCounts.at(it->first);
+                setDAFs[s] = (double)setAltCounts[s]/setAlleleCounts[s];
             } else if (AAint == 1) { // Ancestral allele seems to be alt, so derived is ref
-                setDAFs[it->first] = 1 - ((double)setAltCounts.at(it->first)/setAlleleCounts.at(it->first));
+                setDAFs[s] = 1 - ((double)setAltCounts[s]/setAlleleCounts[s]);
             }
         }
     }
 }
 
 // Works only on biallelic markers
-void GeneralSetCounts::getSetVariantCountsSimple(const std::vector<std::string>& genotypes, const std::map<size_t, string>& posToSpeciesMap) {
+void GeneralSetCounts::getSetVariantCountsSimple(const LineTokenizer& fields) {
     // std::cerr << fields[0] << "\t" << fields[1] << std::endl;
-    getBasicCounts(genotypes, posToSpeciesMap);
+    getBasicCounts(VCFLineGenotypes(fields));
     
     // Now fill in the allele frequencies
-    for(std::map<string,int>::iterator it = setAltCounts.begin(); it != setAltCounts.end(); ++it) {
-        if (setAlleleCounts.at(it->first) > 0) {
-            setAAFs[it->first] = (double)setAltCounts.at(it->first)/setAlleleCounts.at(it->first);
+    for (std::vector<int>::size_type s = 0; s != setAltCounts.size(); s++) {
+        if (setAlleleCounts[s] > 0) {
+            setAAFs[s] = (double)setAltCounts[s]/setAlleleCounts[s];
         }
     }
 }
 
-void GeneralSetCounts::getBasicCounts(const std::vector<std::string>& genotypes, const std::map<size_t, string>& posToSpeciesMap) {
+template <class Genotypes> void GeneralSetCounts::getBasicCounts(const Genotypes& genotypes) {
     // Go through the genotypes - only biallelic markers are allowed
-    for (std::vector<std::string>::size_type i = 0; i != genotypes.size(); i++) {
-        std::string species = posToSpeciesMap.at(i);
-        // The first allele in this individual
-        if (genotypes[i][0] == '1') {
-            overall++; individualsWithVariant[i]++;
-            setAltCounts[species]++; setAlleleCounts[species]++;
-        } else if (genotypes[i][0] == '0') {
-            setAlleleCounts[species]++; 
-        }
-        // The second allele in this individual
-        if (genotypes[i][2] == '1') {
-            overall++;
-            setAltCounts[species]++; setAlleleCounts[species]++;
-            individualsWithVariant[i]++;
-        } else if (genotypes[i][2] == '0') {
-            setAlleleCounts[species]++;
+    size_t nGenotypes = std::min(genotypes.size(), individualsWithVariant.size());
+    for (size_t i = 0; i != nGenotypes; i++) {
+        int s = sets.sampleToSet[i];
+        for (int a = 0; a != 2; a++) { // The first and the second allele in this individual
+            int allele = genotypes.allele(i, a);
+            if (allele == ALLELE_ALT) {
+                overall++; individualsWithVariant[i]++;
+                if (s != -1) { setAltCounts[s]++; setAlleleCounts[s]++; }
+            } else if (allele == ALLELE_REF) {
+                if (s != -1) setAlleleCounts[s]++;
+            }
         }
     }
 }
 
-void GeneralSetCountsWithSplits::getBasicCounts(const std::vector<std::string>& genotypes, const std::map<size_t, string>& posToSpeciesMap) {
+uint64_t splitSiteKey(uint64_t seed, const std::string& chr, uint64_t pos) {
+    uint64_t h = 0xCBF29CE484222325ULL; // FNV-1a of the chromosome name
+    for (std::string::size_type i = 0; i != chr.length(); i++) { h ^= (unsigned char)chr[i]; h *= 0x100000001B3ULL; }
+    return mix64(mix64(seed ^ h) ^ pos);
+}
+
+template <class Genotypes> void GeneralSetCountsWithSplits::getBasicCounts(const Genotypes& genotypes, uint64_t siteKey) {
     // Go through the genotypes - only biallelic markers are allowed
-    for (std::vector<std::string>::size_type i = 0; i != genotypes.size(); i++) {
-        double r = ((double) rand() / (RAND_MAX));
-        std::string species = posToSpeciesMap.at(i);
-        // The first allele in this individual
-        if (genotypes[i][0] == '1') {
-            overall++; individualsWithVariant[i]++;
-            setAltCounts[species]++; setAlleleCounts[species]++;
-            if (r < 0.5) {
-                setAltCountsSplit1[species]++; setAlleleCountsSplit1[species]++;
-            } else {
-                setAltCountsSplit2[species]++; setAlleleCountsSplit2[species]++;
-            }
-        } else if (genotypes[i][0] == '0') {
-            setAlleleCounts[species]++;
-            if (r < 0.5) {
-                setAlleleCountsSplit1[species]++;
-            } else {
-                setAlleleCountsSplit2[species]++;
-            }
-        }
-        // The second allele in this individual
-        if (genotypes[i][2] == '1') {
-            overall++; individualsWithVariant[i]++;
-            setAltCounts[species]++; setAlleleCounts[species]++;
-            if (r < 0.5) {
-                setAltCountsSplit1[species]++; setAlleleCountsSplit1[species]++;
-            } else {
-                setAltCountsSplit2[species]++; setAlleleCountsSplit2[species]++;
-            }
-        } else if (genotypes[i][2] == '0') {
-            setAlleleCounts[species]++;
-            if (r < 0.5) {
-                setAlleleCountsSplit1[species]++;
-            } else {
-                setAlleleCountsSplit2[species]++;
+    size_t nGenotypes = std::min(genotypes.size(), individualsWithVariant.size());
+    uint64_t splitBits = 0;
+    for (size_t i = 0; i != nGenotypes; i++) {
+        if ((i & 63) == 0) splitBits = mix64(siteKey + (i >> 6));
+        bool r = (splitBits >> (i & 63)) & 1; // The split of this individual: 0 for split 1
+        int s = sets.sampleToSet[i];
+        for (int a = 0; a != 2; a++) { // The first and the second allele in this individual
+            int allele = genotypes.allele(i, a);
+            if (allele == ALLELE_ALT) {
+                overall++; individualsWithVariant[i]++;
+                if (s == -1) continue;
+                setAltCounts[s]++; setAlleleCounts[s]++;
+                if (!r) {
+                    setAltCountsSplit1[s]++; setAlleleCountsSplit1[s]++;
+                } else {
+                    setAltCountsSplit2[s]++; setAlleleCountsSplit2[s]++;
+                }
+            } else if (allele == ALLELE_REF) {
+                if (s == -1) continue;
+                setAlleleCounts[s]++;
+                if (!r) {
+                    setAlleleCountsSplit1[s]++;
+                } else {
+                    setAlleleCountsSplit2[s]++;
+                }
             }
         }
     }
 }
 
-void GeneralSetCountsWithSplits::getSplitCounts(const std::vector<std::string>& genotypes, const std::map<size_t, string>& posToSpeciesMap) {
-    
-    getBasicCounts(genotypes, posToSpeciesMap);
-    
-    // If at least one of the outgroup individuals has non-missing data
-    // Find out what is the "ancestral allele" - i.e. the one more common in the outgroup
-    int AAint;
-    try {
-        if (setAlleleCounts.at("Outgroup") > 0) {
-            if ((double)setAltCounts.at("Outgroup")/setAlleleCounts.at("Outgroup") < 0.5) { AAint = 0; }
-            else { AAint = 1; }
-        }
-    } catch (std::out_of_range& e) { AAint = -1; }
+void GeneralSetCountsWithSplits::getSplitCounts(const LineTokenizer& fields, uint64_t siteKey) {
+    getBasicCounts(VCFLineGenotypes(fields), siteKey);
+    fillSplitFrequencies();
+}
+
+void GeneralSetCountsWithSplits::getSplitCounts(const unsigned char* packedGenotypes, uint64_t siteKey) {
+    getBasicCounts(PackedGenotypes(packedGenotypes, individualsWithVariant.size()), siteKey);
+    fillSplitFrequencies();
+}
+
+void GeneralSetCountsWithSplits::getSplitCounts(const BcfGenotypes& genotypes, uint64_t siteKey) {
+    getBasicCounts(genotypes, siteKey);
+    fillSplitFrequencies();
+}
+
+void GeneralSetCountsWithSplits::fillSplitFrequencies() {
+    int AAint = getAncestralAllele();
     
     // Now fill in the allele frequencies
-    for(std::map<string,int>::iterator it = setAltCounts.begin(); it != setAltCounts.end(); ++it) {
-        if (setAlleleCounts.at(it->first) > 0) {
-            setAAFs[it->first] = (double)setAltCounts.at(it->first)/setAlleleCounts.at(it->first);
-            int nSplit1 = setAlleleCountsSplit1.at(it->first); int nSplit2 = setAlleleCountsSplit2.at(it->first);
+    for (std::vector<int>::size_type s = 0; s != setAltCounts.size(); s++) {
+        if (setAlleleCounts[s] > 0) {
+            setAAFs[s] = (double)setAltCounts[s]/setAlleleCounts[s];
+            int nSplit1 = setAlleleCountsSplit1[s]; int nSplit2 = setAlleleCountsSplit2[s];
             if (nSplit1 > 0)
-                setAAFsplit1[it->first] = (double)setAltCountsSplit1.at(it->first)/nSplit1;
+                setAAFsplit1[s] = (double)setAltCountsSplit1[s]/nSplit1;
             if (nSplit2 > 0)
-                setAAFsplit2[it->first] = (double)setAltCountsSplit2.at(it->first)/nSplit2;
+                setAAFsplit2[s] = (double)setAltCountsSplit2[s]/nSplit2;
             if (AAint == 0) { // Ancestral allele seems to be the ref, so derived is alt
-                setDAFs[it->first] = (double)setAltCounts.at(it->first)/setAlleleCounts.at(it->first);
+                setDAFs[s] = (double)setAltCounts[s]/setAlleleCounts[s];
                 if (nSplit1 > 0)
-                    setDAFsplit1[it->first] = (double)setAltCountsSplit1.at(it->first)/nSplit1;
+                    setDAFsplit1[s] = (double)setAltCountsSplit1[s]/nSplit1;
                 if (nSplit2 > 0)
-                    setDAFsplit2[it->first] = (double)setAltCountsSplit2.at(it->first)/nSplit2;
+                    setDAFsplit2[s] = (double)setAltCountsSplit2[s]/nSplit2;
             } else if (AAint == 1) { // Ancestral allele seems to be alt, so derived is ref
-                setDAFs[it->first] = 1 - ((double)setAltCounts.at(it->first)/setAlleleCounts.at(it->first));
+                setDAFs[s] = 1 - ((double)setAltCounts[s]/setAlleleCounts[s]);
                 if (nSplit1 > 0)
-                    setDAFsplit1[it->first] = 1 - ((double)setAltCountsSplit1.at(it->first)/nSplit1);
+                    setDAFsplit1[s] = 1 - ((double)setAltCountsSplit1[s]/nSplit1);
                 if (nSplit2 > 0)
-                    setDAFsplit2[it->first] = 1 - ((double)setAltCountsSplit2.at(it->first)/nSplit2);
+                    setDAFsplit2[s] = 1 - ((double)setAltCountsSplit2[s]/nSplit2);
             }
         }
     }
@@ -193,6 +238,52 @@ std::vector<std::string> split(const std::string &s, char delim) {
     return elems;
 }
 
+void LineTokenizer::tokenize(const std::string& line, char delim) {
+    data = line.data();
+    size_t length = line.length();
+    if (length > 0 && line[length-1] == '\r') length--; // Deal with any left over \r from files prepared on Windows
+    if (starts.empty()) starts.resize(64);
+    starts[0] = 0; nFields = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] == delim) {
+            nFields++;
+            if (nFields + 1 > starts.size()) starts.resize(2 * starts.size());
+            starts[nFields] = i + 1;
+        }
+    }
+    // The last field, unless the line ended with the delimiter
+    if (length > 0 && data[length-1] != delim) {
+        nFields++;
+        if (nFields + 1 > starts.size()) starts.resize(2 * starts.size());
+        starts[nFields] = length + 1;
+    }
+}
+
+// Only biallelic SNPs are used in the calculations
+bool isBiallelicSNP(const LineTokenizer& fields) {
+    if (fields.fieldLength(3) > 1 || fields.fieldLength(4) > 1) return false;
+    if (*fields.field(4) == '*') return false;
+    return true;
+}
+
+template <class Genotypes> static void packGenotypes(const Genotypes& genotypes, size_t nSamples, unsigned char* packed) {
+    size_t nGenotypes = std::min(genotypes.size(), nSamples);
+    std::fill(packed, packed + PackedGenotypes::bytesNeeded(nSamples), 0);
+    for (size_t i = 0; i != nSamples; i++) {
+        int first = ALLELE_MISSING; int second = ALLELE_MISSING;
+        if (i < nGenotypes) { first = genotypes.allele(i, 0); second = genotypes.allele(i, 1); }
+        packed[i >> 1] |= (unsigned char)((first | (second << 2)) << ((i & 1) << 2));
+    }
+}
+
+void PackedGenotypes::pack(const LineTokenizer& fields, size_t nSamples, unsigned char* packed) {
+    packGenotypes(VCFLineGenotypes(fields), nSamples, packed);
+}
+
+void PackedGenotypes::pack(const BcfGenotypes& genotypes, size_t nSamples, unsigned char* packed) {
+    packGenotypes(genotypes, nSamples, packed);
+}
+
 std::vector<size_t> locateSet(std::vector<std::string>& sample_names, const std::vector<std::string>& set) {
     std::vector<size_t> setLocs;
     for (std::vector<std::string>::size_type i = 0; i != set.size(); i++) {
@@ -262,7 +353,15 @@ void assertGZOpen(gzstreambase& gh, const std::string& fn)
 // The caller is responsible for freeing the handle
 std::istream* createReader(const std::string& filename, std::ios_base::openmode mode)
 {
-    if(isGzip(filename))
+    if(isGzip(filename) && isBgzf(filename))
+    {
+        // BGZF blocks can be inflated independently, so this is done on several threads ahead of the reading
+        int nThreads = std::max(1, std::min(BGZF_MAX_INFLATE_THREADS, (int)std::thread::hardware_concurrency()));
+        ibgzfstream* pBGZF = new ibgzfstream(filename, nThreads);
+        if (!pBGZF->good()) { std::cerr << "Error: could not open " << filename << std::endl; exit(EXIT_FAILURE); }
+        return pBGZF;
+    }
+    else if(isGzip(filename))
     {
         igzstream* pGZ = new igzstream(filename.c_str(), mode);
         assertGZOpen(*pGZ, filename);
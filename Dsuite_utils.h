@@ -19,6 +19,8 @@
 #include <assert.h>
 #include <time.h>
 #include <regex>
+#include <stdint.h>
+#include <string.h>
 #include "gzstream.h"
 
 #define PROGRAM_BIN "Dsuite"
@@ -34,6 +36,7 @@ double stringToDouble(std::string s);
 std::string stripExtension(const std::string& filename);
 std::vector<std::string> split(const std::string &s, char delim);
 std::vector<size_t> locateSet(std::vector<std::string>& sample_names, const std::vector<std::string>& set);
+bool isGzip(const std::string& filename);
 std::istream* createReader(const std::string& filename, std::ios_base::openmode mode = std::ios_base::in);
 std::ostream* createWriter(const std::string& filename, std::ios_base::openmode mode = std::ios_base::out);
 bool file_exists(const std::string& name);
@@ -48,7 +51,7 @@ template <typename T> std::string numToString(T i) {
 }
 
 // Print an arbitrary vector to a file
-template <class T> void print_vector(T vector, std::ostream& outFile, char delim = '\t', bool endLine = true) {
+template <class T, class Stream> void print_vector(const T& vector, Stream& outFile, char delim = '\t', bool endLine = true) {
     for (int i = 0; i < vector.size(); i++) {
         if (i == (vector.size()-1)) {
             if (endLine) outFile << vector[i] << std::endl;
@@ -76,86 +79,198 @@ template <class T> double vector_sum(T vector) {
     return sum;
 }
 
-inline void copy_except(int i, std::vector<double>& inVec, std::vector<double>& outVec) {
-    std::copy(inVec.begin(), inVec.begin() + i, outVec.begin());
-    std::copy(inVec.begin() + i + 1, inVec.end(), outVec.begin()+i);
-    //std::cerr << "copying:" << i << " "; print_vector_stream(inVec, std::cerr);
-    //std::cerr << "copied: " << i << " "; print_vector_stream(outVec, std::cerr);
-}
-
 // jackknive standard error
-template <class T> double jackknive_std_err(T& vector) {
+// The delete-one means are (sum - x_i)/(n-1), so they differ from their own mean by (mean - x_i)/(n-1)
+// and the variance comes from the deviations of the values themselves, in O(n) without copying anything
+template <class T> double jackknive_std_err(const T& vector) {
     if (vector.size() <= 2) {
         throw "WARNING: Not enough blocks to calculate jackknife!!";
     }
-    std::vector<double> jackkniveAverages;
-    std::vector<double> JregionDs; JregionDs.resize(vector.size()-1);
-    for (std::vector<double>::size_type i = 0; i != vector.size(); i++) {
-        // std::cerr << "copying " << i << std::endl;
-        copy_except(i, vector, JregionDs);
-        jackkniveAverages.push_back(vector_average(JregionDs));
-        JregionDs.clear(); JregionDs.resize(vector.size()-1);
-    }
-    double jackkniveOverallMean = vector_average(jackkniveAverages);
+    double n = (double)vector.size();
     double sum = 0;
-    for (int i = 0; i < jackkniveAverages.size(); i++) {
-        sum += pow((jackkniveAverages[i] - jackkniveOverallMean), 2.0);
-    }
-    double var = ((double)(jackkniveAverages.size()-1)/(double)jackkniveAverages.size()) * sum;
+    for (size_t i = 0; i != vector.size(); i++) sum += vector[i];
+    double mean = sum / n;
+    double sumSquares = 0;
+    for (size_t i = 0; i != vector.size(); i++) sumSquares += (vector[i] - mean) * (vector[i] - mean);
+    double var = sumSquares / (n * (n - 1)); // = (n-1)/n * the sum of the squared deviations of the delete-one means
     double Dstd_err = sqrt(var);
     return Dstd_err;
 }
 
+// Splits a line into fields without copying them; field i is a pointer into the line plus a length
+// The offsets are kept between lines, so once the tokenizer has grown there are no per-line allocations
+// As with split(), a trailing delimiter does not start an empty last field; a trailing '\r' is ignored
+class LineTokenizer {
+public:
+    LineTokenizer() : data(NULL), nFields(0) {};
+    
+    void tokenize(const std::string& line, char delim = '\t');
+    size_t size() const { return nFields; }
+    const char* field(size_t i) const { return data + starts[i]; }
+    size_t fieldLength(size_t i) const { return starts[i+1] - starts[i] - 1; }
+    std::string fieldString(size_t i) const { return std::string(field(i), fieldLength(i)); }
+    void assignField(size_t i, std::string& s) const { s.assign(field(i), fieldLength(i)); }
+    
+private:
+    const char* data;
+    std::vector<size_t> starts; // starts[i+1] is one past the delimiter ending field i
+    size_t nFields;
+};
+
+bool isBiallelicSNP(const LineTokenizer& fields);
+
+// Alleles as used by the set counts: '0' and '1' from the VCF; anything else counts as missing
+static const int ALLELE_REF = 0;
+static const int ALLELE_ALT = 1;
+static const int ALLELE_MISSING = 2;
+
+// The genotypes straight from the fields of a VCF line, starting at NUM_NON_GENOTYPE_COLUMNS
+class VCFLineGenotypes {
+public:
+    VCFLineGenotypes(const LineTokenizer& fields) : fields(fields) {};
+    size_t size() const { return fields.size() - NUM_NON_GENOTYPE_COLUMNS; }
+    int allele(size_t i, int a) const { // a = 0 or 1: the first or the second allele of individual i
+        size_t c = 2 * a; if (fields.fieldLength(i + NUM_NON_GENOTYPE_COLUMNS) <= c) return ALLELE_MISSING;
+        char allele = fields.field(i + NUM_NON_GENOTYPE_COLUMNS)[c];
+        if (allele == '0') return ALLELE_REF; else if (allele == '1') return ALLELE_ALT; else return ALLELE_MISSING;
+    }
+private:
+    const LineTokenizer& fields;
+};
+
+// The genotypes from the typed GT values of a BCF record (see BcfRecord): each allele is (allele index + 1) << 1 | phased,
+// 0 when it is missing, and the vector end value when the individual has fewer alleles than the ploidy of the record
+class BcfGenotypes {
+public:
+    BcfGenotypes() : values(NULL), type(1), ploidy(0), nSamples(0) {};
+    BcfGenotypes(const unsigned char* values, int type, int ploidy, size_t nSamples) : values(values), type(type), ploidy(ploidy), nSamples(nSamples) {};
+    size_t size() const { return nSamples; } // 0 if the record has no GT
+    int allele(size_t i, int a) const {
+        if (a >= ploidy) return ALLELE_MISSING;
+        size_t k = i * ploidy + a; int value;
+        if (type == 1) value = (int8_t)values[k]; // The usual case
+        else if (type == 2) { int16_t v; memcpy(&v, values + 2 * k, 2); value = v; }
+        else { int32_t v; memcpy(&v, values + 4 * k, 4); value = v; }
+        int index = (value >> 1) - 1; // -1 for missing; the vector end values come out negative too
+        if (index == 0) return ALLELE_REF; else if (index == 1) return ALLELE_ALT; else return ALLELE_MISSING;
+    }
+private:
+    const unsigned char* values;
+    int type; // The BCF type: 1 int8, 2 int16, 3 int32
+    int ploidy;
+    size_t nSamples;
+};
+
+// Genotypes packed into two bits per allele; individual i is in the low (even i) or high (odd i) half of byte i/2
+class PackedGenotypes {
+public:
+    PackedGenotypes(const unsigned char* packed, size_t nSamples) : packed(packed), nSamples(nSamples) {};
+    size_t size() const { return nSamples; }
+    int allele(size_t i, int a) const { return (packed[i >> 1] >> (((i & 1) << 2) + (a << 1))) & 3; }
+    static size_t bytesNeeded(size_t nSamples) { return (nSamples + 1) / 2; }
+    static void pack(const LineTokenizer& fields, size_t nSamples, unsigned char* packed); // Genotypes missing from the line are packed as missing
+    static void pack(const BcfGenotypes& genotypes, size_t nSamples, unsigned char* packed);
+private:
+    const unsigned char* packed;
+    size_t nSamples;
+};
+
+// The sets (usually species) with dense integer IDs, built once from the VCF header
+// The IDs follow the (alphabetical) order of the setsToPosMap
+class SetIndex {
+public:
+    SetIndex(const std::map<string, std::vector<size_t>>& setsToPosMap, const int nSamples);
+    
+    int getID(const string& setName) const; // -1 if there is no such set
+    
+    std::vector<string> setNames; // ID -> set name
+    std::vector<size_t> setSizes;
+    std::vector<int> sampleToSet; // VCF sample index -> set ID; -1 for samples that are not in any set
+    int outgroupID; // -1 if there is no Outgroup set
+};
+
 class GeneralSetCounts {
 public:
-    GeneralSetCounts(const std::map<string, std::vector<size_t>>& setsToPosMap, const int nSamples) : overall(0) {
-        for(std::map<string, std::vector<size_t>>::const_iterator it = setsToPosMap.begin(); it != setsToPosMap.end(); ++it) {
-            setAltCounts[it->first] = 0; setAlleleCounts[it->first] = 0;
-            setAAFs[it->first] = -1.0; setDAFs[it->first] = -1.0;
-            setSizes.push_back(it->second.size());
-        }
+    GeneralSetCounts(const SetIndex& sets, const int nSamples) : overall(0), sets(sets) {
+        int nSets = (int)sets.setNames.size();
+        setAltCounts.assign(nSets, 0); setAlleleCounts.assign(nSets, 0);
+        setAAFs.assign(nSets, -1.0); setDAFs.assign(nSets, -1.0);
+        setSizes = sets.setSizes;
         individualsWithVariant.assign(nSamples, 0);
     };
     
-    void getSetVariantCountsSimple(const std::vector<std::string>& genotypes, const std::map<size_t, string>& posToSpeciesMap);
-    void getSetVariantCounts(const std::vector<std::string>& genotypes, const std::map<size_t, string>& posToSpeciesMap);
+    // Clears the counts, so that one object can be reused for site after site without any allocations
+    void reset();
     
+    // The genotypes are read straight from the VCF line fields, starting at NUM_NON_GENOTYPE_COLUMNS
+    void getSetVariantCountsSimple(const LineTokenizer& fields);
+    void getSetVariantCounts(const LineTokenizer& fields);
+    // or from a packed genotype cache (see PackedGenotypes)
+    void getSetVariantCounts(const unsigned char* packedGenotypes);
+    // or from a BCF record
+    void getSetVariantCounts(const BcfGenotypes& genotypes);
+    
+    // All the per-set values are indexed by the set IDs from the SetIndex
     int overall;
-    std::map<string,int> setAltCounts;
-    std::map<string,int> setAlleleCounts; // The number of non-missing alleles for this set
+    std::vector<int> setAltCounts;
+    std::vector<int> setAlleleCounts; // The number of non-missing alleles for this set
     std::vector<size_t> setSizes;
-    std::map<string,double> setAAFs; // Allele frequencies - alternative allele
-    std::map<string,double> setDAFs; // Allele frequencies - derived allele
+    std::vector<double> setAAFs; // Allele frequencies - alternative allele
+    std::vector<double> setDAFs; // Allele frequencies - derived allele
     std::vector<int> individualsWithVariant; // 0 homRef, 1 het, 2 homAlt
     // std::vector<int> set1individualsWithVariant; std::vector<int> set2individualsWithVariant;
     // std::vector<int> set3individualsWithVariant; std::vector<int> set4individualsWithVariant;
     
+protected:
+    const SetIndex& sets;
+    int getAncestralAllele() const;
+    
 private:
-    void getBasicCounts(const std::vector<std::string>& genotypes, const std::map<size_t, string>& posToSpeciesMap);
+    template <class Genotypes> void getBasicCounts(const Genotypes& genotypes);
+    void fillFrequencies();
 };
 
+// The splitmix64 finalizer: 64 well mixed bits from a counter, used for the random splits for f_G
+inline uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Uniform on [0,1) from mix64 of successive values of the counter
+inline double mix64Uniform(uint64_t& counter) { return (double)(mix64(counter++) >> 11) * (1.0 / 9007199254740992.0); }
+
+// The key for the random splits at a site: it depends only on the seed, the chromosome and the position, so that a site is split
+// the same way however the input is read (VCF, BCF, genotype cache, regions) and on whichever thread
+uint64_t splitSiteKey(uint64_t seed, const std::string& chr, uint64_t pos);
+
 // Split sets for the f_G statistic
+// Each individual goes to split 1 or split 2 at random, with the random bits for 64 individuals at a time from mix64(siteKey + k)
 class GeneralSetCountsWithSplits : public GeneralSetCounts {
 public:
-    GeneralSetCountsWithSplits(const std::map<string, std::vector<size_t>>& setsToPosMap, const int nSamples) : GeneralSetCounts(setsToPosMap,nSamples) {
-        for(std::map<string, std::vector<size_t>>::const_iterator it = setsToPosMap.begin(); it != setsToPosMap.end(); ++it) {
-            setAAFsplit1[it->first] = -1.0; setAAFsplit2[it->first] = -1.0; setDAFsplit1[it->first] = -1.0; setDAFsplit2[it->first] = -1.0;
-            setAlleleCountsSplit1[it->first] = 0; setAlleleCountsSplit2[it->first] = 0; setAltCountsSplit1[it->first] = 0; setAltCountsSplit2[it->first] = 0;
-        }
+    GeneralSetCountsWithSplits(const SetIndex& sets, const int nSamples) : GeneralSetCounts(sets,nSamples) {
+        int nSets = (int)sets.setNames.size();
+        setAAFsplit1.assign(nSets, -1.0); setAAFsplit2.assign(nSets, -1.0); setDAFsplit1.assign(nSets, -1.0); setDAFsplit2.assign(nSets, -1.0);
+        setAlleleCountsSplit1.assign(nSets, 0); setAlleleCountsSplit2.assign(nSets, 0); setAltCountsSplit1.assign(nSets, 0); setAltCountsSplit2.assign(nSets, 0);
     }
-    std::map<string,int> setAltCountsSplit1;
-    std::map<string,int> setAltCountsSplit2;
-    std::map<string,double> setAAFsplit1; // Allele frequencies - alternative allele
-    std::map<string,double> setAAFsplit2; //
-    std::map<string,double> setDAFsplit1; // Allele frequencies - derived allele, in the complement of the set
-    std::map<string,double> setDAFsplit2;
-    std::map<string,int> setAlleleCountsSplit1; // The number of non-missing alleles for the complement of this set
-    std::map<string,int> setAlleleCountsSplit2;
+    std::vector<int> setAltCountsSplit1;
+    std::vector<int> setAltCountsSplit2;
+    std::vector<double> setAAFsplit1; // Allele frequencies - alternative allele
+    std::vector<double> setAAFsplit2; //
+    std::vector<double> setDAFsplit1; // Allele frequencies - derived allele, in the complement of the set
+    std::vector<double> setDAFsplit2;
+    std::vector<int> setAlleleCountsSplit1; // The number of non-missing alleles for the complement of this set
+    std::vector<int> setAlleleCountsSplit2;
     
-    void getSplitCounts(const std::vector<std::string>& genotypes, const std::map<size_t, string>& posToSpeciesMap);
+    void reset();
+    void getSplitCounts(const LineTokenizer& fields, uint64_t siteKey);
+    void getSplitCounts(const unsigned char* packedGenotypes, uint64_t siteKey);
+    void getSplitCounts(const BcfGenotypes& genotypes, uint64_t siteKey);
 
 private:
-    void getBasicCounts(const std::vector<std::string>& genotypes, const std::map<size_t, string>& posToSpeciesMap);
+    template <class Genotypes> void getBasicCounts(const Genotypes& genotypes, uint64_t siteKey);
+    void fillSplitFrequencies();
 };
 
 #endif /* Dsuite_utils_h */
@@ -68,6 +68,7 @@ namespace GZSTREAM_NAMESPACE {
         file = gzopen( name, fmode);
         if (file == 0)
             return (gzstreambuf*)0;
+        gzbuffer( file, 1<<17); // A larger zlib buffer too (the default is 8kb)
         opened = 1;
         return this;
     }
@@ -49,8 +49,8 @@
 
 class gzstreambuf : public std::streambuf {
 private:
-    static const int bufferSize = 47+256;    // size of data buff
-    // totals 512 bytes under g++ for igzstream at the end.
+    static const int bufferSize = 4+(1<<17);    // size of data buff
+    // 4 bytes of putback area and 128kb of data, so that gzread() is called rarely
     
     gzFile           file;               // file handle for compressed file
     char             buffer[bufferSize]; // data buffer
@@ -0,0 +1,78 @@
+#!/bin/bash
+#
+#  scaling_benchmark.sh
+#  Dsuite
+#
+#  Created by Milan Malinsky on 17/10/2026.
+#
+# How Dtrios and Dinvestigate scale with the number of species, the individuals per species, the missing data and the number of sites
+# Every combination of the values below is simulated with "Dsuite simulate" (with the same seed, so the data sets are the same
+# from one run of the script to the next) and then analysed; the wall time, peak memory (RSS) and throughput of each command
+# are written to standard output as a tab-separated table
+#
+# The values can be changed through the environment, e.g.:
+#   SPECIES="10 100 1000" SITES="100000" THREADS=8 ./scaling_benchmark.sh > scaling.txt
+# The peak memory comes from GNU time (/usr/bin/time) if it is there, otherwise from python3
+
+DSUITE=${DSUITE:-./Build/Dsuite}
+SPECIES=${SPECIES:-"10 20 50 100"}
+INDIVIDUALS=${INDIVIDUALS:-"5"}
+MISSING=${MISSING:-"0.02"}
+SITES=${SITES:-"100000"}
+THREADS=${THREADS:-1}
+SEED=${SEED:-1}
+WORKDIR=${WORKDIR:-$(mktemp -d)}
+KEEP=${KEEP:-0} # 1 to keep the simulated data sets and the results in WORKDIR
+
+DSUITE=$(cd "$(dirname "$DSUITE")" && pwd)/$(basename "$DSUITE")
+if [ ! -x "$DSUITE" ]; then echo "Can't find $DSUITE; type make first, or set DSUITE" >&2; exit 1; fi
+mkdir -p "$WORKDIR"
+
+# Runs a command in WORKDIR with its output going to LOG; prints the wall time in seconds and the peak RSS in KB
+measure() {
+    local log=$1; shift
+    if [ -x /usr/bin/time ] && /usr/bin/time -f "%e" true > /dev/null 2>&1; then
+        (cd "$WORKDIR" && /usr/bin/time -f "%e %M" -o "$log.time" "$@" > "$log" 2>&1) || return 1
+        cat "$log.time"
+    else
+        (cd "$WORKDIR" && python3 -c '
+import resource, subprocess, sys, time
+start = time.time()
+with open(sys.argv[1], "w") as log: status = subprocess.call(sys.argv[2:], stdout=log, stderr=subprocess.STDOUT)
+print("%.2f %d" % (time.time() - start, resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss))
+sys.exit(status)' "$log" "$@") || return 1
+    fi
+}
+
+printf "command\tspecies\tindividuals\tmissing\tsites\tthreads\ttrios\twall_s\tpeak_rss_kb\tsites_per_s\ttrio_sites_per_s\n"
+for nSpecies in $SPECIES; do
+for nIndividuals in $INDIVIDUALS; do
+for missing in $MISSING; do
+for nSites in $SITES; do
+    name="sim_${nSpecies}_${nIndividuals}_${missing}_${nSites}"
+    nTrios=$(( nSpecies * (nSpecies - 1) * (nSpecies - 2) / 6 ))
+    row() { # command, number of trios, the output of measure
+        set -- "$1" "$2" $3
+        awk -v c="$1" -v n="$nSpecies" -v i="$nIndividuals" -v m="$missing" -v l="$nSites" -v t="$THREADS" -v trios="$2" -v s="$3" -v rss="$4" \
+            'BEGIN { printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%.0f\t%.0f\n", c, n, i, m, l, t, trios, s, rss, (s > 0 ? l / s : 0), (s > 0 ? l * trios / s : 0) }'
+    }
+
+    result=$(measure "$name.simulate.log" "$DSUITE" simulate --species="$nSpecies" --individuals="$nIndividuals" --missing="$missing" --sites="$nSites" \
+        --seed="$SEED" --threads="$THREADS" "$name") || { echo "Dsuite simulate failed; see $WORKDIR/$name.simulate.log" >&2; exit 1; }
+    row simulate 0 "$result"
+
+    # Jackknife blocks of about 1% of the sites, so that there are enough of them for any number of sites
+    result=$(measure "$name.Dtrios.log" "$DSUITE" Dtrios -j $(( nSites / 100 > 1 ? nSites / 100 : 2 )) -t "${name}_tree.nwk" --threads="$THREADS" \
+        "$name.vcf.gz" "${name}_sets.txt") || { echo "Dsuite Dtrios failed; see $WORKDIR/$name.Dtrios.log" >&2; exit 1; }
+    row Dtrios "$nTrios" "$result"
+
+    result=$(measure "$name.Dinvestigate.log" "$DSUITE" Dinvestigate -w 50,25 --threads="$THREADS" --single-file="${name}_localFstats.txt" \
+        "$name.vcf.gz" "${name}_sets.txt" "${name}_trios.txt") || { echo "Dsuite Dinvestigate failed; see $WORKDIR/$name.Dinvestigate.log" >&2; exit 1; }
+    row Dinvestigate "$(wc -l < "$WORKDIR/${name}_trios.txt" | tr -d ' ')" "$result"
+
+    if [ "$KEEP" != 1 ]; then rm -f "$WORKDIR/$name"*; fi
+done
+done
+done
+done
+if [ "$KEEP" != 1 ]; then rmdir "$WORKDIR" 2> /dev/null; fi
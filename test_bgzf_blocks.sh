@@ -0,0 +1,70 @@
+#!/bin/bash
+#
+#  test_bgzf_blocks.sh
+#  Dsuite
+#
+#  Created by Milan Malinsky on 17/10/2026.
+#
+# Checks that bgzipped VCFs are read correctly whatever the number of BGZF blocks, in particular when the blocks fill a whole
+# number of read-ahead jobs (64 blocks each) so that the empty block at the end of the file is in a job on its own; both
+# from the start of the file and after seeking into it with an index made by Dsuite index (Dtrios --region=start,length)
+# The files are written by python3 with a given number of lines in each block, and the results should be the same as for the plain VCF
+# Usage: ./test_bgzf_blocks.sh (or make test); exits with 1 if any of the outputs differ
+
+DSUITE=${DSUITE:-./Build/Dsuite}
+DSUITE=$(cd "$(dirname "$DSUITE")" && pwd)/$(basename "$DSUITE")
+if [ ! -x "$DSUITE" ]; then echo "Can't find $DSUITE; type make first, or set DSUITE" >&2; exit 1; fi
+if ! command -v python3 > /dev/null; then echo "python3 is not installed; not testing the BGZF blocks" >&2; exit 0; fi
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+cd "$WORKDIR" || exit 1
+
+"$DSUITE" simulate --species=6 --sites=12600 --chromosomes=1 --no-gzip sim 2> /dev/null || { echo "Dsuite simulate failed" >&2; exit 1; }
+
+# bgzip IN OUT N: the header in one block and the variant lines split evenly over N blocks, then the empty end-of-file block
+bgzip() {
+    python3 -c '
+import sys, zlib, struct
+lines = open(sys.argv[1], "rb").read().splitlines(True)
+header = [l for l in lines if l.startswith(b"#")]; variants = lines[len(header):]; n = int(sys.argv[3])
+def block(data):
+    c = zlib.compressobj(6, zlib.DEFLATED, -15); d = c.compress(data) + c.flush()
+    return struct.pack("<BBBBIBBHBBHH", 31, 139, 8, 4, 0, 0, 255, 6, 66, 67, 2, len(d) + 25) + d + struct.pack("<II", zlib.crc32(data) & 0xffffffff, len(data))
+with open(sys.argv[2], "wb") as out:
+    out.write(block(b"".join(header)))
+    for i in range(n): out.write(block(b"".join(variants[len(variants) * i // n:len(variants) * (i + 1) // n])))
+    out.write(block(b""))' "$@"
+}
+
+# run NAME INPUT [Dtrios options]: Dtrios in the directory NAME
+run() {
+    local dir=$1 input=$2; shift 2
+    mkdir "$dir" && (cd "$dir" && cp ../sim_sets.txt sets.txt && "$DSUITE" Dtrios -j 500 "$@" "../$input" sets.txt > Dtrios.log 2>&1)
+}
+
+failed=0
+# compare NAME REFERENCE_NAME
+compare() {
+    for f in "$2"/*.txt; do
+        if ! cmp -s "$f" "$1/$(basename "$f")"; then echo "FAILED: $(basename "$f") differs between $2 and $1" >&2; failed=1; fi
+    done
+}
+
+run plain sim.vcf || { echo "FAILED: Dsuite on sim.vcf; see the logs" >&2; exit 1; }
+run plain_region sim.vcf --region=6201,10000 || { echo "FAILED: Dsuite on sim.vcf with --region; see the logs" >&2; exit 1; }
+tested=""
+# 63, 64 and 128 data blocks: with 64 and 128 the end-of-file block is a job of its own
+for nVariantBlocks in 62 63 127; do
+    input=sim_$((nVariantBlocks + 1)).vcf.gz
+    bgzip sim.vcf "$input" $nVariantBlocks || { echo "Could not write $input" >&2; exit 1; }
+    if run "out_$input" "$input"; then compare "out_$input" plain; else echo "FAILED: Dsuite on $input; see the logs" >&2; failed=1; fi
+    tested="$tested $input"
+done
+# After seeking to the start of the 63rd of 126 blocks of 100 variants, 64 blocks are left
+bgzip sim.vcf sim_seek.vcf.gz 126 && "$DSUITE" index -i 100 sim_seek.vcf.gz > /dev/null 2>&1 || { echo "Could not write and index sim_seek.vcf.gz" >&2; exit 1; }
+if run out_seek sim_seek.vcf.gz --region=6201,10000 && grep -q "skip the first 6200 variants" out_seek/Dtrios.log; then compare out_seek plain_region
+else echo "FAILED: Dsuite on sim_seek.vcf.gz with the index; see the logs" >&2; failed=1; fi
+tested="$tested sim_seek.vcf.gz(--region=6201,10000)"
+
+if [ $failed == 0 ]; then echo "PASSED: bgzipped VCFs give the same results as the plain VCF for:$tested"; fi
+exit $failed
@@ -0,0 +1,45 @@
+#!/bin/bash
+#
+#  test_regions_order.sh
+#  Dsuite
+#
+#  Created by Milan Malinsky on 17/10/2026.
+#
+# Checks that --regions gives the same results however the input is read when the BED file is not in the order of the VCF
+# (chr2 before chr1): a plain VCF (read through), a genotype cache, and a bgzipped VCF with a tabix index if bgzip and tabix
+# are installed. The regions should be visited in the order of the file in every case, so that the jackknife blocks,
+# and so the standard errors and p-values, are the same
+# Usage: ./test_regions_order.sh (or make test); exits with 1 if any of the outputs differ
+
+DSUITE=${DSUITE:-./Build/Dsuite}
+DSUITE=$(cd "$(dirname "$DSUITE")" && pwd)/$(basename "$DSUITE")
+if [ ! -x "$DSUITE" ]; then echo "Can't find $DSUITE; type make first, or set DSUITE" >&2; exit 1; fi
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+cd "$WORKDIR" || exit 1
+
+"$DSUITE" simulate --species=6 --sites=20000 --chromosomes=2 --no-gzip sim 2> /dev/null || { echo "Dsuite simulate failed" >&2; exit 1; }
+printf "chr2\t100\t600000\nchr1\t20000\t900000\nchr2\t700000\t800000\n" > unsorted.bed
+"$DSUITE" cache sim.vcf sim.dsgt > /dev/null 2>&1 || { echo "Dsuite cache failed" >&2; exit 1; }
+inputs="sim.vcf sim.dsgt"
+if command -v bgzip > /dev/null && command -v tabix > /dev/null; then
+    bgzip -c sim.vcf > sim.vcf.gz && tabix -p vcf sim.vcf.gz && inputs="$inputs sim.vcf.gz"
+else
+    echo "bgzip and tabix are not installed; not testing the tabix index" >&2
+fi
+
+failed=0
+for input in $inputs; do
+    dir=out_${input//./_}; mkdir "$dir"
+    (cd "$dir" && cp ../sim_sets.txt sets.txt &&
+     "$DSUITE" Dtrios -j 500 --regions=../unsorted.bed "../$input" sets.txt > Dtrios.log 2>&1 &&
+     "$DSUITE" Dinvestigate -w 50,10 --single-file=localFstats.txt --regions=../unsorted.bed "../$input" sets.txt ../sim_trios.txt > Dinvestigate.txt 2> Dinvestigate.log) \
+        || { echo "FAILED: Dsuite on $input; see the logs" >&2; failed=1; continue; }
+    if [ "$input" != sim.vcf ]; then
+        for f in out_sim_vcf/*.txt; do
+            if ! cmp -s "$f" "$dir/$(basename "$f")"; then echo "FAILED: $(basename "$f") differs between sim.vcf and $input" >&2; failed=1; fi
+        done
+    fi
+done
+if [ $failed == 0 ]; then echo "PASSED: --regions with an unsorted BED gives the same results for: $inputs"; fi
+exit $failed